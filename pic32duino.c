@@ -25,7 +25,11 @@
 #pragma config FPLLODIV = DIV_4					//PLL output divider=DIV_1/2/4/8/16/32/64/256
 //end PLL configuration
 //F_PBDIV = F_SYSCLK / FPBDIV
+#if defined(USE_FASTBOOT)
+#pragma config FPBDIV = DIV_1					//peripheral bus clock divider = 1x, as mcuInit() wants it
+#else
 #pragma config FPBDIV = DIV_8					//peripheral bus clock divider = 8x
+#endif
 #pragma config OSCIOFNC = OFF, FCKSM = CSECMD	//clock output disabled, clock switching disabled
 #pragma config ICESEL = RESERVED				//use PGD1/PGC1,
 #pragma config PMDL1WAY = OFF, IOL1WAY = OFF	//peripheral configuration allows multiple configuration (OFF) or one configuration (ON), PPS allows multiple configuration (OFF)/one configuration(ON)
@@ -368,10 +372,98 @@ const PIN2GPIO GPIO_PinDef[]= {
 #endif	//GPIOG
 };
 
+//send an unsigned number in decimal
+static void _putu(void (*putch)(char), uint32_t dat) {
+	char str[10];
+	uint8_t i=0;
+
+	do {
+		str[i++] = '0' + (dat % 10);
+		dat /= 10;
+	} while (dat);
+	while (i) putch(str[--i]);
+}
+
+//isr statistics
+#if defined(USE_ISRSTATS)
+static volatile ISR_StatTypeDef _isr_stats[ISR_MAX];
+static const char * const _isr_names[ISR_MAX] = {
+	"ct", "u1", "u2", "t1", "t2", "t3", "t4", "t5", "adc",
+	"oc1", "oc2", "oc3", "oc4", "oc5", "ic1", "ic2", "ic3", "ic4", "ic5",
+	"int0", "int1", "int2", "int3", "int4", "dma0", "dma1", "dma2", "dma3",
+	"spi1", "spi2", "i2c1", "i2c2", "cn"};
+static volatile uint32_t _isr_t0[ISR_MAX];		//entry time of the current run
+static const uint16_t _isr_tmrps[8] = {1, 2, 4, 8, 16, 32, 64, 256};	//tmr2-5 prescalers
+static const uint16_t _isr_tmr1ps[4] = {1, 8, 64, 256};				//tmr1 prescalers
+
+//first / last statement of an isr. l = ticks since the event that raised the interrupt
+#define ISR_ENTER(v, l)		do {uint32_t _lat = (l); _isr_t0[v] = coreticks(); if (_lat > _isr_stats[v].lat) _isr_stats[v].lat = _lat;} while (0)
+#define ISR_EXIT(v)			_isrExit(v)
+#define ISR_LAT_CT			(2 * (_CP0_GET_COUNT() - _CP0_GET_COMPARE()))	//core timer counts at half the tick rate
+#define ISR_LAT_TMR(tmr, ckps, t1)	_isrTmrLat(tmr, ckps, t1)			//tmrx restarts from 0 at the period match
+#define ISR_LAT_OC(ocr)		((uint32_t) (uint16_t) (TMR2 - (ocr)) << OSCCONbits.PBDIV)	//oc on tmr2, 1:1
+
+//close a run of vector v
+static void _isrExit(uint8_t v) {
+	uint32_t dt = coreticks() - _isr_t0[v];
+
+	_isr_stats[v].cnt += 1;
+	if (dt > _isr_stats[v].dur) _isr_stats[v].dur = dt;
+}
+
+//tmr count since the period match -> ticks
+static uint32_t _isrTmrLat(uint16_t cnt, uint8_t ckps, uint8_t t1) {
+	return ((uint32_t) cnt * (t1 ? _isr_tmr1ps[ckps & 3] : _isr_tmrps[ckps & 7])) << OSCCONbits.PBDIV;
+}
+
+//statistics of vector v
+volatile ISR_StatTypeDef *isrStats(uint8_t v) {
+	return &_isr_stats[v];
+}
+
+//clear all statistics
+void isrStatsReset(void) {
+	uint32_t tmp = __builtin_get_isr_state();
+	uint8_t v;
+
+	di();
+	for (v=0; v<ISR_MAX; v++) {_isr_stats[v].cnt = _isr_stats[v].dur = _isr_stats[v].lat = 0;}
+	__builtin_set_isr_state(tmp);
+}
+
+//csv dump of the vectors that have run: isr,count,max,lat, in ticks
+void isrReport(void (*putch)(char)) {
+	ISR_StatTypeDef s;
+	uint32_t tmp;
+	uint8_t v;
+	const char *str;
+
+	for (str = "isr,count,max,lat\r\n"; *str; ) putch(*str++);
+	for (v=0; v<ISR_MAX; v++) {
+		tmp = __builtin_get_isr_state();
+		di();										//consistent snapshot
+		s = _isr_stats[v];
+		__builtin_set_isr_state(tmp);
+		if (s.cnt == 0) continue;
+		for (str = _isr_names[v]; *str; ) putch(*str++);
+		putch(','); _putu(putch, s.cnt);
+		putch(','); _putu(putch, s.dur);
+		putch(','); _putu(putch, s.lat);
+		putch('\r'); putch('\n');
+	}
+}
+#else
+#define ISR_ENTER(v, l)
+#define ISR_EXIT(v)
+#endif	//USE_ISRSTATS
+//end isr statistics
+
 //set up core timer
 //global variables
 uint32_t SystemCoreClock=F_FRC;					//System core clock, in Hz, = SYSCLK, updated by SystemCoreClockUpdate()
 volatile uint32_t systick_count=0;				//systick counter
+static void _timeUpdate(void);					//refresh the tick conversions, in Time
+static uint64_t _ticks64Update(void);			//extend coreticks() to 64 bits, in Time
 
 //read sysclock back
 //needs to be executed during mcu initialization or after oscillator reconfiguration
@@ -594,7 +686,9 @@ uint32_t SystemCoreClockUpdate(void) {
 		tmp = F_FRC;
 		break;
 	}
-	return SystemCoreClock = tmp;					//update _F_CPU
+	SystemCoreClock = tmp;							//update _F_CPU
+	_timeUpdate();									//refresh the tick conversions for the new clock
+	return SystemCoreClock;
 }
 
 //switch sysclock back
@@ -610,11 +704,14 @@ uint32_t SystemCoreClockUpdate(void) {
 //000 = Internal Fast Internal RC Oscillator (FRC)
 //On Reset, these bits are set to the value of the FNOSC Configuration bits (DEVCFG1<2:0>).
 //cannot run in 16-bit mode
-uint32_t SystemCoreClockSwitch(uint8_t nosc) {
+static void _clkSwitch(uint8_t nosc) {
 	unsigned int tmp=__builtin_get_isr_state();								//read current isr state
 
 	//disable interrupt and dma
 	di();
+#if defined(_CHECON_PFMWS_MASK)
+	CHECONbits.PFMWS = 7;						//worst case until the new clock is known
+#endif
 	do {
 		//perform the unlock sequency
 		SYSKEY = 0xAA996655;
@@ -626,11 +723,99 @@ uint32_t SystemCoreClockSwitch(uint8_t nosc) {
 	} while (OSCCONbits.OSWEN);						//1->switch not successful
 	ei();
 	__builtin_set_isr_state(tmp);					//restore isr state
-	return SystemCoreClockUpdate();
+}
+
+//clock change notification
+static void (* _clk_notify[CLK_NOTIFYMAX])(void);	//called after each clock change
+static uint8_t _clk_nnotify=0;
+
+//call fn after every clock change made by SystemCoreClockSwitch() / SystemCoreClockSet()
+//returns 1 if registered (or already registered), 0 if the list is full
+uint8_t SystemCoreClockNotify(void (*fn)(void)) {
+	uint8_t i;
+
+	for (i=0; i<_clk_nnotify; i++) if (_clk_notify[i] == fn) return 1;
+	if (_clk_nnotify == CLK_NOTIFYMAX) return 0;
+	_clk_notify[_clk_nnotify++] = fn;
+	return 1;
+}
+
+//the clock has changed: update SystemCoreClock and the tick conversions, re-tune the flash, rebase the peripherals
+static void _clkChanged(void) {
+	uint8_t i;
+
+	SystemCoreClockUpdate();
+	SystemPerformanceConfig();						//re-tune the wait states for the new clock
+	for (i=0; i<_clk_nnotify; i++) _clk_notify[i]();
+}
+
+uint32_t SystemCoreClockSwitch(uint8_t nosc) {
+	_clkSwitch(nosc);
+	_clkChanged();
+	return SystemCoreClock;
+}
+
+//run from the pll at the fastest clock not above hz (or the slowest pll clock if hz is below that)
+//the pll runs from the primary oscillator if that is the current source, from the frc otherwise
+//PLLMULT / PLLODIV can only change with the pll off: the cpu goes through the frc on the way
+//returns SystemCoreClock
+uint32_t SystemCoreClockSet(uint32_t hz) {
+	static const uint8_t pllmult[8] = {15, 16, 17, 18, 19, 20, 21, 24};	//PLLMULT 0..7
+	static const uint8_t pllidiv[8] = {1, 2, 3, 4, 5, 6, 10, 12};		//FPLLIDIV 0..7
+	uint32_t fin, f, best=0;
+	uint8_t m, d, bm=0, bd=7, pb, nosc;
+	unsigned int tmp;
+
+	//pll input
+	if (((OSCCON & CLKCOSC_FRCDIV) == CLKCOSC_POSC) || ((OSCCON & CLKCOSC_FRCDIV) == CLKCOSC_POSCPLL)) {
+		nosc = CLKNOSC_POSCPLL >> 8; fin = F_XTAL;
+	} else {
+		nosc = CLKNOSC_FRCPLL >> 8; fin = F_FRC;
+	}
+	fin /= pllidiv[DEVCFG2bits.FPLLIDIV];
+	if (hz > F_SYSMAX) hz = F_SYSMAX;
+	//fastest mult / odiv combination not above hz
+	for (m=0; m<8; m++)
+		for (d=0; d<8; d++) {
+			f = fin * pllmult[m] / ((d < 7) ? (1ul << d) : 256);
+			if ((f <= hz) && (f > best)) {best = f; bm = m; bd = d;}
+		}
+	if (best == 0) best = fin * pllmult[bm] / 256;	//below the pll range: slowest clock
+	for (pb=0; (pb<3) && ((best >> pb) > F_PHBMAX); pb++) continue;	//PBDIV: 0->1:1 .. 3->8:1
+
+	//pll off, set it up, then back on
+	if (((OSCCON & CLKCOSC_FRCDIV) == CLKCOSC_POSCPLL) || ((OSCCON & CLKCOSC_FRCDIV) == CLKCOSC_FRCPLL)) _clkSwitch(CLKNOSC_FRC >> 8);
+	tmp=__builtin_get_isr_state(); di();			//no interrupts while osccon is unlocked
+	SYS_UNLOCK();
+	OSCCONCLR = CLKPLLMULT_24 | CLKPLLDIV_256;
+	OSCCONSET = ((uint32_t) bm << 16) | ((uint32_t) bd << 27);
+	OSCCONbits.PBDIV = pb;
+	SYS_LOCK();
+	__builtin_set_isr_state(tmp);					//restore isr state
+	_clkSwitch(nosc);
+	_clkChanged();
+	return SystemCoreClock;
+}
+
+//flash wait states and prefetch for SystemCoreClock
+//the wait states must go up before switching to a faster clock - SystemCoreClockSwitch() does that
+void SystemPerformanceConfig(void) {
+	unsigned int tmp=__builtin_get_isr_state();
+
+	di();
+#if defined(_CHECON_PFMWS_MASK)
+	CHECONbits.PFMWS = (SystemCoreClock - 1) / F_FLASH;	//minimum wait states for SYSCLK
+#endif
+#if defined(_CHECON_PREFEN_MASK)
+	CHECONbits.PREFEN = 3;							//predictive prefetch for cacheable and non-cacheable regions
+#endif
+	_CP0_SET_CONFIG((_CP0_GET_CONFIG() & ~0x07) | 0x03);	//K0=3: kseg0 cacheable
+	__builtin_set_isr_state(tmp);
 }
 
 //initialize core timer compare / period
 uint32_t _coretimer_pr=0;							//core timer period
+static uint32_t _coretimer_pr0=0, _coretimer_hz=0;	//period as set, in ticks, and SystemCoreClock it was set at
 static void (* _coretimer_isrptr)(void)=empty_handler;				//tmr1_ptr pointing to empty_handler by default
 
 //initialize core timer - used for ticks()
@@ -647,12 +832,16 @@ void coretimer_init(void) {
 	// Set up core timer interrupt
 	// clear core timer interrupt flag
 	IFS0CLR = _IFS0_CTIF_MASK;
-	// set core time interrupt priority of 2
+	// set core time interrupt priority of 2, or the one CT_ISRIPL builds the vector for
 	IPC0CLR = _IPC0_CTIP_MASK;
-	IPC0SET = (2 << _IPC0_CTIP_POSITION);
+#if defined(CT_ISRIPL)
+	IPC0SET = (ISRIPL_PRIO(CT_ISRIPL) << _IPC0_CTIP_POSITION);
+#else
+	IPC0SET = (CT_IPDEFAULT << _IPC0_CTIP_POSITION);
+#endif
 	// set core time interrupt subpriority of 0
 	IPC0CLR = _IPC0_CTIS_MASK;
-	IPC0SET = (0 << _IPC0_CTIS_POSITION);
+	IPC0SET = (CT_ISDEFAULT << _IPC0_CTIS_POSITION);
 	// disenable core timer interrupt
 	IEC0CLR = _IEC0_CTIE_MASK;
 	IEC0CLR = (1 << _IEC0_CTIE_POSITION);
@@ -660,8 +849,16 @@ void coretimer_init(void) {
 	//_coretimer_isrptr=empty_handler;
 }
 
+//keep the period in time across clock changes - the period in flight runs out at the old rate
+static void _coretimerRebase(void) {
+	_coretimer_pr = (uint64_t) _coretimer_pr0 * SystemCoreClock / _coretimer_hz / 2;	//from the period as set: no error build-up
+}
+
 //set core timer period
 uint32_t coretimer_setpr(uint32_t pr) {
+	_coretimer_pr0 = pr;
+	_coretimer_hz = SystemCoreClock;
+	SystemCoreClockNotify(_coretimerRebase);		//and rescaled after each clock change
 	_coretimer_pr = pr / 2;
 	_CP0_SET_COMPARE(_CP0_GET_COMPARE() + _coretimer_pr);
 	return coreticks();
@@ -673,21 +870,169 @@ uint32_t coretimer_getpr(void) {
 }
 
 //core timer isr
-void __ISR(_CORE_TIMER_VECTOR, ipl2) CoreTimerHandler(void) {
+#if !defined(CT_HANDLER)
+#define CT_HANDLER()		_coretimer_isrptr()
+#endif
+#if defined(CT_ISRIPL)
+#define CT_ISR		__ISR(_CORE_TIMER_VECTOR, CT_ISRIPL)
+#else
+#define CT_ISR		__ISR(_CORE_TIMER_VECTOR)
+#endif
+void CT_ISR CoreTimerHandler(void) {
+	ISR_ENTER(ISR_CT, ISR_LAT_CT);
 	IFS0CLR = _IFS0_CTIF_MASK;						//clear the flag
 	_CP0_SET_COMPARE(_CP0_GET_COMPARE() + _coretimer_pr);				//flag cleared when COMPARE is written
+	_ticks64Update();								//extend coreticks() to 64 bits
 	//execute user handler
-	_coretimer_isrptr();
+	CT_HANDLER();
+	ISR_EXIT(ISR_CT);
 }
 
 //install core timer isr
-void coretimerAttachISR(void (*isrptr)(void)) {
+void coretimerAttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub) {
+#if defined(CT_ISRIPL)
+	if (ipl != ISRIPL_PRIO(CT_ISRIPL)) return;		//the vector is built for another priority: leave it off
+#endif
 	_coretimer_isrptr=isrptr;						//activate the isr handler
 	IFS0CLR = _IFS0_CTIF_MASK;						//clear the flag
+	IPC0CLR = _IPC0_CTIP_MASK | _IPC0_CTIS_MASK;	//priority / sub-priority
+	IPC0SET = (ipl << _IPC0_CTIP_POSITION) | (sub << _IPC0_CTIS_POSITION);
 	IEC0SET = (1 << _IEC0_CTIE_POSITION);			//enable the interrupt
 }
 
 
+//peripheral power
+//PMDx, PMDxCLR, PMDxSET are consecutive words
+static const struct {
+	volatile uint32_t *pmd;						//PMDx
+	uint32_t mask;								//module's bit in PMDx
+} _pmd_def[PMD_MAX] = {
+	{&PMD1, _PMD1_AD1MD_MASK},
+	{&PMD2, _PMD2_CMP1MD_MASK},
+	{&PMD2, _PMD2_CMP2MD_MASK},
+	{&PMD2, _PMD2_CMP3MD_MASK},
+	{&PMD1, _PMD1_CVRMD_MASK},
+	{&PMD3, _PMD3_IC1MD_MASK},
+	{&PMD3, _PMD3_IC2MD_MASK},
+	{&PMD3, _PMD3_IC3MD_MASK},
+	{&PMD3, _PMD3_IC4MD_MASK},
+	{&PMD3, _PMD3_IC5MD_MASK},
+	{&PMD3, _PMD3_OC1MD_MASK},
+	{&PMD3, _PMD3_OC2MD_MASK},
+	{&PMD3, _PMD3_OC3MD_MASK},
+	{&PMD3, _PMD3_OC4MD_MASK},
+	{&PMD3, _PMD3_OC5MD_MASK},
+	{&PMD4, _PMD4_T1MD_MASK},
+	{&PMD4, _PMD4_T2MD_MASK},
+	{&PMD4, _PMD4_T3MD_MASK},
+	{&PMD4, _PMD4_T4MD_MASK},
+	{&PMD4, _PMD4_T5MD_MASK},
+	{&PMD5, _PMD5_U1MD_MASK},
+	{&PMD5, _PMD5_U2MD_MASK},
+	{&PMD5, _PMD5_SPI1MD_MASK},
+	{&PMD5, _PMD5_SPI2MD_MASK},
+	{&PMD5, _PMD5_I2C1MD_MASK},
+	{&PMD5, _PMD5_I2C2MD_MASK},
+	{&PMD6, _PMD6_RTCCMD_MASK},
+};
+static const char * const _pmd_names[PMD_MAX] = {
+	"adc", "cmp1", "cmp2", "cmp3", "cvr", "ic1", "ic2", "ic3", "ic4", "ic5", "oc1", "oc2", "oc3", "oc4", "oc5",
+	"tmr1", "tmr2", "tmr3", "tmr4", "tmr5", "uart1", "uart2", "spi1", "spi2", "i2c1", "i2c2", "rtcc",
+};
+static uint8_t _pmd_refs[PMD_MAX];				//references held on each module
+static uint32_t _pmd_drv=0;						//bit id set -> the module's driver holds a reference
+
+//take a reference on module id. powers it up with the first one
+void pmdOn(uint8_t id) {
+	uint32_t tmp = __builtin_get_isr_state();
+
+	di();
+	if (_pmd_refs[id]++ == 0) _pmd_def[id].pmd[1] = _pmd_def[id].mask;	//PMDxCLR: 0->module on
+	__builtin_set_isr_state(tmp);
+}
+
+//drop a reference on module id. powers it down with the last one
+void pmdOff(uint8_t id) {
+	uint32_t tmp = __builtin_get_isr_state();
+
+	di();
+	if (_pmd_refs[id] && (--_pmd_refs[id] == 0)) _pmd_def[id].pmd[2] = _pmd_def[id].mask;	//PMDxSET: 1->module off, registers reset
+	__builtin_set_isr_state(tmp);
+}
+
+//references held on module id
+uint8_t pmdRefs(uint8_t id) {
+	return _pmd_refs[id];
+}
+
+//xxxInit(): one reference for the driver, however often xxxInit() is called
+static void _pmdInit(uint8_t id) {
+	if (_pmd_drv & (1ul << id)) return;
+	_pmd_drv |= 1ul << id;
+	pmdOn(id);
+}
+
+//xxxDeinit(): drop the driver's reference
+static void _pmdDeinit(uint8_t id) {
+	if ((_pmd_drv & (1ul << id)) == 0) return;
+	_pmd_drv &= ~(1ul << id);
+	pmdOff(id);
+}
+
+//bit id set -> module id powered, read from the PMD registers
+uint32_t pmdPowered(void) {
+	uint32_t tmp = 0;
+	uint8_t id;
+
+	for (id=0; id<PMD_MAX; id++) if ((*_pmd_def[id].pmd & _pmd_def[id].mask) == 0) tmp |= 1ul << id;
+	return tmp;
+}
+
+//csv dump of the powered modules: module,refs
+void pmdReport(void (*putch)(char)) {
+	uint32_t on = pmdPowered();
+	uint8_t id;
+	const char *str;
+
+	for (str = "module,refs\r\n"; *str; ) putch(*str++);
+	for (id=0; id<PMD_MAX; id++) {
+		if ((on & (1ul << id)) == 0) continue;
+		for (str = _pmd_names[id]; *str; ) putch(*str++);
+		putch(','); _putu(putch, _pmd_refs[id]);
+		putch('\r'); putch('\n');
+	}
+}
+
+//output pps: disconnect the pins a peripheral drives
+static const struct {
+	volatile uint32_t *rpr;						//RPnR
+	uint8_t grp;								//output group 1..4
+} _pps_out[] = {
+	{&RPA0R, 1}, {&RPB3R, 1}, {&RPB4R, 1}, {&RPB15R, 1}, {&RPB7R, 1},
+	{&RPA1R, 2}, {&RPB5R, 2}, {&RPB1R, 2}, {&RPB11R, 2}, {&RPB8R, 2},
+	{&RPA2R, 3}, {&RPB6R, 3}, {&RPA4R, 3}, {&RPB13R, 3}, {&RPB2R, 3},
+	{&RPA3R, 4}, {&RPB14R, 4}, {&RPB0R, 4}, {&RPB10R, 4}, {&RPB9R, 4},
+#if defined(_PORTC)
+	{&RPC7R, 1}, {&RPC0R, 1}, {&RPC5R, 1},
+	{&RPA8R, 2}, {&RPC8R, 2}, {&RPA9R, 2},
+	{&RPC6R, 3}, {&RPC1R, 3}, {&RPC3R, 3},
+	{&RPC9R, 4}, {&RPC2R, 4}, {&RPC4R, 4},
+#endif
+};
+#define PPS_G1				(1<<0)
+#define PPS_G2				(1<<1)
+#define PPS_G3				(1<<2)
+#define PPS_G4				(1<<3)
+
+//pins in groups grps mapped to output function code -> back to the port latches
+static void _ppsRelease(uint8_t grps, uint8_t code) {
+	uint8_t i;
+
+	for (i=0; i<sizeof(_pps_out) / sizeof(_pps_out[0]); i++)
+		if ((grps & (1 << (_pps_out[i].grp - 1))) && (*_pps_out[i].rpr == code)) *_pps_out[i].rpr = 0;	//0->no connection
+}
+//end peripheral power
+
 //reset the mcu
 //FRCDIV set to 1:1
 //PBDIV set to 1:1
@@ -695,6 +1040,23 @@ void mcuInit(void) {
 	//initialize the core timer
 	coretimer_init();
 
+#if defined(USE_FASTBOOT)
+	//clock from the config bits: no osccon decode, and the rest of the boot runs at the right wait states
+	SystemCoreClock = F_BOOT;
+	_timeUpdate();								//tick conversions for F_BOOT
+	SystemPerformanceConfig();					//flash wait states / prefetch for SystemCoreClock
+
+	//PBDIV already 1:1 (FPBDIV), FRCDIV already 2:1 (reset value): no unlock
+
+	//turn off all peripherals but tmr2, one write per register
+	PMD1=0xffff;
+	PMD2=0xffff;
+	PMD3=0xffff;
+	PMD4=0xffff & ~_PMD4_T2MD_MASK;				//tmr2 stays on for pwm / systick
+	_pmd_refs[PMD_T2] = 1;						//held by mcuInit(), as pmdOn(PMD_T2) would
+	PMD5=0xffff;
+	PMD6=0xffff;
+#else
 	/* Set the system and peripheral bus speeds and enable the program cache*/
 
 	//SYSTEMConfigPerformance( F_CPU );
@@ -725,6 +1087,7 @@ void mcuInit(void) {
 	PMD4=0xffff;
 	PMD5=0xffff;
 	PMD6=0xffff;
+#endif	//USE_FASTBOOT
 
 	//all pins digital
 	ANSELA = 0x0000;
@@ -744,7 +1107,9 @@ void mcuInit(void) {
 	INTCONbits.MVEC = 1;						//1=enable multi-vectored interrupts, 0=disable
 
 	//initialize tmr2 for pwm generation / systick timer
-	PMD4bits.T2MD = 0;							//0->enable the peripheral, 1->disable the peripheral
+#if !defined(USE_FASTBOOT)
+	pmdOn(PMD_T2);								//held for good: pwm / systick / ticks64()
+#endif
 	T2CON = 0x0000;                 			//stop timer
 	T2CONbits.TCKPS = 0;						//set the prescaler: 0->1:1
 	T2CONbits.TCS = 0;             				//use internal instruction clock from F_PHB
@@ -754,13 +1119,23 @@ void mcuInit(void) {
 	PR2 = PWM_PR;								//set pwm period
 	IFS0bits.T2IF = 0;							//reset the flag
 	IEC0bits.T2IE = 1;							//0->disable tmr2 isr, 1->enable tmr2 isr (for systick generation)
+#if defined(TMR2_ISRIPL)
+	IPC2bits.T2IP = ISRIPL_PRIO(TMR2_ISRIPL);	//the priority the vector is built for
+#else
 	IPC2bits.T2IP = TMR_IPDEFAULT;
+#endif
 	IPC2bits.T2IS = TMR_ISDEFAULT;
 	T2CONbits.TON = 1;             				//turn on the timer
 
+#if !defined(USE_FASTBOOT)
 	//update sysclk
 	SystemCoreClockUpdate();					//update SystemCoreClock
+	SystemPerformanceConfig();					//flash wait states / prefetch for SystemCoreClock
+#endif
 
+#if defined(USE_PROFILE)
+	profileReset();								//measure the profiler overhead
+#endif
 
 	//enable global interrupts
 	ei();										//testing
@@ -771,13 +1146,31 @@ void empty_handler(void) {
 	//do nothing here
 }
 
+//boot time
+#if defined(USE_BOOTTICKS)
+uint32_t _boot_setup=0, _boot_loop=0;			//coreticks() at setup() / at the first loop()
+
+//start-up hook, called from the reset vector before the c run-time is set up: no globals here
+void _on_reset(void) {
+	_CP0_SET_COUNT(0);							//coreticks() from reset
+}
+#define BOOT_MARK(t)		do {t = coreticks();} while (0)
+#else
+#define BOOT_MARK(t)
+#endif	//USE_BOOTTICKS
+
 //C main loop
 int main(void) {
 
 	mcuInit();						//reset the mcu
+	BOOT_MARK(_boot_setup);
 	setup();						//run the setup code
+	BOOT_MARK(_boot_loop);
 	while (1) {
 		loop();						//run the default loop
+#if defined(USE_DFS)
+		dfsRun();					//scale the clock with the load
+#endif
 	}
 }
 
@@ -799,8 +1192,182 @@ inline void digitalWrite(PIN_TypeDef pin, uint8_t val) {
 inline int digitalRead(PIN_TypeDef pin) {
 	return (FIO_GET(GPIO_PinDef[pin].gpio, GPIO_PinDef[pin].mask))?HIGH:LOW;
 }
+
+//port i/o
+//write val to pins in mask: clear, then set
+void portWrite(GPIO_TypeDef *gpio, uint16_t mask, uint16_t val) {
+	gpio->LATCLR = mask & ~val;
+	gpio->LATSET = mask & val;
+}
+
+//read pins in mask
+uint16_t portRead(GPIO_TypeDef *gpio, uint16_t mask) {
+	return gpio->PORT & mask;
+}
+
+//set pins in mask as INPUT, OUTPUT or INPUT_PULLUP
+void portMode(GPIO_TypeDef *gpio, uint16_t mask, uint8_t mode) {
+	switch (mode) {
+	case OUTPUT:		gpio->TRISCLR = mask; break;
+	case INPUT_PULLUP:	gpio->CNPUSET = mask; gpio->TRISSET = mask; break;
+	default:			gpio->CNPUCLR = mask; gpio->TRISSET = mask; break;	//INPUT
+	}
+}
+
+//pin group
+//ports in the order of GPIO_PinDef[]
+static GPIO_TypeDef * const _gpio_ports[GPIO_PORTS] = {
+	GPIOA, GPIOB,
+#if defined(_PORTC)
+	GPIOC,
+#endif
+};
+
+//build a group from n pins: pins[0] -> lsb of the value
+void pinGroupInit(PINGRP_TypeDef *grp, const PIN_TypeDef *pins, uint8_t n) {
+	uint8_t i;
+
+	if (n > PINGRP_MAX) n = PINGRP_MAX;
+	grp->n = n;
+	for (i=0; i<GPIO_PORTS; i++) grp->pmask[i] = 0;
+	for (i=0; i<n; i++) {
+		grp->port[i] = pins[i] / 16;			//16 pins per port
+		grp->mask[i] = GPIO_PinDef[pins[i]].mask;
+		grp->pmask[grp->port[i]] |= grp->mask[i];
+	}
+}
+
+//write val to the group: scatter the bits into per-port masks, then two stores per port
+void pinGroupWrite(PINGRP_TypeDef *grp, uint16_t val) {
+	uint16_t set[GPIO_PORTS];
+	uint8_t i;
+
+	for (i=0; i<GPIO_PORTS; i++) set[i] = 0;
+	for (i=0; i<grp->n; i++, val >>= 1)
+		if (val & 1) set[grp->port[i]] |= grp->mask[i];
+	for (i=0; i<GPIO_PORTS; i++)
+		if (grp->pmask[i]) portWrite(_gpio_ports[i], grp->pmask[i], set[i]);
+}
+
+//read the group: one read per port, then gather the bits
+uint16_t pinGroupRead(PINGRP_TypeDef *grp) {
+	uint16_t in[GPIO_PORTS], val=0;
+	uint8_t i;
+
+	for (i=0; i<GPIO_PORTS; i++)
+		in[i] = (grp->pmask[i]) ? portRead(_gpio_ports[i], grp->pmask[i]) : 0;
+	for (i=0; i<grp->n; i++)
+		if (in[grp->port[i]] & grp->mask[i]) val |= 1<<i;
+	return val;
+}
+
+//set the group as INPUT, OUTPUT or INPUT_PULLUP
+void pinGroupMode(PINGRP_TypeDef *grp, uint8_t mode) {
+	uint8_t i;
+
+	for (i=0; i<GPIO_PORTS; i++)
+		if (grp->pmask[i]) portMode(_gpio_ports[i], grp->pmask[i], mode);
+}
 //end GPIO
 
+//advanced io
+//reverse bit order - spi shifts msb first
+static uint8_t _rev8(uint8_t val) {
+	val = ((val & 0xf0) >> 4) | ((val & 0x0f) << 4);
+	val = ((val & 0xcc) >> 2) | ((val & 0x33) << 2);
+	val = ((val & 0xaa) >> 1) | ((val & 0x55) << 1);
+	return val;
+}
+
+#if defined(SDO1PIN) || defined(SDO2PIN)
+//shift out len bytes through an spi module - stat/buf point to SPIxSTAT/SPIxBUF
+//returns once the last bit has been clocked out
+static void _spiShiftOut(volatile uint32_t *stat, volatile uint32_t *buf, uint8_t bitOrder, const uint8_t *dat, uint16_t len) {
+	uint16_t n=len;								//bytes to be received
+
+	while (!(*stat & _SPI1STAT_SPIRBE_MASK)) *buf;	//flush the rx fifo
+	while (len || n) {
+		if (len && !(*stat & _SPI1STAT_SPITBF_MASK)) {	//room in tx fifo
+			*buf = (bitOrder == MSBFIRST) ? *dat : _rev8(*dat);
+			dat++; len--;
+		}
+		if (!(*stat & _SPI1STAT_SPIRBE_MASK)) {*buf; n--;}	//discard rx data
+	}
+}
+#endif
+
+//shift out len bytes, buf[0] first
+void shiftOutBuffer(PIN_TypeDef dataPin, PIN_TypeDef clockPin, uint8_t bitOrder, const uint8_t *buf, uint16_t len) {
+	GPIO_TypeDef *dgpio = GPIO_PinDef[dataPin].gpio, *cgpio = GPIO_PinDef[clockPin].gpio;
+	uint16_t dmask = GPIO_PinDef[dataPin].mask, cmask = GPIO_PinDef[clockPin].mask;
+	uint8_t i, val;
+
+#if defined(SDO1PIN)
+	if ((dataPin == SDO1PIN) && (clockPin == SCK1PIN) && SPI1CONbits.ON && SPI1CONbits.MSTEN && !SPI1CONbits.CKP) {
+		uint32_t con;
+		while (spi1TransferBusy()) continue;	//let queued dma transfers finish
+		con = SPI1CON;							//save the user's mode
+		SPI1CONbits.ON = 0;					//mode bits only change while the module is off
+		SPI1CONbits.CKE = 1;					//1->data changes on the falling edge: mode 0, as bit-banged
+		SPI1CONbits.MODE16 = 0;				//8-bit data
+		SPI1CONbits.MODE32 = 0;
+		SPI1CONbits.ON = 1;
+		_spiShiftOut(&SPI1STAT, &SPI1BUF, bitOrder, buf, len);
+		SPI1CONbits.ON = 0;
+		SPI1CON = con & ~_SPI1CON_ON_MASK;	//restore the user's mode
+		SPI1CONbits.ON = 1;
+		return;
+	}
+#endif
+#if defined(SDO2PIN)
+	if ((dataPin == SDO2PIN) && (clockPin == SCK2PIN) && SPI2CONbits.ON && SPI2CONbits.MSTEN && !SPI2CONbits.CKP) {
+		uint32_t con;
+		while (spi2TransferBusy()) continue;	//let queued dma transfers finish
+		con = SPI2CON;							//save the user's mode
+		SPI2CONbits.ON = 0;					//mode bits only change while the module is off
+		SPI2CONbits.CKE = 1;					//1->data changes on the falling edge: mode 0, as bit-banged
+		SPI2CONbits.MODE16 = 0;				//8-bit data
+		SPI2CONbits.MODE32 = 0;
+		SPI2CONbits.ON = 1;
+		_spiShiftOut(&SPI2STAT, &SPI2BUF, bitOrder, buf, len);
+		SPI2CONbits.ON = 0;
+		SPI2CON = con & ~_SPI2CON_ON_MASK;	//restore the user's mode
+		SPI2CONbits.ON = 1;
+		return;
+	}
+#endif
+	//bit-bang: masks resolved once, then LATxSET/LATxCLR stores only
+	while (len--) {
+		val = *buf++;
+		if (bitOrder == LSBFIRST) val = _rev8(val);
+		for (i=0; i<8; i++, val <<= 1) {
+			if (val & 0x80) FIO_SET(dgpio, dmask); else FIO_CLR(dgpio, dmask);
+			FIO_SET(cgpio, cmask);					//clock the bit out
+			FIO_CLR(cgpio, cmask);
+		}
+	}
+}
+
+//shift out a byte
+void shiftOut(PIN_TypeDef dataPin, PIN_TypeDef clockPin, uint8_t bitOrder, uint8_t val) {
+	shiftOutBuffer(dataPin, clockPin, bitOrder, &val, 1);
+}
+
+//shift in a byte: data read while clock is high
+uint8_t shiftIn(PIN_TypeDef dataPin, PIN_TypeDef clockPin, uint8_t bitOrder) {
+	GPIO_TypeDef *dgpio = GPIO_PinDef[dataPin].gpio, *cgpio = GPIO_PinDef[clockPin].gpio;
+	uint16_t dmask = GPIO_PinDef[dataPin].mask, cmask = GPIO_PinDef[clockPin].mask;
+	uint8_t i, val=0;
+
+	for (i=0; i<8; i++) {
+		FIO_SET(cgpio, cmask);
+		val = (val << 1) | (FIO_GET(dgpio, dmask) ? 1 : 0);
+		FIO_CLR(cgpio, cmask);
+	}
+	return (bitOrder == MSBFIRST) ? val : _rev8(val);
+}
+//end advanced io
+
 //ticks()
 //Arduino Functions: Time
 //normally use coretimer
@@ -812,6 +1379,7 @@ uint32_t systicks(void) {
 		m=systick_count;
 		f=TMR2;
 	} while (m ^ systick_count);
+	if (IFS0bits.T2IF && (f < 0x8000)) m += 1ul<<16;	//rollover not yet counted by the tmr2 isr
 	return (m | f);
 
 }
@@ -819,22 +1387,542 @@ uint32_t systicks(void) {
 //return timer ticks
 
 
+//tick conversions
+//mul is rounded to 32 bits: relative error <= 2^-32, so a 32-bit result is at most 1 off
+TIME_RecipTypeDef _time_tick2us={0, 0}, _time_tick2ms={0, 0}, _time_us2tick={0, 0}, _time_ms2tick={0, 0};
+uint32_t _time_cpus=F_FRC / 1000000ul, _time_cpms=F_FRC / 1000;	//at the reset clock
+
+//64-bit time base
+static volatile uint32_t _ticks64_hi=0;			//high word of ticks64()
+static volatile uint32_t _ticks64_lo=0;			//coreticks() at the last update
+static uint64_t _ticks64_0=0;					//ticks64() at the last clock change
+static uint64_t _micros64_0=0, _millis64_0=0;	//micros64()/millis64() at the last clock change
+#if defined(USE_DFS)
+static TIME_RecipTypeDef _time_tick2max={0, 0};	//coreticks() -> F_SYSMAX cycles
+static uint64_t _dfsticks_0=0;					//F_SYSMAX cycles at the last clock change
+#endif
+
+//set up r so that (x * r->mul) >> r->sh ~= x * num / den
+//num / den must be less than 2^32
+static void _recipInit(TIME_RecipTypeDef *r, uint32_t num, uint32_t den) {
+	uint8_t sh = 32 + __builtin_clz(num);			//num << sh fills 64 bits
+	uint64_t m = ((uint64_t) num << sh) / den;		//the only division, done once per clock change
+
+	while (m >> 33) {m >>= 1; sh--;}				//keep 32 bits + a rounding bit
+	m = (m + 1) >> 1; sh--;							//round to nearest
+	if (m >> 32) {m >>= 1; sh--;}					//rounded up to 2^32
+	r->mul = m;
+	r->sh = sh;
+}
+
+//(t * mul) >> sh, with the 96-bit product kept intact
+static uint64_t _recipMul(uint64_t t, const TIME_RecipTypeDef *r) {
+	uint64_t lo = (uint64_t) (uint32_t) t * r->mul;
+	uint64_t hi = (uint64_t) (uint32_t) (t >> 32) * r->mul + (lo >> 32);	//product = hi:(uint32_t) lo
+
+	if (r->sh >= 32) return hi >> (r->sh - 32);
+	return (hi << (32 - r->sh)) | ((uint32_t) lo >> r->sh);
+}
+
+//advance the high word on a coreticks() wrap, returns the 64-bit count
+//every ticks64() read commits the extension, so does every tmr2 and core timer interrupt:
+//any one of them within each ~107s (at 40Mhz) wrap period keeps it exact, whatever tmr2 is reconfigured to
+static uint64_t _ticks64Update(void) {
+	uint32_t tmp = __builtin_get_isr_state(), t;
+	uint64_t ticks;
+
+	di();											//hi and lo change together, even for higher priority readers
+	t = coreticks();
+	if (t < _ticks64_lo) _ticks64_hi += 1;			//coreticks() wrapped
+	_ticks64_lo = t;
+	ticks = ((uint64_t) _ticks64_hi << 32) | t;
+	__builtin_set_isr_state(tmp);
+	return ticks;
+}
+
+//64-bit coreticks()
+uint64_t ticks64(void) {
+	return _ticks64Update();
+}
+
+//microseconds since reset
+uint64_t micros64(void) {
+	return _micros64_0 + _recipMul(ticks64() - _ticks64_0, &_time_tick2us);
+}
+
+//milliseconds since reset
+uint64_t millis64(void) {
+	return _millis64_0 + _recipMul(ticks64() - _ticks64_0, &_time_tick2ms);
+}
+
+#if defined(USE_DFS)
+//F_SYSMAX cycles since reset: ticks() at a fixed rate, whatever the governor does to the clock
+uint32_t dfsticks(void) {
+	return _dfsticks_0 + _recipMul(ticks64() - _ticks64_0, &_time_tick2max);
+}
+#endif
+
+//close the 64-bit epoch at the old clock and refresh the conversions for SystemCoreClock
+static void _timeUpdate(void) {
+	uint32_t tmp = __builtin_get_isr_state();
+	uint64_t t;
+
+	di();											//isr readers see either clock, not a mix
+	t = ticks64();
+	if (_time_tick2us.mul) {						//time elapsed at the old clock
+		_micros64_0 += _recipMul(t - _ticks64_0, &_time_tick2us);
+		_millis64_0 += _recipMul(t - _ticks64_0, &_time_tick2ms);
+#if defined(USE_DFS)
+		_dfsticks_0 += _recipMul(t - _ticks64_0, &_time_tick2max);
+#endif
+	}
+	_ticks64_0 = t;
+#if defined(USE_DFS)
+	_recipInit(&_time_tick2max, F_SYSMAX, SystemCoreClock);
+#endif
+	_recipInit(&_time_tick2us, 1000000ul, SystemCoreClock);
+	_recipInit(&_time_tick2ms, 1000, SystemCoreClock);
+	_recipInit(&_time_us2tick, SystemCoreClock, 1000000ul);
+	_recipInit(&_time_ms2tick, SystemCoreClock, 1000);
+	_time_cpus = SystemCoreClock / 1000000ul;
+	_time_cpms = SystemCoreClock / 1000;
+	__builtin_set_isr_state(tmp);
+}
+
 //delay millisseconds
 void delay(uint32_t ms) {
 	uint32_t start_time = ticks();
-	ms *= cyclesPerMillisecond();
+#if defined(USE_DFS)
+	ms = ms * (F_TICK / 1000);				//ticks() runs at F_TICK, not at the current clock
+#else
+	ms = ms2ticks(ms);
+#endif
 	while (ticks() - start_time < ms) continue;
 }
 
 //delay micros seconds
 void delayMicroseconds(uint32_t us) {
 	uint32_t start_time = ticks();
-	us *= cyclesPerMicrosecond();
+#if defined(USE_DFS)
+	us = us * (F_TICK / 1000000ul);				//ticks() runs at F_TICK, not at the current clock
+#else
+	us = us2ticks(us);
+#endif
 	while (ticks() - start_time < us) continue;
 }
+
+//low power
+static int32_t _idle_lat=IDLE_LATENCY;			//wake-up latency estimate, in ticks
+#if defined(USE_DFS)
+static volatile uint32_t _dfs_idle=0;			//ticks spent in idle() in the current dfs window
+#endif
+
+//idle the cpu until coreticks() reaches t, or another interrupt wakes it up
+//the compare is set _idle_lat early and the rest is spun out, so t is met within a few ticks
+//returns 1 if t was reached, 0 if woken up early
+uint8_t idleUntil(uint32_t t) {
+	uint32_t tmp, ie, now;
+	int32_t lat;
+
+	tmp = __builtin_get_isr_state();
+	di();											//interrupts held off: a wake-up can't be lost before wait
+	if ((int32_t) (t - coreticks()) > _idle_lat + IDLE_MIN) {
+		ie = IEC0 & _IEC0_CTIE_MASK;
+		_CP0_SET_COMPARE(_CP0_GET_COUNT() + (t - _idle_lat - coreticks()) / 2);	//core timer counts at half the tick rate
+		IFS0CLR = _IFS0_CTIF_MASK;
+		IEC0SET = _IEC0_CTIE_MASK;
+		now = coreticks();
+		idle();										//an enabled interrupt wakes the cpu even with interrupts disabled
+#if defined(USE_DFS)
+		_dfs_idle += coreticks() - now;				//not part of the load
+#endif
+		now = coreticks();
+		if (IFS0 & _IFS0_CTIF_MASK) {				//woken up by the deadline: refine the latency estimate
+			lat = (int32_t) (now - t) + _idle_lat;	//time from compare match to here
+			_idle_lat += (lat - _idle_lat) / 4;
+			if (_idle_lat < 0) _idle_lat = 0;
+			IFS0CLR = _IFS0_CTIF_MASK;				//consumed here, not by the core timer isr
+		}
+		IEC0CLR = _IEC0_CTIE_MASK;					//restore the core timer interrupt
+		IEC0SET = ie;
+	}
+	__builtin_set_isr_state(tmp);					//other wake-up sources are serviced now
+	if ((int32_t) (t - coreticks()) > _idle_lat + IDLE_MIN) return 0;	//woken up early
+	while ((int32_t) (t - coreticks()) > 0) continue;	//spin out the rest
+	return 1;
+}
+
+//delay ms milliseconds, idling the cpu in between
+void delayIdle(uint32_t ms) {
+	uint32_t t = coreticks() + ms2ticks(ms);
+
+	while (idleUntil(t) == 0) continue;
+}
 //end Time
 
+//scheduler
+//hierarchical timer wheel: 3 levels of 64 slots, each slot a doubly linked list of tasks
+//level 0 slots are one jiffy (SCHED_JIFFY ticks) apart, level 1 slots 64 jiffies, level 2 slots 64*64 jiffies
+//every 64 jiffies the next level 1 slot is cascaded into level 0 (and every 64*64 jiffies level 2 into level 1)
+//insert / cancel / expire are O(1) per task
+#define SCHED_LVLBITS		6
+#define SCHED_SLOTS			(1<<SCHED_LVLBITS)			//slots per level
+#define SCHED_SLOTMASK		(SCHED_SLOTS - 1)
+#if (SCHED_MAX > 254)
+#error "pic32duino.c: SCHED_MAX must be 254 or less!"
+#endif
+typedef struct {
+	uint32_t expires;							//jiffy to run at
+	uint32_t period;							//in jiffies, 0->one shot
+	uint32_t base, hz;							//period as requested: base jiffies at SystemCoreClock = hz
+	void (*fn)(void);							//NULL->task slot free
+	uint8_t next, prev;							//list links
+	uint8_t slot;								//wheel slot holding the task, SCHED_NONE if none
+} SCHED_TaskTypeDef;
+static SCHED_TaskTypeDef _sched_task[SCHED_MAX];
+static uint8_t _sched_wheel[3 * SCHED_SLOTS];	//list heads
+static uint32_t _sched_jiffies=0;				//last jiffy processed
+static uint32_t _sched_last=0;					//coreticks() at _sched_jiffies
+static uint8_t _sched_init=0;					//1->wheel initialized
+static uint32_t _sched_hz=0;					//SystemCoreClock the pending jiffies are counted at
+static void _schedRebase(void);
+
+//hold off the core timer isr while the wheel is being changed
+#define SCHED_LOCK(ie)		do {ie = IEC0 & _IEC0_CTIE_MASK; IEC0CLR = _IEC0_CTIE_MASK;} while (0)
+#define SCHED_UNLOCK(ie)	do {IEC0SET = ie;} while (0)
+
+//reset the wheel - first use
+static void _schedInit(void) {
+	uint16_t i;
+
+	for (i=0; i<3 * SCHED_SLOTS; i++) _sched_wheel[i] = SCHED_NONE;
+	for (i=0; i<SCHED_MAX; i++) {_sched_task[i].fn = NULL; _sched_task[i].slot = SCHED_NONE;}
+	_sched_jiffies = 0;
+	_sched_last = coreticks();
+	_sched_hz = SystemCoreClock;
+	SystemCoreClockNotify(_schedRebase);		//keep the tasks in time across clock changes
+	_sched_init = 1;
+}
+
+//put task id in the slot for its expiry
+static void _schedInsert(uint8_t id) {
+	SCHED_TaskTypeDef *t = &_sched_task[id];
+	int32_t delta;
+	uint8_t slot;
+
+	delta = (int32_t) (t->expires - _sched_jiffies);
+	if (delta < 0) {t->expires = _sched_jiffies; delta = 0;}	//overdue -> current slot, run by schedRun() right away
+	if (delta < SCHED_SLOTS) slot = t->expires & SCHED_SLOTMASK;
+	else if (delta < SCHED_SLOTS * SCHED_SLOTS) slot = SCHED_SLOTS + ((t->expires >> SCHED_LVLBITS) & SCHED_SLOTMASK);
+	else {
+		if (delta >= SCHED_SLOTS * SCHED_SLOTS * SCHED_SLOTS) delta = SCHED_SLOTS * SCHED_SLOTS * SCHED_SLOTS - 1;	//beyond the wheel: park in the farthest slot, re-cascaded later
+		slot = 2 * SCHED_SLOTS + (((_sched_jiffies + delta) >> (2 * SCHED_LVLBITS)) & SCHED_SLOTMASK);
+	}
+	t->slot = slot;
+	t->prev = SCHED_NONE;
+	t->next = _sched_wheel[slot];
+	if (t->next != SCHED_NONE) _sched_task[t->next].prev = id;
+	_sched_wheel[slot] = id;
+}
+
+//take task id off its slot
+static void _schedUnlink(uint8_t id) {
+	SCHED_TaskTypeDef *t = &_sched_task[id];
+
+	if (t->slot == SCHED_NONE) return;			//not in the wheel
+	if (t->prev != SCHED_NONE) _sched_task[t->prev].next = t->next;
+	else _sched_wheel[t->slot] = t->next;
+	if (t->next != SCHED_NONE) _sched_task[t->next].prev = t->prev;
+	t->slot = SCHED_NONE;
+}
+
+//move all tasks of a slot one level down
+static void _schedCascade(uint8_t slot) {
+	uint8_t id;
+
+	while ((id = _sched_wheel[slot]) != SCHED_NONE) {
+		_schedUnlink(id);
+		_schedInsert(id);
+	}
+}
+
+//add a task
+static uint8_t _schedAdd(uint32_t dly, uint32_t period, void (*fn)(void)) {
+	uint32_t ie, dj;
+	uint8_t id;
+
+	if (fn == NULL) return SCHED_NONE;
+	SCHED_LOCK(ie);
+	if (_sched_init == 0) _schedInit();
+	for (id=0; id<SCHED_MAX; id++) if (_sched_task[id].fn == NULL) break;	//free task slot
+	if (id < SCHED_MAX) {
+		_sched_task[id].fn = fn;
+		_sched_task[id].period = _sched_task[id].base = period;
+		_sched_task[id].hz = SystemCoreClock;
+		dj = (coreticks() - _sched_last + dly + SCHED_JIFFY - 1) >> SCHED_SHIFT;	//jiffies from the last one processed
+		_sched_task[id].expires = _sched_jiffies + (dj ? dj : 1);	//the current slot has been processed already
+		_schedInsert(id);
+	} else id = SCHED_NONE;
+	SCHED_UNLOCK(ie);
+	return id;
+}
+
+//the clock has changed: a jiffy is SCHED_JIFFY ticks of the new clock from here on
+//rescale what is left of each delay and each period, so that the tasks stay in time
+static void _schedRebase(void) {
+	SCHED_TaskTypeDef *t;
+	uint32_t ie, dj;
+	uint8_t id;
+
+	if (SystemCoreClock == _sched_hz) return;
+	SCHED_LOCK(ie);
+	for (id=0; id<SCHED_MAX; id++) {
+		t = &_sched_task[id];
+		if (t->slot == SCHED_NONE) continue;		//free, or a one shot being run
+		_schedUnlink(id);
+		dj = ((int32_t) (t->expires - _sched_jiffies) > 0) ? (t->expires - _sched_jiffies) : 0;	//jiffies left at the old clock
+		dj = ((uint64_t) dj * SystemCoreClock + _sched_hz / 2) / _sched_hz;
+		t->expires = _sched_jiffies + (dj ? dj : 1);
+		if (t->period) {
+			dj = ((uint64_t) t->base * SystemCoreClock + t->hz / 2) / t->hz;	//from the period as requested: no error build-up
+			t->period = dj ? dj : 1;
+		}
+		_schedInsert(id);
+	}
+	_sched_hz = SystemCoreClock;
+	//schedAttachCoreTimer(): one core timer period per jiffy at any clock, not rescaled in time
+	if (_coretimer_isrptr == schedRun) {_coretimer_pr0 = SCHED_JIFFY; _coretimer_hz = SystemCoreClock; _coretimer_pr = SCHED_JIFFY / 2;}
+	SCHED_UNLOCK(ie);
+}
+
+//run fn every period ticks
+uint8_t schedEvery(uint32_t period, void (*fn)(void)) {
+	period = (period + SCHED_JIFFY - 1) >> SCHED_SHIFT;
+	return _schedAdd(period << SCHED_SHIFT, period ? period : 1, fn);
+}
+
+//run fn once after dly ticks
+uint8_t schedAfter(uint32_t dly, void (*fn)(void)) {
+	return _schedAdd(dly, 0, fn);
+}
+
+//remove a task
+void schedCancel(uint8_t id) {
+	uint32_t ie;
+
+	if (id >= SCHED_MAX) return;
+	SCHED_LOCK(ie);
+	_schedUnlink(id);
+	_sched_task[id].fn = NULL;					//free the task slot
+	SCHED_UNLOCK(ie);
+}
+
+//run the tasks that are due
+//catches up one jiffy at a time if called late
+void schedRun(void) {
+	SCHED_TaskTypeDef *t;
+	void (*fn)(void);
+	uint8_t id;
+
+	if (_sched_init == 0) return;				//nothing scheduled yet
+	while (coreticks() - _sched_last >= SCHED_JIFFY) {
+		_sched_last += SCHED_JIFFY;
+		_sched_jiffies += 1;
+		if ((_sched_jiffies & SCHED_SLOTMASK) == 0) {	//level 0 wrapped
+			if (((_sched_jiffies >> SCHED_LVLBITS) & SCHED_SLOTMASK) == 0)	//level 1 wrapped
+				_schedCascade(2 * SCHED_SLOTS + ((_sched_jiffies >> (2 * SCHED_LVLBITS)) & SCHED_SLOTMASK));
+			_schedCascade(SCHED_SLOTS + ((_sched_jiffies >> SCHED_LVLBITS) & SCHED_SLOTMASK));
+		}
+		//expire the current slot - one task at a time so that fn() may add / cancel tasks
+		while ((id = _sched_wheel[_sched_jiffies & SCHED_SLOTMASK]) != SCHED_NONE) {
+			t = &_sched_task[id];
+			_schedUnlink(id);
+			fn = t->fn;
+			if (t->period) {t->expires += t->period; _schedInsert(id);}	//periodic: next run, no drift
+			else t->fn = NULL;					//one shot: free the task slot
+			fn();
+		}
+	}
+}
+
+//idle until the next task is due, then run the tasks that are due
+//an interrupt that wakes the cpu up early just runs schedRun() sooner
+void schedIdle(void) {
+	uint32_t dj;
+
+	if (_sched_init == 0) {idleUntil(coreticks() + (1ul<<30)); return;}	//nothing scheduled: wait for an interrupt
+	//first busy level 0 slot, or the next cascade at the latest
+	for (dj=1; dj<SCHED_SLOTS; dj++) {
+		if (_sched_wheel[(_sched_jiffies + dj) & SCHED_SLOTMASK] != SCHED_NONE) break;
+		if (((_sched_jiffies + dj) & SCHED_SLOTMASK) == 0) break;
+	}
+	idleUntil(_sched_last + dj * SCHED_JIFFY);
+	schedRun();
+}
+//end scheduler
+
+//profiler
+PROFILE_TypeDef _profile[PROFILE_MAX];
+static uint32_t _profile_ovh=0;					//ticks taken by an empty PROFILE_BEGIN()/PROFILE_END() pair
+
+//close a run of region id, t1 = coreticks() at PROFILE_END()
+void _profileEnd(uint8_t id, uint32_t t1) {
+	PROFILE_TypeDef *p = &_profile[id];
+	uint32_t dt = t1 - p->t0;
+
+	dt = (dt > _profile_ovh) ? (dt - _profile_ovh) : 0;
+	if ((p->cnt == 0) || (dt < p->min)) p->min = dt;
+	if (dt > p->max) p->max = dt;
+	p->sum += dt;
+	p->cnt += 1;
+}
+
+//clear all regions and measure the overhead: best of 8 empty regions
+void profileReset(void) {
+	uint8_t i;
+	uint32_t dt;
+
+	memset(_profile, 0, sizeof(_profile));
+	_profile_ovh = 0xfffffffful;
+	for (i=0; i<8; i++) {
+		_profile[0].t0 = coreticks();				//same as PROFILE_BEGIN(0)
+		dt = coreticks() - _profile[0].t0;
+		if (dt < _profile_ovh) _profile_ovh = dt;
+	}
+	_profile[0].t0 = 0;
+}
+
+//csv dump of the regions that have run: id,count,min,max,mean, in ticks
+void profileReport(void (*putch)(char)) {
+	PROFILE_TypeDef p;
+	uint32_t tmp, val[5];
+	uint8_t id, i;
+	const char *str;
+
+	for (str = "id,count,min,max,mean\r\n"; *str; ) putch(*str++);
+	for (id=0; id<PROFILE_MAX; id++) {
+		tmp = __builtin_get_isr_state();
+		di();										//consistent snapshot, even for regions in isrs
+		p = _profile[id];
+		__builtin_set_isr_state(tmp);
+		if (p.cnt == 0) continue;
+		val[0] = id; val[1] = p.cnt; val[2] = p.min; val[3] = p.max; val[4] = p.sum / p.cnt;
+		for (i=0; i<5; i++) {
+			_putu(putch, val[i]);
+			putch((i < 4) ? ',' : '\r');
+		}
+		putch('\n');
+	}
+}
+//end profiler
+
+//dfs governor
+#if defined(USE_DFS)
+static const uint32_t _dfs_opp[] = DFS_OPP;		//operating points, fastest first
+#define DFS_NOPP			(sizeof(_dfs_opp) / sizeof(_dfs_opp[0]))
+static uint8_t _dfs_lvl=0xff;					//current operating point, 0xff->not yet set
+static uint8_t _dfs_load=100;					//load over the last window, in %
+static uint8_t _dfs_low=0;						//consecutive windows below DFS_DOWN
+static uint32_t _dfs_t0=0;						//coreticks() at the start of the window
+
+//switch to operating point lvl and start a new window
+static void _dfsSet(uint8_t lvl) {
+	_dfs_lvl = lvl;
+	if (_dfs_opp[lvl] == F_FRC) SystemCoreClockFRC();	//no pll at 8Mhz
+	else SystemCoreClockSet(_dfs_opp[lvl]);
+	_dfs_low = 0;
+	_dfs_idle = 0;
+	_dfs_t0 = coreticks();
+}
+
+//close the window once DFS_WINDOW has passed and step the clock if the load calls for it
+void dfsRun(void) {
+	uint32_t dt, idl;
+
+	if (_dfs_lvl == 0xff) {_dfsSet(0); return;}	//start at the fastest point
+	dt = coreticks() - _dfs_t0;
+	if (dt < ms2ticks(DFS_WINDOW)) return;
+	idl = _dfs_idle;
+	_dfs_load = (idl < dt) ? ((uint64_t) (dt - idl) * 100 / dt) : 0;
+	if (_dfs_load > DFS_UP) {
+		if (_dfs_lvl > 0) {_dfsSet(_dfs_lvl - 1); return;}
+		_dfs_low = 0;
+	} else if (_dfs_load < DFS_DOWN) {
+		//step down only if the load at the slower clock stays below DFS_UP: no bouncing
+		if ((++_dfs_low >= DFS_HOLD) && (_dfs_lvl < DFS_NOPP - 1) &&
+			((uint64_t) _dfs_load * _dfs_opp[_dfs_lvl] < (uint64_t) DFS_UP * _dfs_opp[_dfs_lvl + 1])) {_dfsSet(_dfs_lvl + 1); return;}
+	} else _dfs_low = 0;
+	_dfs_idle -= idl;								//idle() time from isrs since the read stays in the next window
+	_dfs_t0 += dt;
+}
+
+//load over the last window, in %
+uint8_t dfsLoad(void) {
+	return _dfs_load;
+}
+
+//current operating point, 0 = fastest
+uint8_t dfsLevel(void) {
+	return _dfs_lvl;
+}
+#endif	//USE_DFS
+//end dfs governor
+
 //uart1
+#if defined(U1RX_BUFSIZE)
+//uart1 rx ring buffer
+//head advanced by the isr (or by the drain step with U1RXIE cleared), tail advanced by the reader
+#define U1RX_MASK			(U1RX_BUFSIZE - 1)
+#if (U1RX_BUFSIZE & U1RX_MASK)
+#error "pic32duino.c: U1RX_BUFSIZE must be a power of 2!"
+#endif
+static volatile uint8_t _u1rx_buf[U1RX_BUFSIZE];		//rx buffer
+static volatile uint16_t _u1rx_head=0, _u1rx_tail=0;	//write / read index
+#endif	//U1RX_BUFSIZE
+static volatile UART_ErrTypeDef _u1err;				//rx error counters
+
+//move received chars out of the hardware fifo and account for errors
+//called with U1RXIE cleared, or from the isr
+static void _u1rxDrain(void) {
+	uint32_t sta;
+
+#if defined(U1RX_BUFSIZE)
+	while ((sta = U1STA) & _U1STA_URXDA_MASK) {
+		//FERR/PERR refer to the char at the top of the fifo
+		if (sta & _U1STA_FERR_MASK) _u1err.FERR += 1;
+		if (sta & _U1STA_PERR_MASK) _u1err.PERR += 1;
+		if ((uint16_t) (_u1rx_head - _u1rx_tail) >= U1RX_BUFSIZE) {U1RXREG; _u1err.DROPPED += 1;}	//ring full -> discard
+		else {_u1rx_buf[_u1rx_head & U1RX_MASK] = U1RXREG; _u1rx_head += 1;}
+	}
+#else
+	sta = U1STA;
+	if (sta & _U1STA_URXDA_MASK) return;		//polled mode: let the user read the fifo first
+#endif
+	//clearing OERR resets the fifo - so do it only after the fifo has been emptied
+	if (sta & _U1STA_OERR_MASK) {
+		_u1err.OERR += 1;
+		U1STACLR = _U1STA_OERR_MASK;			//restart the receiver
+	}
+}
+
+#if defined(U1RX_BUFSIZE)
+//uart1 isr - rx
+void __ISR(_UART_1_VECTOR) _U1Interrupt(void) {
+	ISR_ENTER(ISR_U1, 0);
+	if (IFS1bits.U1RXIF || IFS1bits.U1EIF) {
+		_u1rxDrain();							//empty the fifo into the ring buffer
+		IFS1CLR = _IFS1_U1RXIF_MASK | _IFS1_U1EIF_MASK;	//clear the flags
+	}
+	ISR_EXIT(ISR_U1);
+}
+#endif	//U1RX_BUFSIZE
+
+//brg from the baud rate at the current clock
+static unsigned long _uart1_br=UART_BR9600;		//baud rate
+static void _uart1Rebase(void) {
+	U1BRG = F_UART / 4 / _uart1_br - 1;			//set lower byte of brg
+}
+
 //initialize usart: high baudrate (brgh=1), 16-bit baudrate (brg16=1)
 //baudrate=Fxtal/(4*(spbrg+1))
 //spbrg=(Fxtal/4/baudrate)-1
@@ -855,7 +1943,7 @@ void uart1Init(unsigned long baud_rate) {
 
 
 	//disable md bits
-	PMD5bits.U1MD = 0;				//power up the module
+	_pmdInit(PMD_U1);				//power up the module
 
 	//U2MODEbits register
 	//bit 15 UARTEN: UARTx Enable bit(1)
@@ -918,7 +2006,9 @@ void uart1Init(unsigned long baud_rate) {
 
 
 	//BAUDCON
-	U1BRG = F_UART / 4 / baud_rate - 1;				//set lower byte of brg.
+	_uart1_br = baud_rate;
+	_uart1Rebase();								//set the brg
+	SystemCoreClockNotify(_uart1Rebase);			//and again after each clock change
 
 	//disable interrupts
 
@@ -974,7 +2064,17 @@ void uart1Init(unsigned long baud_rate) {
 	//11 = Interrupt is set on RSR transfer, making the receive buffer full (i.e., has 4 data characters)
 	//10 = Interrupt is set on RSR transfer, making the receive buffer 3/4 full (i.e., has 3 data characters)
 	//0x = Interrupt is set when any character is received and transferred from the RSR to the receive buffer. Receive buffer has one or more characters.
+	_u1err.OERR = _u1err.FERR = _u1err.PERR = _u1err.DROPPED = 0;	//reset the error counters
+#if defined(U1RX_BUFSIZE)
+	U1STAbits.URXISEL = 2;						//10->interrupt at 3/4 full. the rest is picked up by uart1Available()
+	_u1rx_head = _u1rx_tail = 0;				//reset the rx buffer
+	IPC8bits.U1IP = UART_IPDEFAULT;				//interrupt priority
+	IPC8bits.U1IS = UART_ISDEFAULT;				//interrupt sub-priority
+	IFS1CLR = _IFS1_U1EIF_MASK;					//clear the flag
+	IEC1SET = _IEC1_U1RXIE_MASK | _IEC1_U1EIE_MASK;	//enable rx and rx error interrupts
+#else
 	U1STAbits.URXISEL = 0;						//U1STAbits.URXISEL1 = 0, U1STAbits.URXISEL0 = 0;
+#endif
 //#endif
 	//bit 5 ADDEN: Address Character Detect bit (bit 8 of received data = 1)
 	//1 = Address Detect mode enabled. If 9-bit mode is not selected, this does not take effect.
@@ -1000,6 +2100,15 @@ void uart1Init(unsigned long baud_rate) {
 
 }
 
+//turn off the usart: wait for tx to finish, disconnect u1tx, power down
+void uart1Deinit(void) {
+	if (U1MODEbits.UARTEN) while (U1STAbits.TRMT == 0) continue;	//last char shifted out
+	IEC1CLR = _IEC1_U1RXIE_MASK | _IEC1_U1EIE_MASK | _IEC1_U1TXIE_MASK;	//no more isrs
+	U1MODEbits.UARTEN = 0;			//0->uart off, pins back to the port latches
+	_ppsRelease(PPS_G1, 1);			//u1tx: group 1, 0b0001
+	_pmdDeinit(PMD_U1);				//power down the module
+}
+
 void uart1Putch(char ch) {
 	//Wait for TXREG Buffer to become available
 	//while(!TXIF);			//wait for prior transmission to finish
@@ -1041,13 +2150,55 @@ void uart1Putline(char *ln) {
 }
 
 //get the received char
+//returns 0 if nothing has been received - check uart1Available() first
 uint8_t uart1Getch(void) {
+#if defined(U1RX_BUFSIZE)
+	uint8_t ch;
+
+	if ((_u1rx_head == _u1rx_tail) && (uart1Available() == 0)) return 0;	//nothing received
+	ch = _u1rx_buf[_u1rx_tail & U1RX_MASK];
+	_u1rx_tail += 1;
+	return ch;
+#else
 	return U1RXREG;		//return it
+#endif
 }
 
-//test if data rx is available
+//number of chars received
+//polled mode: 1 if data rx is available
 uint16_t uart1Available(void) {
+#if defined(U1RX_BUFSIZE)
+	//drain-on-idle: pick up chars below the 3/4-full interrupt threshold
+	IEC1CLR = _IEC1_U1RXIE_MASK;				//hold off the isr
+	_u1rxDrain();
+	IEC1SET = _IEC1_U1RXIE_MASK;
+	return _u1rx_head - _u1rx_tail;
+#else
+	_u1rxDrain();								//clear OERR so the receiver doesn't stall
 	return U1STAbits.URXDA;
+#endif
+}
+
+//read up to n chars into buf
+//return the number of chars read
+uint16_t uart1Read(uint8_t *buf, uint16_t n) {
+	uint16_t i;
+#if defined(U1RX_BUFSIZE)
+	uint16_t cnt = uart1Available();			//drain the fifo once for the whole read
+
+	if (n > cnt) n = cnt;
+	for (i = 0; i < n; i++) buf[i] = _u1rx_buf[(_u1rx_tail + i) & U1RX_MASK];
+	_u1rx_tail += n;							//release the space in one go
+	return n;
+#else
+	for (i = 0; (i < n) && U1STAbits.URXDA; i++) buf[i] = U1RXREG;
+	return i;
+#endif
+}
+
+//rx error counters
+volatile UART_ErrTypeDef *uart1Errors(void) {
+	return &_u1err;
 }
 
 //test if uart tx is busy
@@ -1091,7 +2242,92 @@ void u1Print(char *str, int32_t dat) {
 }
 
 //uart2
-//initialize usart: high baudrate (brgh=1), 16-bit baudrate (brg16=1)
+#if defined(U2TX_BUFSIZE)
+//uart2 tx ring buffer
+//head advanced by uart2Putch(), tail advanced by the isr. both free running, wrapped by U2TX_MASK
+#define U2TX_MASK			(U2TX_BUFSIZE - 1)
+#if (U2TX_BUFSIZE & U2TX_MASK)
+#error "pic32duino.c: U2TX_BUFSIZE must be a power of 2!"
+#endif
+static volatile uint8_t _u2tx_buf[U2TX_BUFSIZE];		//tx buffer
+static volatile uint16_t _u2tx_head=0, _u2tx_tail=0;	//write / read index
+static volatile uint32_t _u2tx_dropped=0;				//chars dropped on overflow
+
+//move chars from the ring buffer into the hardware fifo
+//called with U2TXIE cleared, or from the isr
+static void _u2txFill(void) {
+	while ((_u2tx_tail != _u2tx_head) && !U2STAbits.UTXBF) {
+		U2TXREG = _u2tx_buf[_u2tx_tail & U2TX_MASK];	//load up the tx register
+		_u2tx_tail += 1;
+	}
+}
+
+#endif	//U2TX_BUFSIZE
+
+#if defined(U2RX_BUFSIZE)
+//uart2 rx ring buffer
+//head advanced by the isr (or by the drain step with U2RXIE cleared), tail advanced by the reader
+#define U2RX_MASK			(U2RX_BUFSIZE - 1)
+#if (U2RX_BUFSIZE & U2RX_MASK)
+#error "pic32duino.c: U2RX_BUFSIZE must be a power of 2!"
+#endif
+static volatile uint8_t _u2rx_buf[U2RX_BUFSIZE];		//rx buffer
+static volatile uint16_t _u2rx_head=0, _u2rx_tail=0;	//write / read index
+#endif	//U2RX_BUFSIZE
+static volatile UART_ErrTypeDef _u2err;				//rx error counters
+
+//move received chars out of the hardware fifo and account for errors
+//called with U2RXIE cleared, or from the isr
+static void _u2rxDrain(void) {
+	uint32_t sta;
+
+#if defined(U2RX_BUFSIZE)
+	while ((sta = U2STA) & _U2STA_URXDA_MASK) {
+		//FERR/PERR refer to the char at the top of the fifo
+		if (sta & _U2STA_FERR_MASK) _u2err.FERR += 1;
+		if (sta & _U2STA_PERR_MASK) _u2err.PERR += 1;
+		if ((uint16_t) (_u2rx_head - _u2rx_tail) >= U2RX_BUFSIZE) {U2RXREG; _u2err.DROPPED += 1;}	//ring full -> discard
+		else {_u2rx_buf[_u2rx_head & U2RX_MASK] = U2RXREG; _u2rx_head += 1;}
+	}
+#else
+	sta = U2STA;
+	if (sta & _U2STA_URXDA_MASK) return;		//polled mode: let the user read the fifo first
+#endif
+	//clearing OERR resets the fifo - so do it only after the fifo has been emptied
+	if (sta & _U2STA_OERR_MASK) {
+		_u2err.OERR += 1;
+		U2STACLR = _U2STA_OERR_MASK;			//restart the receiver
+	}
+}
+
+#if defined(U2TX_BUFSIZE) || defined(U2RX_BUFSIZE)
+//uart2 isr - tx / rx
+void __ISR(_UART_2_VECTOR) _U2Interrupt(void) {
+	ISR_ENTER(ISR_U2, 0);
+#if defined(U2RX_BUFSIZE)
+	if (IFS1bits.U2RXIF || IFS1bits.U2EIF) {
+		_u2rxDrain();							//empty the fifo into the ring buffer
+		IFS1CLR = _IFS1_U2RXIF_MASK | _IFS1_U2EIF_MASK;	//clear the flags
+	}
+#endif
+#if defined(U2TX_BUFSIZE)
+	if (IFS1bits.U2TXIF) {
+		_u2txFill();							//refill the fifo
+		IFS1CLR = _IFS1_U2TXIF_MASK;			//clear the flag
+		if (_u2tx_tail == _u2tx_head) IEC1CLR = _IEC1_U2TXIE_MASK;	//nothing left to send -> disable the interrupt
+	}
+#endif
+	ISR_EXIT(ISR_U2);
+}
+#endif	//U2TX_BUFSIZE || U2RX_BUFSIZE
+
+//brg from the baud rate at the current clock
+static unsigned long _uart2_br=UART_BR9600;		//baud rate
+static void _uart2Rebase(void) {
+	U2BRG = F_UART / 4 / _uart2_br - 1;			//set lower byte of brg
+}
+
+//initialize usart: high baudrate (brgh=1), 16-bit baudrate (brg16=1)
 //baudrate=Fxtal/(4*(spbrg+1))
 //spbrg=(Fxtal/4/baudrate)-1
 //tx/rx pins to be assumed in gpio mode
@@ -1111,7 +2347,7 @@ void uart2Init(unsigned long baud_rate) {
 
 
 	//disable md bits
-	PMD5bits.U2MD = 0;				//power up the module
+	_pmdInit(PMD_U2);				//power up the module
 
 	//U2MODEbits register
 	//bit 15 UARTEN: UARTx Enable bit(1)
@@ -1174,7 +2410,9 @@ void uart2Init(unsigned long baud_rate) {
 
 
 	//BAUDCON
-	U2BRG = F_UART / 4 / baud_rate - 1;				//set lower byte of brg
+	_uart2_br = baud_rate;
+	_uart2Rebase();								//set the brg
+	SystemCoreClockNotify(_uart2Rebase);			//and again after each clock change
 
 	//disable interrupts
 //#if defined(UxTX2RP)
@@ -1187,7 +2425,15 @@ void uart2Init(unsigned long baud_rate) {
 	//10 = Interrupt when a character is transferred to the Transmit Shift Register (TSR) and as a result, the transmit buffer becomes empty
 	//01 = Interrupt when the last character is shifted out of the Transmit Shift Register; all transmit operations are completed
 	//00 = Interrupt when a character is transferred to the Transmit Shift Register (this implies there is at least one character open in the transmit buffer)
+#if defined(U2TX_BUFSIZE)
+	U2STAbits.UTXISEL = 2;						//10->interrupt when the tx buffer becomes empty - refilled by the isr
+	_u2tx_head = _u2tx_tail = 0;				//reset the tx buffer
+	_u2tx_dropped = 0;
+	IPC9bits.U2IP = UART_IPDEFAULT;				//interrupt priority
+	IPC9bits.U2IS = UART_ISDEFAULT;				//interrupt sub-priority
+#else
 	U2STAbits.UTXISEL = 0;						//U2STAbits.UTXISEL1=0, U2STAbits.UTXISEL0=0;
+#endif
 //#endif
 	//bit 14 UTXINV: IrDAr Encoder Transmit Polarity Inversion bit
 	//If IREN = 0:
@@ -1229,7 +2475,17 @@ void uart2Init(unsigned long baud_rate) {
 	//11 = Interrupt is set on RSR transfer, making the receive buffer full (i.e., has 4 data characters)
 	//10 = Interrupt is set on RSR transfer, making the receive buffer 3/4 full (i.e., has 3 data characters)
 	//0x = Interrupt is set when any character is received and transferred from the RSR to the receive buffer. Receive buffer has one or more characters.
+	_u2err.OERR = _u2err.FERR = _u2err.PERR = _u2err.DROPPED = 0;	//reset the error counters
+#if defined(U2RX_BUFSIZE)
+	U2STAbits.URXISEL = 2;						//10->interrupt at 3/4 full. the rest is picked up by uart2Available()
+	_u2rx_head = _u2rx_tail = 0;				//reset the rx buffer
+	IPC9bits.U2IP = UART_IPDEFAULT;				//interrupt priority
+	IPC9bits.U2IS = UART_ISDEFAULT;				//interrupt sub-priority
+	IFS1CLR = _IFS1_U2EIF_MASK;					//clear the flag
+	IEC1SET = _IEC1_U2RXIE_MASK | _IEC1_U2EIE_MASK;	//enable rx and rx error interrupts
+#else
 	U2STAbits.URXISEL = 0;						//U2STAbits.URXISEL1 = 0, U2STAbits.URXISEL0 = 0;
+#endif
 //#endif
 	//bit 5 ADDEN: Address Character Detect bit (bit 8 of received data = 1)
 	//1 = Address Detect mode enabled. If 9-bit mode is not selected, this does not take effect.
@@ -1255,7 +2511,46 @@ void uart2Init(unsigned long baud_rate) {
 
 }
 
+//turn off the usart: wait for tx to finish, disconnect u2tx, power down
+void uart2Deinit(void) {
+	if (U2MODEbits.UARTEN) {
+		while (uart2Busy()) continue;			//tx buffer drained
+		while (U2STAbits.TRMT == 0) continue;	//last char shifted out
+	}
+	IEC1CLR = _IEC1_U2RXIE_MASK | _IEC1_U2EIE_MASK | _IEC1_U2TXIE_MASK;	//no more isrs
+	U2MODEbits.UARTEN = 0;			//0->uart off, pins back to the port latches
+	_ppsRelease(PPS_G4, 0b0010);	//u2tx: group 4, 0b0010
+	_pmdDeinit(PMD_U2);				//power down the module
+}
+
 void uart2Putch(char ch) {
+#if defined(U2TX_BUFSIZE)
+	//buffer full?
+	if ((uint16_t) (_u2tx_head - _u2tx_tail) >= U2TX_BUFSIZE) {
+#if   U2TX_OVERFLOW == UART_OVF_DROPNEW
+		_u2tx_dropped += 1;						//discard the new char
+		return;
+#elif U2TX_OVERFLOW == UART_OVF_DROPOLD
+		IEC1CLR = _IEC1_U2TXIE_MASK;			//hold off the isr
+		if ((uint16_t) (_u2tx_head - _u2tx_tail) >= U2TX_BUFSIZE) {
+			_u2tx_tail += 1;					//discard the oldest char
+			_u2tx_dropped += 1;
+		}
+#else	//UART_OVF_BLOCK
+		do {
+			//drain the buffer here too, in case the isr cannot run (interrupts disabled / called from a higher priority isr)
+			IEC1CLR = _IEC1_U2TXIE_MASK;		//hold off the isr
+			_u2txFill();
+			IEC1SET = _IEC1_U2TXIE_MASK;
+		} while ((uint16_t) (_u2tx_head - _u2tx_tail) >= U2TX_BUFSIZE);
+#endif
+	}
+	_u2tx_buf[_u2tx_head & U2TX_MASK] = ch;		//save the char
+	_u2tx_head += 1;
+	IEC1CLR = _IEC1_U2TXIE_MASK;				//hold off the isr
+	_u2txFill();								//prime the hardware fifo if the transmitter is idle
+	IEC1SET = _IEC1_U2TXIE_MASK;				//isr takes over from here
+#else
 	while (U2STAbits.UTXBF) continue;	//wait if the tx buffer is full
 
 	//Write data
@@ -1264,6 +2559,7 @@ void uart2Putch(char ch) {
 	//while(!TRMT);			//wait for the transmission to finish
 	//don't use txif as this is not back-to-back transmission
 	//USART_WAIT(U1STAbits.TRMT);
+#endif	//U2TX_BUFSIZE
 }
 
 void uart2Puts(char *str) {
@@ -1288,21 +2584,75 @@ void uart2Putline(char *ln) {
 	uart2Puts((char *)"\r\n");
 }
 
+//get the received char
+//returns 0 if nothing has been received - check uart2Available() first
 uint8_t uart2Getch(void) {
-	//while(!RCIF); RCIF=0;		//Wait for a byte
-	//USART_WAIT(U1STAbits.TRMT);		//wait for the prior transmission to end
+#if defined(U2RX_BUFSIZE)
+	uint8_t ch;
 
+	if ((_u2rx_head == _u2rx_tail) && (uart2Available() == 0)) return 0;	//nothing received
+	ch = _u2rx_buf[_u2rx_tail & U2RX_MASK];
+	_u2rx_tail += 1;
+	return ch;
+#else
 	return U2RXREG;		//return it
+#endif
 }
 
-//test if data rx is available
+//number of chars received
+//polled mode: 1 if data rx is available
 uint16_t uart2Available(void) {
+#if defined(U2RX_BUFSIZE)
+	//drain-on-idle: pick up chars below the 3/4-full interrupt threshold
+	IEC1CLR = _IEC1_U2RXIE_MASK;				//hold off the isr
+	_u2rxDrain();
+	IEC1SET = _IEC1_U2RXIE_MASK;
+	return _u2rx_head - _u2rx_tail;
+#else
+	_u2rxDrain();								//clear OERR so the receiver doesn't stall
 	return U2STAbits.URXDA;
+#endif
+}
+
+//read up to n chars into buf
+//return the number of chars read
+uint16_t uart2Read(uint8_t *buf, uint16_t n) {
+	uint16_t i;
+#if defined(U2RX_BUFSIZE)
+	uint16_t cnt = uart2Available();			//drain the fifo once for the whole read
+
+	if (n > cnt) n = cnt;
+	for (i = 0; i < n; i++) buf[i] = _u2rx_buf[(_u2rx_tail + i) & U2RX_MASK];
+	_u2rx_tail += n;							//release the space in one go
+	return n;
+#else
+	for (i = 0; (i < n) && U2STAbits.URXDA; i++) buf[i] = U2RXREG;
+	return i;
+#endif
+}
+
+//rx error counters
+volatile UART_ErrTypeDef *uart2Errors(void) {
+	return &_u2err;
 }
 
 //test if uart tx is busy
+//with tx buffer: busy until the buffer has been drained into the hardware fifo
 uint16_t uart2Busy(void) {
+#if defined(U2TX_BUFSIZE)
+	return (_u2tx_head != _u2tx_tail) || U2STAbits.UTXBF;
+#else
 	return U2STAbits.UTXBF;
+#endif
+}
+
+//number of chars dropped on tx buffer overflow
+uint32_t uart2TxDropped(void) {
+#if defined(U2TX_BUFSIZE)
+	return _u2tx_dropped;
+#else
+	return 0;
+#endif
 }
 
 //print to uart2
@@ -1346,16 +2696,30 @@ void u2Print(char *str, int32_t dat) {
 static void (* _tmr1_isrptr)(void)=empty_handler;				//tmr1_ptr pointing to empty_handler by default
 
 //interrupt service routine
-void __ISR(_TIMER_1_VECTOR/*, TxIPL*/) _T1Interrupt(void) {
+#if defined(TMR1_HANDLER)
+#define TMR1_DIRECT
+#else
+#define TMR1_HANDLER()		_tmr1_isrptr()
+#endif
+#if defined(TMR1_DIRECT) || !defined(USE_ISR_DIRECT)
+#if defined(TMR1_ISRIPL)
+#define TMR1_ISR		__ISR(_TIMER_1_VECTOR, TMR1_ISRIPL)
+#else
+#define TMR1_ISR		__ISR(_TIMER_1_VECTOR)
+#endif
+void TMR1_ISR _T1Interrupt(void) {
+	ISR_ENTER(ISR_T1, ISR_LAT_TMR(TMR1, T1CONbits.TCKPS, 1));
 	IFS0bits.T1IF=0;							//clear tmr1 interrupt flag
-	_tmr1_isrptr();								//execute user tmr1 isr
+	TMR1_HANDLER();								//execute user tmr1 isr
+	ISR_EXIT(ISR_T1);
 }
+#endif	//TMR1_DIRECT
 
 //initialize the timer1 (16bit)
 void tmr1Init(uint8_t ps, uint16_t period) {
 	_tmr1_isrptr=empty_handler;					//point to default handler
 
-	PMD4bits.T1MD = 0;							//enable power to tmr
+	_pmdInit(PMD_T1);							//enable power to tmr
 	T1CONbits.TON = 0;							//turn off rtc1
 	T1CONbits.TCS = 0;							//use internal clock = Fosc
 	//T1CONbits.T32 = 0;						//0->16 bit timer, 1->32bit timer
@@ -1368,32 +2732,55 @@ void tmr1Init(uint8_t ps, uint16_t period) {
 	T1CONbits.TON = 1;							//turn on rtc1
 }
 
+//stop the timer and power it down
+void tmr1Deinit(void) {
+	T1CONbits.TON = 0;							//turn off the timer
+	IEC0CLR = _IEC0_T1IE_MASK;					//no more isrs
+	_tmr1_isrptr=empty_handler;					//point to default handler
+	_pmdDeinit(PMD_T1);							//power down the timer
+}
+
+#if defined(TMR1_DIRECT) || !defined(USE_ISR_DIRECT)
 //activate the isr handler
-void tmr1AttachISR(void (*isrptr)(void)) {
+void tmr1AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub) {
+#if defined(TMR1_ISRIPL)
+	if (ipl != ISRIPL_PRIO(TMR1_ISRIPL)) return;		//the vector is built for another priority: leave it off
+#endif
 	_tmr1_isrptr=isrptr;						//activate the isr handler
-	IPC1bits.T1IP = TMR_IPDEFAULT;
-	IPC1bits.T1IS = TMR_ISDEFAULT;
+	IPC1bits.T1IP = ipl;
+	IPC1bits.T1IS = sub;
 	IFS0bits.T1IF = 0;							//reset the flag
 	IEC0bits.T1IE = 1;							//rtc1 interrupt on
 }
+#endif
 
 //tmr2
 //global variables
 static void (* _tmr2_isrptr)(void)=empty_handler;				//tmr1_ptr pointing to empty_handler by default
 
 //interrupt service routine
-void __ISR(_TIMER_2_VECTOR/*, TxIPL*/) _T2Interrupt(void) {
+#if !defined(TMR2_HANDLER)
+#define TMR2_HANDLER()		_tmr2_isrptr()
+#endif
+#if defined(TMR2_ISRIPL)
+#define TMR2_ISR		__ISR(_TIMER_2_VECTOR, TMR2_ISRIPL)
+#else
+#define TMR2_ISR		__ISR(_TIMER_2_VECTOR)
+#endif
+void TMR2_ISR _T2Interrupt(void) {
+	ISR_ENTER(ISR_T2, ISR_LAT_TMR(TMR2, T2CONbits.TCKPS, 0));
 	IFS0bits.T2IF=0;							//clear tmr1 interrupt flag
 	systick_count+= 1ul<<16;					//T2 runs in 16 bit mode, 1:1 prescaler
-	_tmr2_isrptr();								//execute user tmr2 isr
+	_ticks64Update();							//extend coreticks() to 64 bits
+	TMR2_HANDLER();								//execute user tmr2 isr
+	ISR_EXIT(ISR_T2);
 }
 
 //initialize the timer2 (16bit)
 void tmr2Init(uint8_t ps, uint16_t period) {
 	_tmr2_isrptr=empty_handler;					//point to default handler
-	systick_count=0;							//reset systick
 
-	PMD4bits.T2MD = 0;							//enable power to tmr
+	_pmdInit(PMD_T2);							//enable power to tmr
 	T2CONbits.TON = 0;							//turn off rtc1
 	T2CONbits.TCS = 0;							//use internal clock = Fosc
 	T2CONbits.T32 = 0;							//0->16 bit timer, 1->32bit timer
@@ -1402,15 +2789,18 @@ void tmr2Init(uint8_t ps, uint16_t period) {
 	TMR2 = 0;									//reset the timer/counter
 	PR2=period-0;								//minimum rtc resolution is 1ms
 	IFS0bits.T2IF = 0;							//reset the flag
-	IEC0bits.T2IE = 0;							//rtc1 interrupt off
+	IEC0bits.T2IE = 1;							//keep the time base isr running
 	T2CONbits.TON = 1;							//turn on rtc1
 }
 
 //activate the isr handler
-void tmr2AttachISR(void (*isrptr)(void)) {
+void tmr2AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub) {
+#if defined(TMR2_ISRIPL)
+	if (ipl != ISRIPL_PRIO(TMR2_ISRIPL)) return;		//the vector is built for another priority: leave it off
+#endif
 	_tmr2_isrptr=isrptr;						//activate the isr handler
-	IPC2bits.T2IP = TMR_IPDEFAULT;
-	IPC2bits.T2IS = TMR_ISDEFAULT;
+	IPC2bits.T2IP = ipl;
+	IPC2bits.T2IS = sub;
 	IFS0bits.T2IF = 0;							//reset the flag
 	IEC0bits.T2IE = 1;							//rtc1 interrupt on
 }
@@ -1420,16 +2810,30 @@ void tmr2AttachISR(void (*isrptr)(void)) {
 static void (* _tmr3_isrptr)(void)=empty_handler;				//tmr1_ptr pointing to empty_handler by default
 
 //interrupt service routine
-void __ISR(_TIMER_3_VECTOR/*, TxIPL*/) _T3Interrupt(void) {
+#if defined(TMR3_HANDLER)
+#define TMR3_DIRECT
+#else
+#define TMR3_HANDLER()		_tmr3_isrptr()
+#endif
+#if defined(TMR3_DIRECT) || !defined(USE_ISR_DIRECT)
+#if defined(TMR3_ISRIPL)
+#define TMR3_ISR		__ISR(_TIMER_3_VECTOR, TMR3_ISRIPL)
+#else
+#define TMR3_ISR		__ISR(_TIMER_3_VECTOR)
+#endif
+void TMR3_ISR _T3Interrupt(void) {
+	ISR_ENTER(ISR_T3, ISR_LAT_TMR(TMR3, T3CONbits.TCKPS, 0));
 	IFS0bits.T3IF=0;							//clear tmr1 interrupt flag
-	_tmr3_isrptr();								//execute user tmr1 isr
+	TMR3_HANDLER();								//execute user tmr1 isr
+	ISR_EXIT(ISR_T3);
 }
+#endif	//TMR3_DIRECT
 
 //initialize the timer3 (16bit)
 void tmr3Init(uint8_t ps, uint16_t period) {
 	_tmr3_isrptr=empty_handler;					//point to default handler
 
-	PMD4bits.T3MD = 0;							//enable power to tmr
+	_pmdInit(PMD_T3);							//enable power to tmr
 	T3CONbits.TON = 0;							//turn off rtc1
 	T3CONbits.TCS = 0;							//use internal clock = Fosc
 	//T3CONbits.T32 = 0;						//0->16 bit timer, 1->32bit timer
@@ -1442,30 +2846,57 @@ void tmr3Init(uint8_t ps, uint16_t period) {
 	T3CONbits.TON = 1;							//turn on rtc1
 }
 
+//stop the timer and power it down
+void tmr3Deinit(void) {
+	T3CONbits.TON = 0;							//turn off the timer
+	IEC0CLR = _IEC0_T3IE_MASK;					//no more isrs
+	_tmr3_isrptr=empty_handler;					//point to default handler
+	_pmdDeinit(PMD_T3);							//power down the timer
+}
+
+#if defined(TMR3_DIRECT) || !defined(USE_ISR_DIRECT)
 //activate the isr handler
-void tmr3AttachISR(void (*isrptr)(void)) {
+void tmr3AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub) {
+#if defined(TMR3_ISRIPL)
+	if (ipl != ISRIPL_PRIO(TMR3_ISRIPL)) return;		//the vector is built for another priority: leave it off
+#endif
 	_tmr3_isrptr=isrptr;						//activate the isr handler
-	IPC3bits.T3IP = TMR_IPDEFAULT;
-	IPC3bits.T3IS = TMR_ISDEFAULT;
+	IPC3bits.T3IP = ipl;
+	IPC3bits.T3IS = sub;
 	IFS0bits.T3IF = 0;							//reset the flag
 	IEC0bits.T3IE = 1;							//rtc1 interrupt on
 }
+#endif
 
 //tmr4
 //global variables
 static void (* _tmr4_isrptr)(void)=empty_handler;				//tmr1_ptr pointing to empty_handler by default
 
 //interrupt service routine
-void __ISR(_TIMER_4_VECTOR/*, TxIPL*/) _T4Interrupt(void) {
+#if defined(TMR4_HANDLER)
+#define TMR4_DIRECT
+#else
+#define TMR4_HANDLER()		_tmr4_isrptr()
+#endif
+#if defined(TMR4_DIRECT) || !defined(USE_ISR_DIRECT)
+#if defined(TMR4_ISRIPL)
+#define TMR4_ISR		__ISR(_TIMER_4_VECTOR, TMR4_ISRIPL)
+#else
+#define TMR4_ISR		__ISR(_TIMER_4_VECTOR)
+#endif
+void TMR4_ISR _T4Interrupt(void) {
+	ISR_ENTER(ISR_T4, ISR_LAT_TMR(TMR4, T4CONbits.TCKPS, 0));
 	IFS0bits.T4IF=0;							//clear tmr1 interrupt flag
-	_tmr4_isrptr();								//execute user tmr1 isr
+	TMR4_HANDLER();								//execute user tmr1 isr
+	ISR_EXIT(ISR_T4);
 }
+#endif	//TMR4_DIRECT
 
 //initialize the timer4 (16bit)
 void tmr4Init(uint8_t ps, uint16_t period) {
 	_tmr4_isrptr=empty_handler;					//point to default handler
 
-	PMD4bits.T4MD = 0;							//enable power to tmr
+	_pmdInit(PMD_T4);							//enable power to tmr
 	T4CONbits.TON = 0;							//turn off rtc1
 	T4CONbits.TCS = 0;							//use internal clock = Fosc
 	T4CONbits.T32 = 0;							//0->16 bit timer, 1->32bit timer
@@ -1478,30 +2909,57 @@ void tmr4Init(uint8_t ps, uint16_t period) {
 	T4CONbits.TON = 1;							//turn on rtc1
 }
 
+//stop the timer and power it down
+void tmr4Deinit(void) {
+	T4CONbits.TON = 0;							//turn off the timer
+	IEC0CLR = _IEC0_T4IE_MASK;					//no more isrs
+	_tmr4_isrptr=empty_handler;					//point to default handler
+	_pmdDeinit(PMD_T4);							//power down the timer
+}
+
+#if defined(TMR4_DIRECT) || !defined(USE_ISR_DIRECT)
 //activate the isr handler
-void tmr4AttachISR(void (*isrptr)(void)) {
+void tmr4AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub) {
+#if defined(TMR4_ISRIPL)
+	if (ipl != ISRIPL_PRIO(TMR4_ISRIPL)) return;		//the vector is built for another priority: leave it off
+#endif
 	_tmr4_isrptr=isrptr;						//activate the isr handler
-	IPC4bits.T4IP = TMR_IPDEFAULT;
-	IPC4bits.T4IS = TMR_ISDEFAULT;
+	IPC4bits.T4IP = ipl;
+	IPC4bits.T4IS = sub;
 	IFS0bits.T4IF = 0;							//reset the flag
 	IEC0bits.T4IE = 1;							//rtc1 interrupt on
 }
+#endif
 
 //tmr5
 //global variables
 static void (* _tmr5_isrptr)(void)=empty_handler;				//tmr1_ptr pointing to empty_handler by default
 
 //interrupt service routine
-void __ISR(_TIMER_5_VECTOR/*, TxIPL*/) _T5Interrupt(void) {
+#if defined(TMR5_HANDLER)
+#define TMR5_DIRECT
+#else
+#define TMR5_HANDLER()		_tmr5_isrptr()
+#endif
+#if defined(TMR5_DIRECT) || !defined(USE_ISR_DIRECT)
+#if defined(TMR5_ISRIPL)
+#define TMR5_ISR		__ISR(_TIMER_5_VECTOR, TMR5_ISRIPL)
+#else
+#define TMR5_ISR		__ISR(_TIMER_5_VECTOR)
+#endif
+void TMR5_ISR _T5Interrupt(void) {
+	ISR_ENTER(ISR_T5, ISR_LAT_TMR(TMR5, T5CONbits.TCKPS, 0));
 	IFS0bits.T5IF=0;							//clear tmr1 interrupt flag
-	_tmr5_isrptr();								//execute user tmr1 isr
+	TMR5_HANDLER();								//execute user tmr1 isr
+	ISR_EXIT(ISR_T5);
 }
+#endif	//TMR5_DIRECT
 
 //initialize the timer5 (16bit)
 void tmr5Init(uint8_t ps, uint16_t period) {
 	_tmr5_isrptr=empty_handler;					//point to default handler
 
-	PMD4bits.T5MD = 0;							//enable power to tmr
+	_pmdInit(PMD_T5);							//enable power to tmr
 	T5CONbits.TON = 0;							//turn off rtc1
 	T5CONbits.TCS = 0;							//use internal clock = Fosc
 	//T5CONbits.T32 = 0;						//0->16 bit timer, 1->32bit timer
@@ -1514,14 +2972,27 @@ void tmr5Init(uint8_t ps, uint16_t period) {
 	T5CONbits.TON = 1;							//turn on rtc1
 }
 
+//stop the timer and power it down
+void tmr5Deinit(void) {
+	T5CONbits.TON = 0;							//turn off the timer
+	IEC0CLR = _IEC0_T5IE_MASK;					//no more isrs
+	_tmr5_isrptr=empty_handler;					//point to default handler
+	_pmdDeinit(PMD_T5);							//power down the timer
+}
+
+#if defined(TMR5_DIRECT) || !defined(USE_ISR_DIRECT)
 //activate the isr handler
-void tmr5AttachISR(void (*isrptr)(void)) {
+void tmr5AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub) {
+#if defined(TMR5_ISRIPL)
+	if (ipl != ISRIPL_PRIO(TMR5_ISRIPL)) return;		//the vector is built for another priority: leave it off
+#endif
 	_tmr5_isrptr=isrptr;						//activate the isr handler
-	IPC5bits.T5IP = TMR_IPDEFAULT;
-	IPC5bits.T5IS = TMR_ISDEFAULT;
+	IPC5bits.T5IP = ipl;
+	IPC5bits.T5IS = sub;
 	IFS0bits.T5IF = 0;							//reset the flag
 	IEC0bits.T5IE = 1;							//rtc1 interrupt on
 }
+#endif
 
 //32-bit timer
 //tmr2 as lsw, tmr3 as msw
@@ -1548,8 +3019,6 @@ uint32_t tmr23Get(void) {
 	return ((uint32_t) tmr3 << 16) | tmr2;
 }
 
-#define tmr23AttachISR(isr)		tmr3AttachISR(isr)
-
 //tmr4 as lsw, tmr5 as msw
 void tmr45Init(uint8_t ps, uint32_t period) {
 	tmr4Init(ps, period);
@@ -1574,8 +3043,6 @@ uint32_t tmr45Get(void) {
 	return ((uint32_t) tmr5 << 16) | tmr4;
 }
 
-#define tmr45AttachISR(isr)		tmr5AttachISR(isr)
-
 //end Timer
 
 //define pwm functions
@@ -1585,7 +3052,7 @@ uint32_t tmr45Get(void) {
 //reset pwm
 void pwm1Init(void) {
 	//power up the pwm module
-	PMD3bits.OC1MD = 0;						//0->turn on the peripheral, 1->turn off the peripheral
+	_pmdInit(PMD_OC1);						//0->turn on the peripheral, 1->turn off the peripheral
 
 #if defined(PWM12RP)
 	//assign the output pins
@@ -1609,7 +3076,7 @@ void pwm1Init(void) {
 //reset pwm
 void pwm2Init(void) {
 	//power up the pwm module
-	PMD3bits.OC2MD = 0;						//0->turn on the peripheral, 1->turn off the peripheral
+	_pmdInit(PMD_OC2);						//0->turn on the peripheral, 1->turn off the peripheral
 
 #if defined(PWM22RP)
 	//assign the output pins
@@ -1632,7 +3099,7 @@ void pwm2Init(void) {
 //reset pwm
 void pwm3Init(void) {
 	//power up the pwm module
-	PMD3bits.OC3MD = 0;						//0->turn on the peripheral, 1->turn off the peripheral
+	_pmdInit(PMD_OC3);						//0->turn on the peripheral, 1->turn off the peripheral
 
 #if defined(PWM32RP)
 	//assign the output pins
@@ -1656,7 +3123,7 @@ void pwm3Init(void) {
 //reset pwm
 void pwm4Init(void) {
 	//power up the pwm module
-	PMD3bits.OC4MD = 0;						//0->turn on the peripheral, 1->turn off the peripheral
+	_pmdInit(PMD_OC4);						//0->turn on the peripheral, 1->turn off the peripheral
 
 #if defined(PWM42RP)
 	//assign the output pins
@@ -1680,7 +3147,7 @@ void pwm4Init(void) {
 //reset pwm
 void pwm5Init(void) {
 	//power up the pwm module
-	PMD3bits.OC5MD = 0;						//0->turn on the peripheral, 1->turn off the peripheral
+	_pmdInit(PMD_OC5);						//0->turn on the peripheral, 1->turn off the peripheral
 
 #if defined(PWM52RP)
 	//assign the output pins
@@ -1699,13 +3166,132 @@ void pwm5Init(void) {
 	OC5CONbits.ON= 1;						//1->turn on oc, 0->turn off oc
 }
 
+//analogWrite
+//pins each oc can be mapped to, with the pps output code
+static const struct {
+	PIN_TypeDef pin;
+	uint8_t oc;									//1..5
+	volatile uint32_t *rpr;						//RPxnR register of the pin
+	uint8_t code;								//pps code of the oc
+} _pwm_pins[] = {
+	{PA0, 1, &RPA0R, 0b0101},				//oc1 -> RA0
+	{PB3, 1, &RPB3R, 0b0101},				//oc1 -> RB3
+	{PB4, 1, &RPB4R, 0b0101},				//oc1 -> RB4
+	{PB15, 1, &RPB15R, 0b0101},				//oc1 -> RB15
+	{PB7, 1, &RPB7R, 0b0101},				//oc1 -> RB7
+	{PA1, 2, &RPA1R, 0b0101},				//oc2 -> RA1
+	{PB5, 2, &RPB5R, 0b0101},				//oc2 -> RB5
+	{PB1, 2, &RPB1R, 0b0101},				//oc2 -> RB1
+	{PB11, 2, &RPB11R, 0b0101},				//oc2 -> RB11
+	{PB8, 2, &RPB8R, 0b0101},				//oc2 -> RB8
+	{PA3, 3, &RPA3R, 0b0101},				//oc3 -> RA3
+	{PB14, 3, &RPB14R, 0b0101},				//oc3 -> RB14
+	{PB0, 3, &RPB0R, 0b0101},				//oc3 -> RB0
+	{PB10, 3, &RPB10R, 0b0101},				//oc3 -> RB10
+	{PB9, 3, &RPB9R, 0b0101},				//oc3 -> RB9
+	{PA2, 4, &RPA2R, 0b0101},				//oc4 -> RA2
+	{PA2, 5, &RPA2R, 0b0110},				//oc5 -> RA2
+	{PB6, 4, &RPB6R, 0b0101},				//oc4 -> RB6
+	{PB6, 5, &RPB6R, 0b0110},				//oc5 -> RB6
+	{PA4, 4, &RPA4R, 0b0101},				//oc4 -> RA4
+	{PA4, 5, &RPA4R, 0b0110},				//oc5 -> RA4
+	{PB13, 4, &RPB13R, 0b0101},				//oc4 -> RB13
+	{PB13, 5, &RPB13R, 0b0110},				//oc5 -> RB13
+	{PB2, 4, &RPB2R, 0b0101},				//oc4 -> RB2
+	{PB2, 5, &RPB2R, 0b0110},				//oc5 -> RB2
+#if defined(_PORTC)
+	{PC7, 1, &RPC7R, 0b0101},				//oc1 -> RC7
+	{PC0, 1, &RPC0R, 0b0101},				//oc1 -> RC0
+	{PC5, 1, &RPC5R, 0b0101},				//oc1 -> RC5
+	{PA8, 2, &RPA8R, 0b0101},				//oc2 -> RA8
+	{PC8, 2, &RPC8R, 0b0101},				//oc2 -> RC8
+	{PA9, 2, &RPA9R, 0b0101},				//oc2 -> RA9
+	{PC9, 3, &RPC9R, 0b0101},				//oc3 -> RC9
+	{PC2, 3, &RPC2R, 0b0101},				//oc3 -> RC2
+	{PC4, 3, &RPC4R, 0b0101},				//oc3 -> RC4
+	{PC6, 4, &RPC6R, 0b0101},				//oc4 -> RC6
+	{PC6, 5, &RPC6R, 0b0110},				//oc5 -> RC6
+	{PC1, 4, &RPC1R, 0b0101},				//oc4 -> RC1
+	{PC1, 5, &RPC1R, 0b0110},				//oc5 -> RC1
+	{PC3, 4, &RPC3R, 0b0101},				//oc4 -> RC3
+	{PC3, 5, &RPC3R, 0b0110},				//oc5 -> RC3
+#endif
+};
+static volatile uint32_t * const _pwm_ocr[5] = {&OC1R, &OC2R, &OC3R, &OC4R, &OC5R};
+static volatile uint32_t * const _pwm_ocrs[5] = {&OC1RS, &OC2RS, &OC3RS, &OC4RS, &OC5RS};
+static volatile uint32_t * const _pwm_occon[5] = {&OC1CON, &OC2CON, &OC3CON, &OC4CON, &OC5CON};
+static uint8_t _pwm_pinoc[PMAX];				//oc driving a pin: 1..5, 0->none
+static uint8_t _pwm_ocused=0;					//bit n-1 set -> ocn taken by analogWrite()
+
+//map pin to a free oc and start the pwm on it
+//an oc is free if analogWrite() doesn't use it, no driver holds it (pwmxInit(), ocxInit(), pmdOn()) and it is off
+//returns the oc (1..5), 0 if no free oc can reach the pin
+static uint8_t _pwmAlloc(PIN_TypeDef pin) {
+	uint8_t i, n;
+
+	for (i=0; i<sizeof(_pwm_pins) / sizeof(_pwm_pins[0]); i++) {
+		n = _pwm_pins[i].oc;
+		if ((_pwm_pins[i].pin != pin) || (_pwm_ocused & (1<<(n - 1)))) continue;
+		if (pmdRefs(PMD_OC1 + n - 1) || (*_pwm_occon[n - 1] & (1<<15))) continue;	//in use by a driver
+		_pwm_ocused |= 1<<(n - 1);
+		pmdOn(PMD_OC1 + n - 1);					//analogWrite()'s own reference, kept for good
+		*_pwm_occon[n - 1] = 0x0000;			//reset the oc
+		*_pwm_ocr[n - 1] = *_pwm_ocrs[n - 1] = 0;	//reset the duty cycle registers
+		*_pwm_occon[n - 1] = (0<<3) | 0x06;		//OCTSEL: 0->timebase = timer2; OCM: 0b110 -> pwm on OCx, fault pin disabled
+		*_pwm_pins[i].rpr = _pwm_pins[i].code;	//map the oc to the pin
+		GPIO_PinDef[pin].gpio->ANSELCLR = GPIO_PinDef[pin].mask;	//digital
+		FIO_OUT(GPIO_PinDef[pin].gpio, GPIO_PinDef[pin].mask);		//output
+		*_pwm_occon[n - 1] |= 1<<15;			//1->turn on oc, 0->turn off oc
+		return _pwm_pinoc[pin] = n;
+	}
+	return 0;
+}
+
+//set pwm duty cycle on pin
+void analogWrite(PIN_TypeDef pin, uint16_t dc) {
+	uint8_t n = _pwm_pinoc[pin];
+
+	if (n == 0) n = _pwmAlloc(pin);				//first call on this pin
+	if (n) *_pwm_ocrs[n - 1] = dc;				//a single OCxRS store
+}
 //end pwm/oc
 
 //adc module
+//adc channel -> analog pin
+//pin lay-out may change
+//below is for pic32mx1xx/2xx/3xx pdip
+static const struct {
+	GPIO_TypeDef *gpio;							//gpio port, NULL -> no pin
+	uint16_t mask;								//pin mask
+} _adc_pins[16] = {
+	{GPIOA, 1<<0},								//AN0 = RA0
+	{GPIOA, 1<<1},								//AN1 = RA1
+	{GPIOB, 1<<0},								//AN2 = RB0
+	{GPIOB, 1<<1},								//AN3 = RB1
+	{GPIOB, 1<<2},								//AN4 = RB2
+	{GPIOB, 1<<3},								//AN5 = RB3
+#if defined(_PORTC)
+	{GPIOC, 1<<0},								//AN6 = RC0
+	{GPIOC, 1<<1},								//AN7 = RC1
+	{GPIOC, 1<<2},								//AN8 = RC2
+#else
+	{NULL, 0}, {NULL, 0}, {NULL, 0},			//AN6..8 not bonded out
+#endif
+	{GPIOB, 1<<15},								//AN9 = RB15
+	{GPIOB, 1<<14},								//AN10= RB14
+	{GPIOB, 1<<13},								//AN11= RB13
+	{GPIOB, 1<<12},								//AN12= RB12
+	{NULL, 0},									//AN13= CTMUT
+	{NULL, 0},									//AN14= Internal Vref
+	{NULL, 0},									//AN15= Open
+};
+
+static uint8_t _adc_ch=0xff;					//last channel selected by analogReadStart()
+
 //rest the adc
 //automatic sampling (ASAM=1), manual conversion
 void adcInit(void) {
-	PMD1bits.AD1MD = 0;						//0->enable peripheral, 1->disable peripheral
+	_pmdInit(PMD_AD1);						//0->enable peripheral, 1->disable peripheral
 	//turn off the adc
 	AD1CON1bits.ON = 0;				//0->adc off, 1->adc on
 
@@ -1754,6 +3340,7 @@ void adcInit(void) {
 #endif
 	//AD1CON3 = 0x0002;
 	AD1CSSL = 0;					//0->no scaning
+	_adc_ch = 0xff;					//no channel selected yet
 	//use muxA always
 	//negative input is VR-
 	AD1CHSbits.CH0NA = 0;			//0->ch0 negative is VR-, 1->ch0 negative is AN1
@@ -1762,70 +3349,146 @@ void adcInit(void) {
 	AD1CON1bits.ON = 1;				//0->adc off, 1->adc on
 }
 
+//turn off the adc and power it down
+//a scan's tmr3 trigger keeps running: adcScanStop() or tmr3Deinit() first
+void adcDeinit(void) {
+	IEC0CLR = _IEC0_AD1IE_MASK;		//no more isrs
+	AD1CON1bits.ON = 0;				//0->adc off, 1->adc on
+	_adc_ch = 0xff;					//no channel selected
+	_pmdDeinit(PMD_AD1);			//power down the module
+}
+
+//start a conversion on ch - non-blocking
+//the pin is put back in analog mode every time - pinMode() / analogWrite() / pulseMeasureStart() may have made it digital
+//CH0SA is written only when the channel changes
+void analogReadStart(uint16_t ch) {
+	ch = ch & 0x0f;					//0..15 is valid input
+	if (_adc_pins[ch].gpio) _adc_pins[ch].gpio->ANSELSET = _adc_pins[ch].mask;	//analog mode: a single store
+	if (ch != _adc_ch) {			//new channel
+		_adc_ch = ch;
+		AD1CHSbits.CH0SA = ch;		//set Ch0 positive input
+	}
+	AD1CON1CLR = _AD1CON1_DONE_MASK;	//clear the DONE bit -> it is persistent in manual mode
+	AD1CON1SET = _AD1CON1_SAMP_MASK;	//1->set SAMP to start sampling, 0->stop sampling and start conversion
+}
+
 //read the adc
 uint16_t analogRead(uint16_t ch) {
-	//int i;
+	analogReadStart(ch);
+	//wait for the conversion to end
+	while (analogReadReady() == 0) continue;	//0->conversion on going, 1->conversion done
+	return analogReadResult();
+}
+
+#if defined(ADC_SCANDEPTH)
+//scan sampler
+//AD1CSSL selects the channels, BUFM splits ADC1BUF into two 8-word halves: the adc fills one half while the isr reads the other
+//each isr copies one sample set into _adc_scanbuf[_adc_scanwr]; a full half is handed to the user and the isr moves to the other half
+static uint16_t _adc_scanbuf[2][ADC_SCANDEPTH * ADC_SCANMAX];	//double buffer
+static uint8_t _adc_scannch=0;					//number of channels in a sample set
+static uint16_t _adc_scanidx=0;					//write index into the current half
+static volatile uint8_t _adc_scanwr=0;			//half being filled by the isr
+static volatile uint8_t _adc_scanrdy=0;			//1->the other half is filled and not yet collected
+static volatile uint32_t _adc_scanovf=0;		//filled halves not collected in time
+
+//end of scan isr
+void __ISR(_ADC_VECTOR) _ADCInterrupt(void) {
+	volatile uint32_t *src = AD1CON2bits.BUFS ? &ADC1BUF0 : &ADC1BUF8;	//1->adc filling 8..15, read 0..7
+	uint16_t *dst = &_adc_scanbuf[_adc_scanwr][_adc_scanidx];
+	uint8_t i;
+
+	ISR_ENTER(ISR_ADC, 0);
+	for (i=0; i<_adc_scannch; i++) dst[i] = src[i * 4];	//ADC1BUFn are 16 bytes apart
+	IFS0CLR = _IFS0_AD1IF_MASK;					//clear the flag
+	_adc_scanidx += _adc_scannch;
+	if (_adc_scanidx >= _adc_scannch * ADC_SCANDEPTH) {	//current half filled -> swap
+		_adc_scanidx = 0;
+		if (_adc_scanrdy) _adc_scanovf += 1;	//previous half not collected
+		_adc_scanrdy = 1;
+		_adc_scanwr ^= 1;
+	}
+	ISR_EXIT(ISR_ADC);
+}
+
+//scan channels in chmask (bit n -> ADC_ANn) at rate sample sets per second
+//only the lowest ADC_SCANMAX channels in chmask are scanned
+//tmr3 period match triggers each conversion -> tmr3 runs at rate x channels
+void adcScanInit(uint16_t chmask, uint32_t rate) {
+	uint16_t mask=0;
+	uint8_t ch, ps;
+	uint32_t period;
+
+	adcInit();									//reset the adc
+	AD1CON1bits.ON = 0;							//0->adc off, 1->adc on
+	IEC0CLR = _IEC0_AD1IE_MASK;					//stop the isr
+
+	//pick the channels and put their pins in analog mode - once for the whole scan
+	_adc_scannch = 0;
+	for (ch=0; ch<16; ch++) {
+		if ((chmask & (1<<ch)) && (_adc_scannch < ADC_SCANMAX)) {
+			mask |= 1<<ch; _adc_scannch += 1;
+			if (_adc_pins[ch].gpio) {
+				_adc_pins[ch].gpio->ANSELSET = _adc_pins[ch].mask;	//analog mode
+				_adc_pins[ch].gpio->TRISSET = _adc_pins[ch].mask;	//input
+			}
+		}
+	}
+	if (_adc_scannch == 0) return;				//nothing to scan
+	_adc_scanidx = 0; _adc_scanwr = 0; _adc_scanrdy = 0; _adc_scanovf = 0;
+
+	AD1CON1bits.SSRC = 2;						//2->timer3 period match ends sampling and starts conversion
+	AD1CON1bits.ASAM = 1;						//1->sampling begins immediately after last conversion
+	AD1CON2bits.CSCNA = 1;						//1->scan inputs
+	AD1CON2bits.SMPI = _adc_scannch - 1;		//interrupt at the end of each scan
+	AD1CON2bits.BUFM = 1;						//1->two 8-word buffers
+	AD1CSSL = mask;								//channels to scan
+
+	IFS0CLR = _IFS0_AD1IF_MASK;					//clear the flag
+	IPC5bits.AD1IP = ADC_IPDEFAULT;				//interrupt priority
+	IPC5bits.AD1IS = ADC_ISDEFAULT;				//interrupt sub-priority
+	IEC0SET = _IEC0_AD1IE_MASK;					//enable the isr
+	AD1CON1bits.ON = 1;							//0->adc off, 1->adc on
+
+	//smallest prescaler that fits the period into 16 bits
+	if (rate == 0) rate = 1;
+	period = F_PHB / rate / _adc_scannch;		//tmr3 ticks per conversion at 1:1
+	for (ps=TMR_PS1x; ps<TMR_PS256x; ps++) {
+		if (period <= 0x10000ul) break;
+		period >>= (ps==TMR_PS64x)?2:1;			//next prescaler: 2x, except 64x->256x
+	}
+	if (period > 0x10000ul) period = 0x10000ul;	//slowest possible
+	if (period < 2) period = 2;					//fastest possible
+	tmr3Init(ps, period - 1);					//tmr3 period = PR3 + 1
+}
 
-	AD1CON1bits.SAMP = 0;			// |= (1<<1);			//1->set SAMP to start sampling, 0->stop sampling and start conversion
-	ch = ch & 0x0f;					//0..15 is valid input
-	//pin lay-out may change
-	//below is for pic32mx1xx/2xx/3xx pdip
-	switch (ch) {
-	case ADC_AN0:
-		ANSELA |= (1<<0);
-		break;	//AN0 = RA0
-	case ADC_AN1:
-		ANSELA |= (1<<1);
-		break;	//AN1 = RA1
-	case ADC_AN2:
-		ANSELB |= (1<<0);
-		break;	//AN2 = RB0
-	case ADC_AN3:
-		ANSELB |= (1<<1);
-		break;	//AN3 = RB1
-	case ADC_AN4:
-		ANSELB |= (1<<2);
-		break;	//AN4 = RB2
-	case ADC_AN5:
-		ANSELB |= (1<<3);
-		break;	//AN5 = RB3
-#if defined(_PORTC)
-	case ADC_AN6:
-		ANSELC |= (1<<0);
-		break;	//AN6 = RC0
-	case ADC_AN7:
-		ANSELC |= (1<<1);
-		break;	//AN7 = RC1
-	case ADC_AN8:
-		ANSELC |= (1<<2);
-		break;	//AN8 = RC2
-#endif
-	case ADC_AN9:
-		ANSELB |= (1<<15);
-		break;	//AN9 = RB15
-	case ADC_AN10:
-		ANSELB |= (1<<14);
-		break;	//AN10= RB14
-	case ADC_AN11:
-		ANSELB |= (1<<13);
-		break;	//AN11= RB13
-	case ADC_AN12:
-		ANSELB |= (1<<12);
-		break;	//AN12= RB12
-		//case ADC_AN13:ANSELB |= (1<<0); break;	//AN13= CTMUT
-		//case ADC_AN14:ANSELB |= (1<<0); break;	//AN14= Internal Vref
-		//case ADC_AN15:ANSELB |= (1<<0); break;	//AN15= Open
+//stop scanning, back to adcInit() settings
+void adcScanStop(void) {
+	IEC0CLR = _IEC0_AD1IE_MASK;					//stop the isr
+	T3CONbits.TON = 0;							//stop the trigger
+	adcInit();									//reset the adc
+}
+
+//return the filled half of the double buffer, NULL if none ready
+//the data stays valid until the isr fills the other half - ADC_SCANDEPTH sample periods
+uint16_t *adcScanGet(void) {
+	uint16_t *buf=NULL;
+	uint32_t ie;
+
+	ie = IEC0 & _IEC0_AD1IE_MASK;				//isr on only while a scan runs
+	IEC0CLR = _IEC0_AD1IE_MASK;					//hold off the isr
+	if (_adc_scanrdy) {
+		_adc_scanrdy = 0;
+		buf = _adc_scanbuf[_adc_scanwr ^ 1];	//the half not being filled
 	}
-	AD1CHSbits.CH0SA = ch;			//set Ch0 positive input
-	//start the conversion
-	//for (i=0; i<10000; i++);
-	AD1CON1bits.SAMP = 1;			// |= (1<<1);			//1->set SAMP to start sampling, 0->stop sampling and start conversion
-	//clear the DONE bit -> it is persistent in manual mode
-	//AD1CON1bits.DONE = 0;
-	//wait for the previous conversion to end
-	while (AD1CON1bits.DONE == 0) continue;	//0->conversion on going, 1->conversion done
-	return ADC1BUF0;
+	IEC0SET = ie;								//restore the isr
+	return buf;
 }
+
+//number of filled halves not collected in time
+uint32_t adcScanOverruns(void) {
+	return _adc_scanovf;
+}
+#endif	//ADC_SCANDEPTH
 //end ADC
 
 //output compare
@@ -1833,20 +3496,34 @@ uint16_t analogRead(uint16_t ch) {
 uint16_t _oc1pr=0xffff;							//oc isr period
 void (*_oc1_isrptr)(void)=empty_handler;		//tmr1_ptr pointing to empty_handler by default
 //OC ISR
-void __ISR(_OUTPUT_COMPARE_1_VECTOR/*, _TxIPL*/) _OC1Interrupt(void) {			//for PIC32
+#if defined(OC1_HANDLER)
+#define OC1_DIRECT
+#else
+#define OC1_HANDLER()		_oc1_isrptr()
+#endif
+#if defined(OC1_DIRECT) || !defined(USE_ISR_DIRECT)
+#if defined(OC1_ISRIPL)
+#define OC1_ISR		__ISR(_OUTPUT_COMPARE_1_VECTOR, OC1_ISRIPL)
+#else
+#define OC1_ISR		__ISR(_OUTPUT_COMPARE_1_VECTOR)
+#endif
+void OC1_ISR _OC1Interrupt(void) {			//for PIC32
+	ISR_ENTER(ISR_OC1, ISR_LAT_OC(OC1R));
 	//clear the flag
 	IFS0bits.OC1IF = 0;							//clear the flag
 	//OC1R += _oc1pr;	OC1R &= 0xffff;				//update to the next match point
 	//only care about the 16 bits
-	_oc1_isrptr();								//run user handler
+	OC1_HANDLER();								//run user handler
+	ISR_EXIT(ISR_OC1);
 }
+#endif	//OC1_DIRECT
 
 void oc1Init(uint16_t pr) {
 	_oc1_isrptr=empty_handler;
 	_oc1pr = pr;								//reset the pr
 
 	//power up the pwm module
-	PMD3bits.OC1MD = 0;							//0->turn on the peripheral, 1->turn off the peripheral
+	_pmdInit(PMD_OC1);							//0->turn on the peripheral, 1->turn off the peripheral
 
 	//assign the output pins
 #if defined(PWM12RP)
@@ -1872,33 +3549,65 @@ void oc1Init(uint16_t pr) {
 	OC1CONbits.ON= 1;						//1->turn on oc, 0->turn off oc
 }
 
+//stop the oc, disconnect its pin and power it down
+//an oc taken by analogWrite() keeps running on analogWrite()'s reference
+void oc1Deinit(void) {
+	if (_pwm_ocused & (1<<0)) {_pmdDeinit(PMD_OC1); return;}
+	OC1CONbits.ON = 0;						//1->turn on oc, 0->turn off oc
+	IEC0CLR = _IEC0_OC1IE_MASK;				//no more isrs
+	_oc1_isrptr=empty_handler;
+	_ppsRelease(PPS_G1, 0b0101);			//oc1: group 1, 0b0101
+	_pmdDeinit(PMD_OC1);						//power down the module
+}
+
+#if defined(OC1_DIRECT) || !defined(USE_ISR_DIRECT)
 //activate user isr
-void oc1AttachISR(void (*isrptr)(void)) {
+void oc1AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub) {
+#if defined(OC1_ISRIPL)
+	if (ipl != ISRIPL_PRIO(OC1_ISRIPL)) return;		//the vector is built for another priority: leave it off
+#endif
 	_oc1_isrptr=isrptr;						//activate the isr handler
 	//OC1R = TMR2 + _oc1pr; OC1R &= 0xffff;	//update to the next match point
 	IFS0bits.OC1IF = 0;						//0->clear the flag;
 	IEC0bits.OC1IE = 1;						//0->disable the interrupt, 1->enable the interrupt
+	IPC1bits.OC1IP = ipl;						//interrupt priority
+	IPC1bits.OC1IS = sub;						//interrupt sub-priority
 }
+#endif
 
 //oc2 - 16bit
 uint16_t _oc2pr=0xffff;							//oc isr period
 void (*_oc2_isrptr)(void)=empty_handler;		//tmr1_ptr pointing to empty_handler by default
 //OC ISR
-void __ISR(_OUTPUT_COMPARE_2_VECTOR/*, _TxIPL*/) _OC2Interrupt(void) {			//for PIC32
+#if defined(OC2_HANDLER)
+#define OC2_DIRECT
+#else
+#define OC2_HANDLER()		_oc2_isrptr()
+#endif
+#if defined(OC2_DIRECT) || !defined(USE_ISR_DIRECT)
+#if defined(OC2_ISRIPL)
+#define OC2_ISR		__ISR(_OUTPUT_COMPARE_2_VECTOR, OC2_ISRIPL)
+#else
+#define OC2_ISR		__ISR(_OUTPUT_COMPARE_2_VECTOR)
+#endif
+void OC2_ISR _OC2Interrupt(void) {			//for PIC32
+	ISR_ENTER(ISR_OC2, ISR_LAT_OC(OC2R));
 	//clear the flag
 	IFS0bits.OC2IF = 0;							//clear the flag
 	OC2R += _oc2pr;
 	OC2R &= 0xffff;				//update to the next match point
 	//only care about the 16 bits
-	_oc2_isrptr();								//run user handler
+	OC2_HANDLER();								//run user handler
+	ISR_EXIT(ISR_OC2);
 }
+#endif	//OC2_DIRECT
 
 void oc2Init(uint16_t pr) {
 	_oc2_isrptr=empty_handler;
 	_oc2pr = pr;								//reset the pr
 
 	//power up the pwm module
-	PMD3bits.OC2MD = 0;							//0->turn on the peripheral, 1->turn off the peripheral
+	_pmdInit(PMD_OC2);							//0->turn on the peripheral, 1->turn off the peripheral
 
 	//assign the output pins
 #if defined(PWM22RP)
@@ -1924,35 +3633,67 @@ void oc2Init(uint16_t pr) {
 	OC2CONbits.ON= 1;						//1->turn on oc, 0->turn off oc
 }
 
+//stop the oc, disconnect its pin and power it down
+//an oc taken by analogWrite() keeps running on analogWrite()'s reference
+void oc2Deinit(void) {
+	if (_pwm_ocused & (1<<1)) {_pmdDeinit(PMD_OC2); return;}
+	OC2CONbits.ON = 0;						//1->turn on oc, 0->turn off oc
+	IEC0CLR = _IEC0_OC2IE_MASK;				//no more isrs
+	_oc2_isrptr=empty_handler;
+	_ppsRelease(PPS_G2, 0b0101);			//oc2: group 2, 0b0101
+	_pmdDeinit(PMD_OC2);						//power down the module
+}
+
+#if defined(OC2_DIRECT) || !defined(USE_ISR_DIRECT)
 //activate user isr
-void oc2AttachISR(void (*isrptr)(void)) {
+void oc2AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub) {
+#if defined(OC2_ISRIPL)
+	if (ipl != ISRIPL_PRIO(OC2_ISRIPL)) return;		//the vector is built for another priority: leave it off
+#endif
 	_oc2_isrptr=isrptr;						//activate the isr handler
 	OC2R = TMR2 + _oc2pr;
 	OC2R &= 0xffff;	//update to the next match point
 	IFS0bits.OC2IF = 0;						//0->clear the flag;
 	IEC0bits.OC2IE = 1;						//0->disable the interrupt, 1->enable the interrupt
+	IPC2bits.OC2IP = ipl;						//interrupt priority
+	IPC2bits.OC2IS = sub;						//interrupt sub-priority
 }
+#endif
 
 
 //oc3 - 16bit
 uint16_t _oc3pr=0xffff;							//oc isr period
 void (*_oc3_isrptr)(void)=empty_handler;		//tmr1_ptr pointing to empty_handler by default
 //OC ISR
-void __ISR(_OUTPUT_COMPARE_3_VECTOR/*, _TxIPL*/) _OC3Interrupt(void) {			//for PIC32
+#if defined(OC3_HANDLER)
+#define OC3_DIRECT
+#else
+#define OC3_HANDLER()		_oc3_isrptr()
+#endif
+#if defined(OC3_DIRECT) || !defined(USE_ISR_DIRECT)
+#if defined(OC3_ISRIPL)
+#define OC3_ISR		__ISR(_OUTPUT_COMPARE_3_VECTOR, OC3_ISRIPL)
+#else
+#define OC3_ISR		__ISR(_OUTPUT_COMPARE_3_VECTOR)
+#endif
+void OC3_ISR _OC3Interrupt(void) {			//for PIC32
+	ISR_ENTER(ISR_OC3, ISR_LAT_OC(OC3R));
 	//clear the flag
 	IFS0bits.OC3IF = 0;							//clear the flag
 	OC3R += _oc3pr;
 	OC3R &= 0xffff;				//update to the next match point
 	//only care about the 16 bits
-	_oc3_isrptr();								//run user handler
+	OC3_HANDLER();								//run user handler
+	ISR_EXIT(ISR_OC3);
 }
+#endif	//OC3_DIRECT
 
 void oc3Init(uint16_t pr) {
 	_oc3_isrptr=empty_handler;
 	_oc3pr = pr;								//reset the pr
 
 	//power up the pwm module
-	PMD3bits.OC3MD = 0;							//0->turn on the peripheral, 1->turn off the peripheral
+	_pmdInit(PMD_OC3);							//0->turn on the peripheral, 1->turn off the peripheral
 
 	//assign the output pins
 #if defined(PWM32RP)
@@ -1978,34 +3719,66 @@ void oc3Init(uint16_t pr) {
 	OC3CONbits.ON= 1;						//1->turn on oc, 0->turn off oc
 }
 
+//stop the oc, disconnect its pin and power it down
+//an oc taken by analogWrite() keeps running on analogWrite()'s reference
+void oc3Deinit(void) {
+	if (_pwm_ocused & (1<<2)) {_pmdDeinit(PMD_OC3); return;}
+	OC3CONbits.ON = 0;						//1->turn on oc, 0->turn off oc
+	IEC0CLR = _IEC0_OC3IE_MASK;				//no more isrs
+	_oc3_isrptr=empty_handler;
+	_ppsRelease(PPS_G4, 0b0101);			//oc3: group 4, 0b0101
+	_pmdDeinit(PMD_OC3);						//power down the module
+}
+
+#if defined(OC3_DIRECT) || !defined(USE_ISR_DIRECT)
 //activate user isr
-void oc3AttachISR(void (*isrptr)(void)) {
+void oc3AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub) {
+#if defined(OC3_ISRIPL)
+	if (ipl != ISRIPL_PRIO(OC3_ISRIPL)) return;		//the vector is built for another priority: leave it off
+#endif
 	_oc3_isrptr=isrptr;						//activate the isr handler
 	OC3R = TMR2 + _oc3pr;
 	OC3R &= 0xffff;	//update to the next match point
 	IFS0bits.OC3IF = 0;						//0->clear the flag;
 	IEC0bits.OC3IE = 1;						//0->disable the interrupt, 1->enable the interrupt
+	IPC3bits.OC3IP = ipl;						//interrupt priority
+	IPC3bits.OC3IS = sub;						//interrupt sub-priority
 }
+#endif
 
 //oc4 - 16bit
 uint16_t _oc4pr=0xffff;							//oc isr period
 void (*_oc4_isrptr)(void)=empty_handler;		//tmr1_ptr pointing to empty_handler by default
 //OC ISR
-void __ISR(_OUTPUT_COMPARE_4_VECTOR/*, _TxIPL*/) _OC4Interrupt(void) {			//for PIC32
+#if defined(OC4_HANDLER)
+#define OC4_DIRECT
+#else
+#define OC4_HANDLER()		_oc4_isrptr()
+#endif
+#if defined(OC4_DIRECT) || !defined(USE_ISR_DIRECT)
+#if defined(OC4_ISRIPL)
+#define OC4_ISR		__ISR(_OUTPUT_COMPARE_4_VECTOR, OC4_ISRIPL)
+#else
+#define OC4_ISR		__ISR(_OUTPUT_COMPARE_4_VECTOR)
+#endif
+void OC4_ISR _OC4Interrupt(void) {			//for PIC32
+	ISR_ENTER(ISR_OC4, ISR_LAT_OC(OC4R));
 	//clear the flag
 	IFS0bits.OC4IF = 0;							//clear the flag
 	OC4R += _oc4pr;
 	OC4R &= 0xffff;				//update to the next match point
 	//only care about the 16 bits
-	_oc4_isrptr();								//run user handler
+	OC4_HANDLER();								//run user handler
+	ISR_EXIT(ISR_OC4);
 }
+#endif	//OC4_DIRECT
 
 void oc4Init(uint16_t pr) {
 	_oc4_isrptr=empty_handler;
 	_oc4pr = pr;								//reset the pr
 
 	//power up the pwm module
-	PMD3bits.OC4MD = 0;							//0->turn on the peripheral, 1->turn off the peripheral
+	_pmdInit(PMD_OC4);							//0->turn on the peripheral, 1->turn off the peripheral
 
 	//assign the output pins
 #if defined(PWM42RP)
@@ -2031,34 +3804,66 @@ void oc4Init(uint16_t pr) {
 	OC4CONbits.ON= 1;						//1->turn on oc, 0->turn off oc
 }
 
+//stop the oc, disconnect its pin and power it down
+//an oc taken by analogWrite() keeps running on analogWrite()'s reference
+void oc4Deinit(void) {
+	if (_pwm_ocused & (1<<3)) {_pmdDeinit(PMD_OC4); return;}
+	OC4CONbits.ON = 0;						//1->turn on oc, 0->turn off oc
+	IEC0CLR = _IEC0_OC4IE_MASK;				//no more isrs
+	_oc4_isrptr=empty_handler;
+	_ppsRelease(PPS_G3, 0b0101);			//oc4: group 3, 0b0101
+	_pmdDeinit(PMD_OC4);						//power down the module
+}
+
+#if defined(OC4_DIRECT) || !defined(USE_ISR_DIRECT)
 //activate user isr
-void oc4AttachISR(void (*isrptr)(void)) {
+void oc4AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub) {
+#if defined(OC4_ISRIPL)
+	if (ipl != ISRIPL_PRIO(OC4_ISRIPL)) return;		//the vector is built for another priority: leave it off
+#endif
 	_oc4_isrptr=isrptr;						//activate the isr handler
 	OC4R = TMR2 + _oc4pr;
 	OC4R &= 0xffff;	//update to the next match point
 	IFS0bits.OC4IF = 0;						//0->clear the flag;
 	IEC0bits.OC4IE = 1;						//0->disable the interrupt, 1->enable the interrupt
+	IPC4bits.OC4IP = ipl;						//interrupt priority
+	IPC4bits.OC4IS = sub;						//interrupt sub-priority
 }
+#endif
 
 //oc5 - 16bit
 uint16_t _oc5pr=0xffff;							//oc isr period
 void (*_oc5_isrptr)(void)=empty_handler;		//tmr1_ptr pointing to empty_handler by default
 //OC ISR
-void __ISR(_OUTPUT_COMPARE_5_VECTOR/*, _TxIPL*/) _OC5Interrupt(void) {			//for PIC32
+#if defined(OC5_HANDLER)
+#define OC5_DIRECT
+#else
+#define OC5_HANDLER()		_oc5_isrptr()
+#endif
+#if defined(OC5_DIRECT) || !defined(USE_ISR_DIRECT)
+#if defined(OC5_ISRIPL)
+#define OC5_ISR		__ISR(_OUTPUT_COMPARE_5_VECTOR, OC5_ISRIPL)
+#else
+#define OC5_ISR		__ISR(_OUTPUT_COMPARE_5_VECTOR)
+#endif
+void OC5_ISR _OC5Interrupt(void) {			//for PIC32
+	ISR_ENTER(ISR_OC5, ISR_LAT_OC(OC5R));
 	//clear the flag
 	IFS0bits.OC5IF = 0;							//clear the flag
 	OC5R += _oc5pr;
 	OC5R &= 0xffff;				//update to the next match point
 	//only care about the 16 bits
-	_oc5_isrptr();								//run user handler
+	OC5_HANDLER();								//run user handler
+	ISR_EXIT(ISR_OC5);
 }
+#endif	//OC5_DIRECT
 
 void oc5Init(uint16_t pr) {
 	_oc5_isrptr=empty_handler;
 	_oc5pr = pr;								//reset the pr
 
 	//power up the pwm module
-	PMD3bits.OC5MD = 0;							//0->turn on the peripheral, 1->turn off the peripheral
+	_pmdInit(PMD_OC5);							//0->turn on the peripheral, 1->turn off the peripheral
 
 	//assign the output pins
 #if defined(PWM52RP)
@@ -2084,14 +3889,32 @@ void oc5Init(uint16_t pr) {
 	OC5CONbits.ON= 1;						//1->turn on oc, 0->turn off oc
 }
 
+//stop the oc, disconnect its pin and power it down
+//an oc taken by analogWrite() keeps running on analogWrite()'s reference
+void oc5Deinit(void) {
+	if (_pwm_ocused & (1<<4)) {_pmdDeinit(PMD_OC5); return;}
+	OC5CONbits.ON = 0;						//1->turn on oc, 0->turn off oc
+	IEC0CLR = _IEC0_OC5IE_MASK;				//no more isrs
+	_oc5_isrptr=empty_handler;
+	_ppsRelease(PPS_G3, 0b0110);			//oc5: group 3, 0b0110
+	_pmdDeinit(PMD_OC5);						//power down the module
+}
+
+#if defined(OC5_DIRECT) || !defined(USE_ISR_DIRECT)
 //activate user isr
-void oc5AttachISR(void (*isrptr)(void)) {
+void oc5AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub) {
+#if defined(OC5_ISRIPL)
+	if (ipl != ISRIPL_PRIO(OC5_ISRIPL)) return;		//the vector is built for another priority: leave it off
+#endif
 	_oc5_isrptr=isrptr;						//activate the isr handler
 	OC5R = TMR2 + _oc5pr;
 	OC5R &= 0xffff;	//update to the next match point
 	IFS0bits.OC5IF = 0;						//0->clear the flag;
 	IEC0bits.OC5IE = 1;						//0->disable the interrupt, 1->enable the interrupt
+	IPC5bits.OC5IP = ipl;						//interrupt priority
+	IPC5bits.OC5IS = sub;						//interrupt sub-priority
 }
+#endif
 
 //end output compare
 
@@ -2100,11 +3923,23 @@ static void (*_ic1_isrptr)(void)=empty_handler;				//function pointer pointing t
 //volatile uint16_t IC1DAT=0;				//buffer
 
 //input capture ISR
-void __ISR(_INPUT_CAPTURE_1_VECTOR/*, _TxIPL*/) _IC1Interrupt(void) {			//for PIC32
+#if defined(IC1_HANDLER)
+#define IC1_DIRECT								//the vector runs IC1_HANDLER(), not _ic1_isrptr
+#else
+#define IC1_HANDLER()		_ic1_isrptr()
+#endif
+#if defined(IC1_ISRIPL)
+#define IC1_ISR		__ISR(_INPUT_CAPTURE_1_VECTOR, IC1_ISRIPL)
+#else
+#define IC1_ISR		__ISR(_INPUT_CAPTURE_1_VECTOR)
+#endif
+void IC1_ISR _IC1Interrupt(void) {			//for PIC32
+	ISR_ENTER(ISR_IC1, 0);
 	//clear the flag
 	//IC1DAT = IC1BUF;					//read the captured value
 	IFS0bits.IC1IF = 0;					//clear the flag after the buffer has been read (the interrupt flag is persistent)
-	_ic1_isrptr();						//run user handler
+	IC1_HANDLER();						//run user handler
+	ISR_EXIT(ISR_IC1);
 }
 
 //reset input capture 1
@@ -2114,7 +3949,7 @@ void ic1Init(void) {
 	_ic1_isrptr = empty_handler;		//reset user handler
 
 	IC12RP();							//assign pin to IC
-	PMD3bits.IC1MD = 0;					//0->enable power to input capture
+	_pmdInit(PMD_IC1);					//0->enable power to input capture
 	IC1CON = 0;
 	IC1CON  = 	(0<<15) |				//1->enable the module, 0->disable the module
 				(0<<13) |				//0->operates in idle, 1->don't operate in idle
@@ -2139,14 +3974,25 @@ void ic1Init(void) {
 	//input capture running now
 }
 
+//stop the input capture and power it down
+void ic1Deinit(void) {
+	IC1CONbits.ON = 0;					//1->enable the module, 0->disable the module
+	IEC0CLR = _IEC0_IC1IE_MASK;			//no more isrs
+	_ic1_isrptr = empty_handler;		//reset user handler
+	_pmdDeinit(PMD_IC1);				//power down the module
+}
+
 //activate user ptr
-void ic1AttachISR(void (*isrptr)(void)) {
+void ic1AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub) {
+#if defined(IC1_ISRIPL)
+	if (ipl != ISRIPL_PRIO(IC1_ISRIPL)) return;		//the vector is built for another priority: leave it off
+#endif
 	_ic1_isrptr = isrptr;				//install user ptr
 	//IC1BUF;								//read the buffer to clear the flag
 	IFS0bits.IC1IF   = 0;				//0->clear the flag
 	IEC0bits.IC1IE   = 1;				//1->enable the interrupt, 0->disable the interrupt
-	IPC1bits.IC1IP = IC_IPDEFAULT;		//interrupt priority.
-	IPC1bits.IC1IS = IC_ISDEFAULT;		//interrupt sur-priority
+	IPC1bits.IC1IP = ipl;		//interrupt priority.
+	IPC1bits.IC1IS = sub;		//interrupt sur-priority
 }
 
 //read buffer value
@@ -2158,11 +4004,23 @@ static void (*_ic2_isrptr)(void)=empty_handler;				//function pointer pointing t
 //volatile uint16_t IC2DAT=0;				//buffer
 
 //input capture ISR
-void __ISR(_INPUT_CAPTURE_2_VECTOR/*, _TxIPL*/) _IC2Interrupt(void) {			//for PIC32
+#if defined(IC2_HANDLER)
+#define IC2_DIRECT								//the vector runs IC2_HANDLER(), not _ic2_isrptr
+#else
+#define IC2_HANDLER()		_ic2_isrptr()
+#endif
+#if defined(IC2_ISRIPL)
+#define IC2_ISR		__ISR(_INPUT_CAPTURE_2_VECTOR, IC2_ISRIPL)
+#else
+#define IC2_ISR		__ISR(_INPUT_CAPTURE_2_VECTOR)
+#endif
+void IC2_ISR _IC2Interrupt(void) {			//for PIC32
+	ISR_ENTER(ISR_IC2, 0);
 	//clear the flag
 	//IC2DAT = IC2BUF;					//read the captured value
 	IFS0bits.IC2IF = 0;					//clear the flag after the buffer has been read (the interrupt flag is persistent)
-	_ic2_isrptr();						//run user handler
+	IC2_HANDLER();						//run user handler
+	ISR_EXIT(ISR_IC2);
 }
 
 //reset input capture 1
@@ -2172,7 +4030,7 @@ void ic2Init(void) {
 	_ic2_isrptr = empty_handler;		//reset user handler
 
 	IC22RP();							//assign pin to IC
-	PMD3bits.IC2MD = 0;					//0->enable power to input capture
+	_pmdInit(PMD_IC2);					//0->enable power to input capture
 	IC2CON = 0;
 	IC2CON  = 	(0<<15) |				//1->enable the module, 0->disable the module
 				(0<<13) |				//0->operates in idle, 1->don't operate in idle
@@ -2197,14 +4055,25 @@ void ic2Init(void) {
 	//input capture running now
 }
 
+//stop the input capture and power it down
+void ic2Deinit(void) {
+	IC2CONbits.ON = 0;					//1->enable the module, 0->disable the module
+	IEC0CLR = _IEC0_IC2IE_MASK;			//no more isrs
+	_ic2_isrptr = empty_handler;		//reset user handler
+	_pmdDeinit(PMD_IC2);				//power down the module
+}
+
 //activate user ptr
-void ic2AttachISR(void (*isrptr)(void)) {
+void ic2AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub) {
+#if defined(IC2_ISRIPL)
+	if (ipl != ISRIPL_PRIO(IC2_ISRIPL)) return;		//the vector is built for another priority: leave it off
+#endif
 	_ic2_isrptr = isrptr;				//install user ptr
 	//IC2BUF;								//read the buffer to clear the flag
 	IFS0bits.IC2IF   = 0;				//0->clear the flag
 	IEC0bits.IC2IE   = 1;				//1->enable the interrupt, 0->disable the interrupt
-	IPC2bits.IC2IP = IC_IPDEFAULT;		//interrupt priority.
-	IPC2bits.IC2IS = IC_ISDEFAULT;		//interrupt sur-priority
+	IPC2bits.IC2IP = ipl;		//interrupt priority.
+	IPC2bits.IC2IS = sub;		//interrupt sur-priority
 }
 
 //read buffer value
@@ -2216,11 +4085,23 @@ static void (*_ic3_isrptr)(void)=empty_handler;				//function pointer pointing t
 //volatile uint16_t IC3DAT=0;				//buffer
 
 //input capture ISR
-void __ISR(_INPUT_CAPTURE_3_VECTOR/*, IPL7*/) _IC3Interrupt(void) {			//for PIC32
+#if defined(IC3_HANDLER)
+#define IC3_DIRECT								//the vector runs IC3_HANDLER(), not _ic3_isrptr
+#else
+#define IC3_HANDLER()		_ic3_isrptr()
+#endif
+#if defined(IC3_ISRIPL)
+#define IC3_ISR		__ISR(_INPUT_CAPTURE_3_VECTOR, IC3_ISRIPL)
+#else
+#define IC3_ISR		__ISR(_INPUT_CAPTURE_3_VECTOR)
+#endif
+void IC3_ISR _IC3Interrupt(void) {			//for PIC32
+	ISR_ENTER(ISR_IC3, 0);
 	//clear the flag
 	//IC3DAT = IC3BUF;					//read the captured value
 	IFS0bits.IC3IF = 0;					//clear the flag after the buffer has been read (the interrupt flag is persistent)
-	_ic3_isrptr();						//run user handler
+	IC3_HANDLER();						//run user handler
+	ISR_EXIT(ISR_IC3);
 }
 
 //reset input capture 1
@@ -2230,7 +4111,7 @@ void ic3Init(void) {
 	_ic3_isrptr = empty_handler;		//reset user handler
 
 	IC32RP();							//assign pin to IC
-	PMD3bits.IC3MD = 0;					//0->enable power to input capture
+	_pmdInit(PMD_IC3);					//0->enable power to input capture
 	IC3CON = 0;							//reset ic3con
 	IC3CON  = 	(0<<15) |				//1->enable the module, 0->disable the module
 				(0<<13) |				//0->operates in idle, 1->don't operate in idle
@@ -2254,14 +4135,25 @@ void ic3Init(void) {
 	//input capture running now
 }
 
+//stop the input capture and power it down
+void ic3Deinit(void) {
+	IC3CONbits.ON = 0;					//1->enable the module, 0->disable the module
+	IEC0CLR = _IEC0_IC3IE_MASK;			//no more isrs
+	_ic3_isrptr = empty_handler;		//reset user handler
+	_pmdDeinit(PMD_IC3);				//power down the module
+}
+
 //activate user ptr
-void ic3AttachISR(void (*isrptr)(void)) {
+void ic3AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub) {
+#if defined(IC3_ISRIPL)
+	if (ipl != ISRIPL_PRIO(IC3_ISRIPL)) return;		//the vector is built for another priority: leave it off
+#endif
 	_ic3_isrptr = isrptr;				//install user ptr
 	//IC3BUF;								//read the buffer to clear the flag
 	IFS0bits.IC3IF   = 0;				//0->clear the flag
 	IEC0bits.IC3IE   = 1;				//1->enable the interrupt, 0->disable the interrupt
-	IPC3bits.IC3IP = IC_IPDEFAULT;		//interrupt priority.
-	IPC3bits.IC3IS = IC_ISDEFAULT;		//interrupt sur-priority
+	IPC3bits.IC3IP = ipl;		//interrupt priority.
+	IPC3bits.IC3IS = sub;		//interrupt sur-priority
 }
 
 //read buffer value
@@ -2273,11 +4165,23 @@ static void (*_ic4_isrptr)(void)=empty_handler;				//function pointer pointing t
 //volatile uint16_t IC4DAT=0;				//buffer
 
 //input capture ISR
-void __ISR(_INPUT_CAPTURE_4_VECTOR/*, _TxIPL*/) _IC4Interrupt(void) {			//for PIC32
+#if defined(IC4_HANDLER)
+#define IC4_DIRECT								//the vector runs IC4_HANDLER(), not _ic4_isrptr
+#else
+#define IC4_HANDLER()		_ic4_isrptr()
+#endif
+#if defined(IC4_ISRIPL)
+#define IC4_ISR		__ISR(_INPUT_CAPTURE_4_VECTOR, IC4_ISRIPL)
+#else
+#define IC4_ISR		__ISR(_INPUT_CAPTURE_4_VECTOR)
+#endif
+void IC4_ISR _IC4Interrupt(void) {			//for PIC32
+	ISR_ENTER(ISR_IC4, 0);
 	//clear the flag
 	//IC4DAT = IC4BUF;					//read the captured value
 	IFS0bits.IC4IF = 0;					//clear the flag after the buffer has been read (the interrupt flag is persistent)
-	_ic4_isrptr();						//run user handler
+	IC4_HANDLER();						//run user handler
+	ISR_EXIT(ISR_IC4);
 }
 
 //reset input capture 1
@@ -2287,7 +4191,7 @@ void ic4Init(void) {
 	_ic4_isrptr = empty_handler;		//reset user handler
 
 	IC42RP();							//assign pin to IC
-	PMD3bits.IC4MD = 0;					//0->enable power to input capture
+	_pmdInit(PMD_IC4);					//0->enable power to input capture
 	IC4CON = 0;							//reset ic4con
 	IC4CON  = 	(0<<15) |				//1->enable the module, 0->disable the module
 				(0<<13) |				//0->operates in idle, 1->don't operate in idle
@@ -2311,14 +4215,25 @@ void ic4Init(void) {
 	//input capture running now
 }
 
+//stop the input capture and power it down
+void ic4Deinit(void) {
+	IC4CONbits.ON = 0;					//1->enable the module, 0->disable the module
+	IEC0CLR = _IEC0_IC4IE_MASK;			//no more isrs
+	_ic4_isrptr = empty_handler;		//reset user handler
+	_pmdDeinit(PMD_IC4);				//power down the module
+}
+
 //activate user ptr
-void ic4AttachISR(void (*isrptr)(void)) {
+void ic4AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub) {
+#if defined(IC4_ISRIPL)
+	if (ipl != ISRIPL_PRIO(IC4_ISRIPL)) return;		//the vector is built for another priority: leave it off
+#endif
 	_ic4_isrptr = isrptr;				//install user ptr
 	//IC4BUF;								//read the buffer to clear the flag
 	IFS0bits.IC4IF   = 0;				//0->clear the flag
 	IEC0bits.IC4IE   = 1;				//1->enable the interrupt, 0->disable the interrupt
-	IPC4bits.IC4IP = IC_IPDEFAULT;		//interrupt priority.
-	IPC4bits.IC4IS = IC_ISDEFAULT;		//interrupt sur-priority
+	IPC4bits.IC4IP = ipl;		//interrupt priority.
+	IPC4bits.IC4IS = sub;		//interrupt sur-priority
 }
 
 //read buffer value
@@ -2330,11 +4245,23 @@ static void (*_ic5_isrptr)(void)=empty_handler;				//function pointer pointing t
 //volatile uint16_t IC5DAT=0;				//buffer
 
 //input capture ISR
-void __ISR(_INPUT_CAPTURE_5_VECTOR/*, _TxIPL*/) _IC5Interrupt(void) {			//for PIC32
+#if defined(IC5_HANDLER)
+#define IC5_DIRECT								//the vector runs IC5_HANDLER(), not _ic5_isrptr
+#else
+#define IC5_HANDLER()		_ic5_isrptr()
+#endif
+#if defined(IC5_ISRIPL)
+#define IC5_ISR		__ISR(_INPUT_CAPTURE_5_VECTOR, IC5_ISRIPL)
+#else
+#define IC5_ISR		__ISR(_INPUT_CAPTURE_5_VECTOR)
+#endif
+void IC5_ISR _IC5Interrupt(void) {			//for PIC32
+	ISR_ENTER(ISR_IC5, 0);
 	//clear the flag
 	//IC5DAT = IC5BUF;					//read the captured value
 	IFS0bits.IC5IF = 0;					//clear the flag after the buffer has been read (the interrupt flag is persistent)
-	_ic5_isrptr();						//run user handler
+	IC5_HANDLER();						//run user handler
+	ISR_EXIT(ISR_IC5);
 }
 
 //reset input capture 1
@@ -2344,7 +4271,7 @@ void ic5Init(void) {
 	_ic5_isrptr = empty_handler;		//reset user handler
 
 	IC52RP();							//assign pin to IC
-	PMD3bits.IC5MD = 0;					//0->enable power to input capture
+	_pmdInit(PMD_IC5);					//0->enable power to input capture
 	IC5CON = 0;
 	IC5CON  = 	(0<<15) |				//1->enable the module, 0->disable the module
 				(0<<13) |				//0->operates in idle, 1->don't operate in idle
@@ -2368,30 +4295,243 @@ void ic5Init(void) {
 	//input capture running now
 }
 
+//stop the input capture and power it down
+void ic5Deinit(void) {
+	IC5CONbits.ON = 0;					//1->enable the module, 0->disable the module
+	IEC0CLR = _IEC0_IC5IE_MASK;			//no more isrs
+	_ic5_isrptr = empty_handler;		//reset user handler
+	_pmdDeinit(PMD_IC5);				//power down the module
+}
+
 //activate user ptr
-void ic5AttachISR(void (*isrptr)(void)) {
+void ic5AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub) {
+#if defined(IC5_ISRIPL)
+	if (ipl != ISRIPL_PRIO(IC5_ISRIPL)) return;		//the vector is built for another priority: leave it off
+#endif
 	_ic5_isrptr = isrptr;				//install user ptr
 	//IC5BUF;								//read the buffer to clear the flag
 	IFS0bits.IC5IF   = 0;				//0->clear the flag
 	IEC0bits.IC5IE   = 1;				//1->enable the interrupt, 0->disable the interrupt
-	IPC5bits.IC5IP = IC_IPDEFAULT;		//interrupt priority.
-	IPC5bits.IC5IS = IC_ISDEFAULT;		//interrupt sur-priority
+	IPC5bits.IC5IP = ipl;		//interrupt priority.
+	IPC5bits.IC5IS = sub;		//interrupt sur-priority
 }
 
 //read buffer value
 //uint16_t ic5Get(void) {
 //	return IC5DAT;
 //}
+//pulse measurement on input capture
+//both edges are captured in hardware against tmr2; the isr extends each capture to 32 bits with systick_count
+typedef struct {
+	volatile uint8_t edges;				//edges captured so far: 0, 1 or 2
+	volatile uint32_t t0;				//leading edge
+	volatile uint32_t width;			//pulse width, valid when edges == 2
+} IC_PulseTypeDef;
+static IC_PulseTypeDef _ic_pulse[5];
+static const uint32_t _ic_iemask[5] = {_IEC0_IC1IE_MASK, _IEC0_IC2IE_MASK, _IEC0_IC3IE_MASK, _IEC0_IC4IE_MASK, _IEC0_IC5IE_MASK};
+
+//extend a 16-bit tmr2 capture to 32 bits
+//valid if the capture is less than one tmr2 period (PR2=0xffff) old
+static uint32_t _icExtend(uint16_t cap) {
+	uint32_t m;
+	uint16_t t;
+
+	do {
+		m=systick_count;
+		t=TMR2;
+	} while (m ^ systick_count);
+	if (IFS0bits.T2IF && (t < 0x8000)) m += 1ul<<16;	//rollover not yet counted by the tmr2 isr
+	if (cap > t) m -= 1ul<<16;							//captured before the last rollover
+	return m | cap;
+}
+
+//process one captured edge
+static void _icPulseEdge(IC_PulseTypeDef *p, uint16_t cap) {
+	uint32_t t = _icExtend(cap);
+
+	if (p->edges == 0) {p->t0 = t; p->edges = 1;}				//leading edge
+	else if (p->edges == 1) {p->width = t - p->t0; p->edges = 2;}	//trailing edge
+}
+
+//per module isr handlers
+#if !defined(IC1_DIRECT)
+static void _ic1Pulse(void) {
+	while (IC1CONbits.ICBNE) _icPulseEdge(&_ic_pulse[0], IC1BUF);
+	if (_ic_pulse[0].edges >= 2) IEC0CLR = _IEC0_IC1IE_MASK;	//done - ignore further edges
+}
+#endif
+#if !defined(IC2_DIRECT)
+static void _ic2Pulse(void) {
+	while (IC2CONbits.ICBNE) _icPulseEdge(&_ic_pulse[1], IC2BUF);
+	if (_ic_pulse[1].edges >= 2) IEC0CLR = _IEC0_IC2IE_MASK;	//done - ignore further edges
+}
+#endif
+#if !defined(IC3_DIRECT)
+static void _ic3Pulse(void) {
+	while (IC3CONbits.ICBNE) _icPulseEdge(&_ic_pulse[2], IC3BUF);
+	if (_ic_pulse[2].edges >= 2) IEC0CLR = _IEC0_IC3IE_MASK;	//done - ignore further edges
+}
+#endif
+#if !defined(IC4_DIRECT)
+static void _ic4Pulse(void) {
+	while (IC4CONbits.ICBNE) _icPulseEdge(&_ic_pulse[3], IC4BUF);
+	if (_ic_pulse[3].edges >= 2) IEC0CLR = _IEC0_IC4IE_MASK;	//done - ignore further edges
+}
+#endif
+#if !defined(IC5_DIRECT)
+static void _ic5Pulse(void) {
+	while (IC5CONbits.ICBNE) _icPulseEdge(&_ic_pulse[4], IC5BUF);
+	if (_ic_pulse[4].edges >= 2) IEC0CLR = _IEC0_IC5IE_MASK;	//done - ignore further edges
+}
+#endif
+
+//input capture module on pin, 0xff if none
+static uint8_t _icModule(PIN_TypeDef pin) {
+#if defined(IC1PIN)
+	if (pin == IC1PIN) return 0;
+#endif
+#if defined(IC2PIN)
+	if (pin == IC2PIN) return 1;
+#endif
+#if defined(IC3PIN)
+	if (pin == IC3PIN) return 2;
+#endif
+#if defined(IC4PIN)
+	if (pin == IC4PIN) return 3;
+#endif
+#if defined(IC5PIN)
+	if (pin == IC5PIN) return 4;
+#endif
+	return 0xff;
+}
+
+//arm input capture on pin for one pulse of state
+//returns 0 if pin is not an ICxPIN, or if its vector is bound to ICx_HANDLER()
+uint8_t pulseMeasureStart(PIN_TypeDef pin, uint8_t state) {
+	uint8_t n = _icModule(pin);
+
+	if (n == 0xff) return 0;
+	GPIO_PinDef[pin].gpio->ANSELCLR = GPIO_PinDef[pin].mask;	//digital input
+	FIO_IN(GPIO_PinDef[pin].gpio, GPIO_PinDef[pin].mask);
+	_ic_pulse[n].edges = 0;
+	_ic_pulse[n].width = 0;
+	switch (n) {
+	case 0:
+#if defined(IC1_DIRECT)
+		return 0;							//the ic1 vector runs IC1_HANDLER(): the pulse handler would never run
+#else
+		ic1Init();
+		IC1CONbits.ON = 0;					//reconfigure with the module off
+		IC1CONbits.FEDGE = (state == HIGH);	//1->capture rising edge first, 0->falling edge first
+		IC1CONbits.ICM = 6;					//6->every edge, starting with FEDGE
+		IC1CONbits.ON = 1;
+		ic1AttachISR(_ic1Pulse);
+		break;
+#endif
+	case 1:
+#if defined(IC2_DIRECT)
+		return 0;							//the ic2 vector runs IC2_HANDLER(): the pulse handler would never run
+#else
+		ic2Init();
+		IC2CONbits.ON = 0;					//reconfigure with the module off
+		IC2CONbits.FEDGE = (state == HIGH);	//1->capture rising edge first, 0->falling edge first
+		IC2CONbits.ICM = 6;					//6->every edge, starting with FEDGE
+		IC2CONbits.ON = 1;
+		ic2AttachISR(_ic2Pulse);
+		break;
+#endif
+	case 2:
+#if defined(IC3_DIRECT)
+		return 0;							//the ic3 vector runs IC3_HANDLER(): the pulse handler would never run
+#else
+		ic3Init();
+		IC3CONbits.ON = 0;					//reconfigure with the module off
+		IC3CONbits.FEDGE = (state == HIGH);	//1->capture rising edge first, 0->falling edge first
+		IC3CONbits.ICM = 6;					//6->every edge, starting with FEDGE
+		IC3CONbits.ON = 1;
+		ic3AttachISR(_ic3Pulse);
+		break;
+#endif
+	case 3:
+#if defined(IC4_DIRECT)
+		return 0;							//the ic4 vector runs IC4_HANDLER(): the pulse handler would never run
+#else
+		ic4Init();
+		IC4CONbits.ON = 0;					//reconfigure with the module off
+		IC4CONbits.FEDGE = (state == HIGH);	//1->capture rising edge first, 0->falling edge first
+		IC4CONbits.ICM = 6;					//6->every edge, starting with FEDGE
+		IC4CONbits.ON = 1;
+		ic4AttachISR(_ic4Pulse);
+		break;
+#endif
+	case 4:
+#if defined(IC5_DIRECT)
+		return 0;							//the ic5 vector runs IC5_HANDLER(): the pulse handler would never run
+#else
+		ic5Init();
+		IC5CONbits.ON = 0;					//reconfigure with the module off
+		IC5CONbits.FEDGE = (state == HIGH);	//1->capture rising edge first, 0->falling edge first
+		IC5CONbits.ICM = 6;					//6->every edge, starting with FEDGE
+		IC5CONbits.ON = 1;
+		ic5AttachISR(_ic5Pulse);
+		break;
+#endif
+	}
+	return 1;
+}
+
+//pulse width in tmr2 ticks, 0 if not yet complete
+uint32_t pulseMeasureResult(PIN_TypeDef pin) {
+	uint8_t n = _icModule(pin);
+
+	if ((n == 0xff) || (_ic_pulse[n].edges < 2)) return 0;
+	return _ic_pulse[n].width;
+}
+
+//wait for a pulse of state on pin and return its width in us, 0 on timeout
+uint32_t pulseIn(PIN_TypeDef pin, uint8_t state) {
+	uint32_t t0, tmp, timeout = us2ticks(PULSE_TIMEOUT);
+	uint8_t n;
+
+	t0 = coreticks();
+	if (pulseMeasureStart(pin, state)) {
+		n = _icModule(pin);
+		while ((tmp = pulseMeasureResult(pin)) == 0)
+			if (coreticks() - t0 > timeout) {IEC0CLR = _ic_iemask[n]; return 0;}
+		return (uint64_t) tmp * 1000000ul / F_PHB;	//tmr2 ticks -> us, exact at any F_PHB
+	}
+	//no input capture on this pin: poll
+	state = state ? HIGH : LOW;
+	while (digitalRead(pin) == state) if (coreticks() - t0 > timeout) return 0;	//wait for the previous pulse to end
+	while (digitalRead(pin) != state) if (coreticks() - t0 > timeout) return 0;	//wait for the pulse to start
+	tmp = coreticks();
+	while (digitalRead(pin) == state) if (coreticks() - t0 > timeout) return 0;	//wait for the pulse to end
+	return ticks2us(coreticks() - tmp);
+}
 //end input capture
 
 //extint
 //extint0
 void (* _int0_isrptr) (void)=empty_handler;
 
-void __ISR(_EXTERNAL_0_VECTOR) _INT0Interrupt(void) {
+#if defined(INT0_HANDLER)
+#define INT0_DIRECT
+#else
+#define INT0_HANDLER()		_int0_isrptr()
+#endif
+#if defined(INT0_DIRECT) || !defined(USE_ISR_DIRECT)
+#if defined(INT0_ISRIPL)
+#define INT0_ISR		__ISR(_EXTERNAL_0_VECTOR, INT0_ISRIPL)
+#else
+#define INT0_ISR		__ISR(_EXTERNAL_0_VECTOR)
+#endif
+void INT0_ISR _INT0Interrupt(void) {
+	ISR_ENTER(ISR_INT0, 0);
 	IFS0bits.INT0IF = 0;				//clera the flag
-	_int0_isrptr();						//run the isr
+	INT0_HANDLER();						//run the isr
+	ISR_EXIT(ISR_INT0);
 }
+#endif	//INT0_DIRECT
 
 void int0Init(void) {
 	//INT02RP();						//map int0_pin - int0 cannot be remapped
@@ -2403,21 +4543,40 @@ void int0Init(void) {
 	INTCONbits.INT0EP = 0;				//1=triggered on the falling edge. 0 = rising edge
 }
 
-void int0AttachISR(void (*isrptr) (void)) {
+#if defined(INT0_DIRECT) || !defined(USE_ISR_DIRECT)
+void int0AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub) {
+#if defined(INT0_ISRIPL)
+	if (ipl != ISRIPL_PRIO(INT0_ISRIPL)) return;		//the vector is built for another priority: leave it off
+#endif
 	_int0_isrptr = isrptr;
 	IFS0bits.INT0IF = 0;				//clear int0 flag
 	IEC0bits.INT0IE = 1;				//1->enable int0 interrupt, 0->disable the interrupt
-	IPC0bits.INT0IP = INT_IPDEFAULT;	//interrupt priority.
-	IPC0bits.INT0IS = INT_ISDEFAULT;	//interrupt sur-priority
+	IPC0bits.INT0IP = ipl;	//interrupt priority.
+	IPC0bits.INT0IS = sub;	//interrupt sur-priority
 }
+#endif
 
 //extint1
 void (* _int1_isrptr) (void)=empty_handler;
 
-void __ISR(_EXTERNAL_1_VECTOR) _INT1Interrupt(void) {
+#if defined(INT1_HANDLER)
+#define INT1_DIRECT
+#else
+#define INT1_HANDLER()		_int1_isrptr()
+#endif
+#if defined(INT1_DIRECT) || !defined(USE_ISR_DIRECT)
+#if defined(INT1_ISRIPL)
+#define INT1_ISR		__ISR(_EXTERNAL_1_VECTOR, INT1_ISRIPL)
+#else
+#define INT1_ISR		__ISR(_EXTERNAL_1_VECTOR)
+#endif
+void INT1_ISR _INT1Interrupt(void) {
+	ISR_ENTER(ISR_INT1, 0);
 	IFS0bits.INT1IF = 0;				//clera the flag
-	_int1_isrptr();						//run the isr
+	INT1_HANDLER();						//run the isr
+	ISR_EXIT(ISR_INT1);
 }
+#endif	//INT1_DIRECT
 
 void int1Init(void) {
 	INT12RP();							//map int1_pin
@@ -2429,21 +4588,40 @@ void int1Init(void) {
 	INTCONbits.INT1EP = 0;				//1=triggered on the falling edge. 0 = rising edge
 }
 
-void int1AttachISR(void (*isrptr) (void)) {
+#if defined(INT1_DIRECT) || !defined(USE_ISR_DIRECT)
+void int1AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub) {
+#if defined(INT1_ISRIPL)
+	if (ipl != ISRIPL_PRIO(INT1_ISRIPL)) return;		//the vector is built for another priority: leave it off
+#endif
 	_int1_isrptr = isrptr;
 	IFS0bits.INT1IF = 0;				//clear int0 flag
 	IEC0bits.INT1IE = 1;				//1->enable int0 interrupt, 0->disable the interrupt
-	IPC1bits.INT1IP = INT_IPDEFAULT;	//interrupt priority.
-	IPC1bits.INT1IS = INT_ISDEFAULT;	//interrupt sur-priority
+	IPC1bits.INT1IP = ipl;	//interrupt priority.
+	IPC1bits.INT1IS = sub;	//interrupt sur-priority
 }
+#endif
 
 //extint2
 void (* _int2_isrptr) (void)=empty_handler;
 
-void __ISR(_EXTERNAL_2_VECTOR) _INT2Interrupt(void) {
+#if defined(INT2_HANDLER)
+#define INT2_DIRECT
+#else
+#define INT2_HANDLER()		_int2_isrptr()
+#endif
+#if defined(INT2_DIRECT) || !defined(USE_ISR_DIRECT)
+#if defined(INT2_ISRIPL)
+#define INT2_ISR		__ISR(_EXTERNAL_2_VECTOR, INT2_ISRIPL)
+#else
+#define INT2_ISR		__ISR(_EXTERNAL_2_VECTOR)
+#endif
+void INT2_ISR _INT2Interrupt(void) {
+	ISR_ENTER(ISR_INT2, 0);
 	IFS0bits.INT2IF = 0;				//clera the flag
-	_int2_isrptr();						//run the isr
+	INT2_HANDLER();						//run the isr
+	ISR_EXIT(ISR_INT2);
 }
+#endif	//INT2_DIRECT
 
 void int2Init(void) {
 	INT22RP();							//map int1_pin
@@ -2455,21 +4633,40 @@ void int2Init(void) {
 	INTCONbits.INT2EP = 0;				//1=triggered on the falling edge. 0 = rising edge
 }
 
-void int2AttachISR(void (*isrptr) (void)) {
+#if defined(INT2_DIRECT) || !defined(USE_ISR_DIRECT)
+void int2AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub) {
+#if defined(INT2_ISRIPL)
+	if (ipl != ISRIPL_PRIO(INT2_ISRIPL)) return;		//the vector is built for another priority: leave it off
+#endif
 	_int2_isrptr = isrptr;
 	IFS0bits.INT2IF = 0;				//clear int0 flag
 	IEC0bits.INT2IE = 1;				//1->enable int0 interrupt, 0->disable the interrupt
-	IPC2bits.INT2IP = INT_IPDEFAULT;	//interrupt priority.
-	IPC2bits.INT2IS = INT_ISDEFAULT;	//interrupt sur-priority
+	IPC2bits.INT2IP = ipl;	//interrupt priority.
+	IPC2bits.INT2IS = sub;	//interrupt sur-priority
 }
+#endif
 
 //extint3
 void (* _int3_isrptr) (void)=empty_handler;
 
-void __ISR(_EXTERNAL_3_VECTOR) _INT3Interrupt(void) {
+#if defined(INT3_HANDLER)
+#define INT3_DIRECT
+#else
+#define INT3_HANDLER()		_int3_isrptr()
+#endif
+#if defined(INT3_DIRECT) || !defined(USE_ISR_DIRECT)
+#if defined(INT3_ISRIPL)
+#define INT3_ISR		__ISR(_EXTERNAL_3_VECTOR, INT3_ISRIPL)
+#else
+#define INT3_ISR		__ISR(_EXTERNAL_3_VECTOR)
+#endif
+void INT3_ISR _INT3Interrupt(void) {
+	ISR_ENTER(ISR_INT3, 0);
 	IFS0bits.INT3IF = 0;				//clera the flag
-	_int3_isrptr();						//run the isr
+	INT3_HANDLER();						//run the isr
+	ISR_EXIT(ISR_INT3);
 }
+#endif	//INT3_DIRECT
 
 void int3Init(void) {
 	INT32RP();							//map int1_pin
@@ -2481,21 +4678,40 @@ void int3Init(void) {
 	INTCONbits.INT3EP = 0;				//1=triggered on the falling edge. 0 = rising edge
 }
 
-void int3AttachISR(void (*isrptr) (void)) {
+#if defined(INT3_DIRECT) || !defined(USE_ISR_DIRECT)
+void int3AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub) {
+#if defined(INT3_ISRIPL)
+	if (ipl != ISRIPL_PRIO(INT3_ISRIPL)) return;		//the vector is built for another priority: leave it off
+#endif
 	_int3_isrptr = isrptr;
 	IFS0bits.INT3IF = 0;				//clear int0 flag
 	IEC0bits.INT3IE = 1;				//1->enable int0 interrupt, 0->disable the interrupt
-	IPC3bits.INT3IP = INT_IPDEFAULT;	//interrupt priority.
-	IPC3bits.INT3IS = INT_ISDEFAULT;	//interrupt sur-priority
+	IPC3bits.INT3IP = ipl;	//interrupt priority.
+	IPC3bits.INT3IS = sub;	//interrupt sur-priority
 }
+#endif
 
 //extint4
 void (* _int4_isrptr) (void)=empty_handler;
 
-void __ISR(_EXTERNAL_4_VECTOR) _INT4Interrupt(void) {
+#if defined(INT4_HANDLER)
+#define INT4_DIRECT
+#else
+#define INT4_HANDLER()		_int4_isrptr()
+#endif
+#if defined(INT4_DIRECT) || !defined(USE_ISR_DIRECT)
+#if defined(INT4_ISRIPL)
+#define INT4_ISR		__ISR(_EXTERNAL_4_VECTOR, INT4_ISRIPL)
+#else
+#define INT4_ISR		__ISR(_EXTERNAL_4_VECTOR)
+#endif
+void INT4_ISR _INT4Interrupt(void) {
+	ISR_ENTER(ISR_INT4, 0);
 	IFS0bits.INT4IF = 0;				//clera the flag
-	_int4_isrptr();						//run the isr
+	INT4_HANDLER();						//run the isr
+	ISR_EXIT(ISR_INT4);
 }
+#endif	//INT4_DIRECT
 
 void int4Init(void) {
 	INT42RP();							//map int1_pin
@@ -2507,20 +4723,188 @@ void int4Init(void) {
 	INTCONbits.INT4EP = 0;				//1=triggered on the falling edge. 0 = rising edge
 }
 
-void int4AttachISR(void (*isrptr) (void)) {
+#if defined(INT4_DIRECT) || !defined(USE_ISR_DIRECT)
+void int4AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub) {
+#if defined(INT4_ISRIPL)
+	if (ipl != ISRIPL_PRIO(INT4_ISRIPL)) return;		//the vector is built for another priority: leave it off
+#endif
 	_int4_isrptr = isrptr;
 	IFS0bits.INT4IF = 0;				//clear int0 flag
 	IEC0bits.INT4IE = 1;				//1->enable int0 interrupt, 0->disable the interrupt
-	IPC4bits.INT4IP = INT_IPDEFAULT;	//interrupt priority.
-	IPC4bits.INT4IS = INT_ISDEFAULT;	//interrupt sur-priority
+	IPC4bits.INT4IP = ipl;	//interrupt priority.
+	IPC4bits.INT4IS = sub;	//interrupt sur-priority
 }
+#endif
 //end extint
 
 //spi
+//spi dma transfer descriptor
+typedef struct {
+	const uint8_t *tx;							//data to send, NULL -> rx only
+	uint8_t *rx;								//received data, NULL -> tx only
+	uint16_t len;								//number of bytes
+	void (*callback)(void);						//run from the isr when done, may be NULL
+} SPI_XferTypeDef;
+#define SPI_DMAQMASK		(SPI_DMAQSIZE - 1)
+#if (SPI_DMAQSIZE & SPI_DMAQMASK)
+#error "pic32duino.c: SPI_DMAQSIZE must be a power of 2!"
+#endif
+
+//spi1 dma transfer engine
+//DCH0 moves tx bytes into SPI1BUF on the spi tx irq, DCH1 moves rx bytes out of SPI1BUF on the spi rx irq
+static SPI_XferTypeDef _spi1_q[SPI_DMAQSIZE];			//transfer queue
+static volatile uint8_t _spi1_qhead=0, _spi1_qtail=0;	//write / read index
+static volatile uint8_t _spi1_busy=0;					//1->dma transfer in progress
+#define SPI1_IEMASK		(_IEC1_DMA0IE_MASK | _IEC1_DMA1IE_MASK | _IEC1_SPI1TXIE_MASK)	//interrupts used by the engine
+
+//start the transfer at the tail of the queue
+static void _spi1DMAStart(void) {
+	SPI_XferTypeDef *x = &_spi1_q[_spi1_qtail & SPI_DMAQMASK];
+
+	//flush the rx fifo
+	while (!SPI1STATbits.SPIRBE) SPI1BUF;
+	SPI1STATCLR = _SPI1STAT_SPIROV_MASK;
+
+	DCH0SSA = KVA_TO_PA(x->tx ? x->tx : x->rx);		//rx only: the rx buffer, filled with 0xff by spi1Transfer(), is the source
+	DCH0SSIZ = x->len;
+	DCH0INTCLR = 0x00ff00ff;						//clear flags / enables
+	if (x->rx) {
+		//completion signaled by the rx channel
+		DCH1DSA = KVA_TO_PA(x->rx);
+		DCH1DSIZ = x->len;
+		DCH1INTCLR = 0x00ff00ff;
+		DCH1INTSET = _DCH1INT_CHBCIE_MASK;			//interrupt on block done
+		IFS1CLR = _IFS1_DMA1IF_MASK;
+		IEC1SET = _IEC1_DMA1IE_MASK;
+		DCH1CONSET = _DCH1CON_CHEN_MASK;			//arm the rx channel first
+	} else {
+		//tx only: tx channel done -> wait for the shift register to empty
+		DCH0INTSET = _DCH0INT_CHBCIE_MASK;			//interrupt on block done
+		IFS1CLR = _IFS1_DMA0IF_MASK;
+		IEC1SET = _IEC1_DMA0IE_MASK;
+	}
+	DCH0CONSET = _DCH0CON_CHEN_MASK;				//arm the tx channel
+	DCH0ECONSET = _DCH0ECON_CFORCE_MASK;			//and kick off the first byte
+}
+
+//current transfer done: notify the user and start the next one
+static void _spi1DMADone(void) {
+	void (*callback)(void) = _spi1_q[_spi1_qtail & SPI_DMAQMASK].callback;
+
+	_spi1_qtail += 1;
+	if (callback) callback();					//e.g. deassert chip select
+	if (_spi1_qtail != _spi1_qhead) _spi1DMAStart();	//chain the next transfer
+	else _spi1_busy = 0;
+}
+
+//rx channel block done - full duplex / rx only transfer complete
+void __ISR(_DMA_1_VECTOR) _DMA1Interrupt(void) {
+	ISR_ENTER(ISR_DMA1, 0);
+	DCH1INTCLR = _DCH1INT_CHBCIF_MASK;			//clear the flags
+	IFS1CLR = _IFS1_DMA1IF_MASK;
+	IEC1CLR = _IEC1_DMA1IE_MASK;
+	_spi1DMADone();
+	ISR_EXIT(ISR_DMA1);
+}
+
+//tx channel block done - tx only transfer: last bytes still in the fifo
+void __ISR(_DMA_0_VECTOR) _DMA0Interrupt(void) {
+	ISR_ENTER(ISR_DMA0, 0);
+	DCH0INTCLR = _DCH0INT_CHBCIF_MASK;			//clear the flags
+	IFS1CLR = _IFS1_DMA0IF_MASK;
+	IEC1CLR = _IEC1_DMA0IE_MASK;
+	SPI1CONbits.STXISEL = 0;					//00->interrupt when the last byte has been shifted out
+	IFS1CLR = _IFS1_SPI1TXIF_MASK;
+	IEC1SET = _IEC1_SPI1TXIE_MASK;
+	ISR_EXIT(ISR_DMA0);
+}
+
+//spi1 tx isr - tx only transfer complete
+void __ISR(_SPI_1_VECTOR) _SPI1Interrupt(void) {
+	ISR_ENTER(ISR_SPI1, 0);
+	IEC1CLR = _IEC1_SPI1TXIE_MASK;
+	SPI1CONbits.STXISEL = 3;					//11->back to dma pacing: tx buffer not full
+	IFS1CLR = _IFS1_SPI1TXIF_MASK;
+	while (!SPI1STATbits.SPIRBE) SPI1BUF;		//discard the received data
+	SPI1STATCLR = _SPI1STAT_SPIROV_MASK;
+	_spi1DMADone();
+	ISR_EXIT(ISR_SPI1);
+}
+
+//set up the dma channels for spi1 - called by spi1Init()
+static void _spi1DMAInit(void) {
+	IEC1CLR = SPI1_IEMASK;						//stop the engine
+	DCH0CONCLR = _DCH0CON_CHEN_MASK;
+	DCH1CONCLR = _DCH1CON_CHEN_MASK;
+	_spi1_qhead = _spi1_qtail = 0;				//empty the queue
+	_spi1_busy = 0;
+
+	//spi raises tx irq while its tx buffer has room, rx irq while its rx buffer has data
+	SPI1CONbits.STXISEL = 3;					//11->tx buffer not full
+	SPI1CONbits.SRXISEL = 1;					//01->rx buffer not empty
+
+	DMACONSET = _DMACON_ON_MASK;				//1->enable the dma controller
+	//tx channel: memory -> SPI1BUF, one byte per spi tx irq
+	DCH0CON = 3;								//priority 3, no chaining, no auto-enable
+	DCH0ECON = (_SPI1_TX_IRQ << _DCH0ECON_CHSIRQ_POSITION) | _DCH0ECON_SIRQEN_MASK;
+	DCH0DSA = KVA_TO_PA(&SPI1BUF);
+	DCH0DSIZ = 1;
+	DCH0CSIZ = 1;
+	DCH0INTCLR = 0x00ff00ff;
+	//rx channel: SPI1BUF -> memory, one byte per spi rx irq
+	DCH1CON = 3;								//priority 3, no chaining, no auto-enable
+	DCH1ECON = (_SPI1_RX_IRQ << _DCH1ECON_CHSIRQ_POSITION) | _DCH1ECON_SIRQEN_MASK;
+	DCH1SSA = KVA_TO_PA(&SPI1BUF);
+	DCH1SSIZ = 1;
+	DCH1CSIZ = 1;
+	DCH1INTCLR = 0x00ff00ff;
+
+	IFS1CLR = _IFS1_DMA0IF_MASK | _IFS1_DMA1IF_MASK | _IFS1_SPI1TXIF_MASK;
+	IPC10bits.DMA0IP = SPI_IPDEFAULT;			//interrupt priority
+	IPC10bits.DMA0IS = SPI_ISDEFAULT;			//interrupt sub-priority
+	IPC10bits.DMA1IP = SPI_IPDEFAULT;
+	IPC10bits.DMA1IS = SPI_ISDEFAULT;
+	IPC7bits.SPI1IP = SPI_IPDEFAULT;
+	IPC7bits.SPI1IS = SPI_ISDEFAULT;
+}
+
+//queue a dma transfer
+//tx=NULL -> rx only (0xff is sent), rx=NULL -> tx only
+//callback runs from the isr once the transfer has completed
+//returns 0 if the queue is full
+uint8_t spi1Transfer(const uint8_t *tx, uint8_t *rx, uint16_t len, void (*callback)(void)) {
+	SPI_XferTypeDef *x;
+	uint32_t ie;
+
+	if ((len == 0) || ((tx == NULL) && (rx == NULL))) return 0;	//nothing to do
+	if ((uint8_t) (_spi1_qhead - _spi1_qtail) >= SPI_DMAQSIZE) return 0;	//queue full
+	if (tx == NULL) memset(rx, 0xff, len);		//rx only: the rx buffer doubles as the source of 0xff - rx lags tx so nothing is overwritten before it is sent
+	x = &_spi1_q[_spi1_qhead & SPI_DMAQMASK];
+	x->tx = tx; x->rx = rx; x->len = len; x->callback = callback;
+
+	ie = IEC1 & SPI1_IEMASK;					//hold off the engine's isrs
+	IEC1CLR = SPI1_IEMASK;
+	_spi1_qhead += 1;
+	if (_spi1_busy == 0) {_spi1_busy = 1; _spi1DMAStart();}	//engine idle -> start now
+	else IEC1SET = ie;
+	return 1;
+}
+
+//number of dma transfers pending
+uint8_t spi1TransferBusy(void) {
+	return _spi1_qhead - _spi1_qtail;
+}
+
 //rest spi1
 #define F_SPI1			100000ul		//spi speed
+//brg from the spi speed at the current clock
+static uint32_t _spi1_br=F_SPI1;		//spi speed
+static void _spi1Rebase(void) {
+	SPI1BRG = F_PHB / 2 / _spi1_br;	//set the baudrate generator
+}
+
 void spi1Init(uint32_t br) {
-	PMD5bits.SPI1MD = 0;				//0->enable the module
+	_pmdInit(PMD_SPI1);				//0->enable the module
 
 	//map the pins
 	//map the pins
@@ -2540,7 +4924,9 @@ void spi1Init(uint32_t br) {
 	SPI1CON = 0; 						//reset the spi module
 	SPI1CONbits.MSTEN = 1;				//1->master mode, 0->slave mode
 	SPI1CONbits.ENHBUF= 1;				//1->enable enhanced buffer mode, 0->disable enhanced buffer mode
-	SPI1BRG = F_PHB / 2 / br;			//set the baudrate generator
+	_spi1_br = br;
+	_spi1Rebase();						//set the baudrate generator
+	SystemCoreClockNotify(_spi1Rebase);	//and again after each clock change
 	SPI1BUF;							//read the buffer to reset the flag
 	IFS1bits.SPI1TXIF = 0;				//0->reset the flag
 	IFS1bits.SPI1RXIF = 0;				//0->reset the flag
@@ -2548,9 +4934,167 @@ void spi1Init(uint32_t br) {
 	IEC1bits.SPI1TXIE = 0;				//0->disable the interrupt, 1->enable the interrupt
 	IEC1bits.SPI1RXIE = 0;				//0->disable the interrupt, 1->enable the interrupt
 	IEC1bits.SPI1EIE = 0;				//0->disable the interrupt, 1->enable the interrupt
+	_spi1DMAInit();						//set up dma transfers
 	SPI1CONbits.ON = 1;					//1->enable the module, 0->disable the module
 }
 
+//turn off the spi: wait for the pending transfers, stop the dma channels, disconnect sdo1, power down
+void spi1Deinit(void) {
+	while (spi1TransferBusy()) continue;	//queue drained
+	if (SPI1CONbits.ON) while (SPI1STATbits.SPIBUSY) continue;	//last byte clocked out
+	IEC1CLR = SPI1_IEMASK;				//stop the engine
+	DCH0CONCLR = _DCH0CON_CHEN_MASK;
+	DCH1CONCLR = _DCH1CON_CHEN_MASK;
+	SPI1CONbits.ON = 0;					//1->enable the module, 0->disable the module
+	_ppsRelease(PPS_G2 | PPS_G3, 0b0011);	//sdo1: groups 2 and 3, 0b0011
+	_pmdDeinit(PMD_SPI1);				//power down the module
+}
+
+//spi2 dma transfer engine
+//DCH2 moves tx bytes into SPI2BUF on the spi tx irq, DCH3 moves rx bytes out of SPI2BUF on the spi rx irq
+static SPI_XferTypeDef _spi2_q[SPI_DMAQSIZE];			//transfer queue
+static volatile uint8_t _spi2_qhead=0, _spi2_qtail=0;	//write / read index
+static volatile uint8_t _spi2_busy=0;					//1->dma transfer in progress
+#define SPI2_IEMASK		(_IEC1_DMA2IE_MASK | _IEC1_DMA3IE_MASK | _IEC1_SPI2TXIE_MASK)	//interrupts used by the engine
+
+//start the transfer at the tail of the queue
+static void _spi2DMAStart(void) {
+	SPI_XferTypeDef *x = &_spi2_q[_spi2_qtail & SPI_DMAQMASK];
+
+	//flush the rx fifo
+	while (!SPI2STATbits.SPIRBE) SPI2BUF;
+	SPI2STATCLR = _SPI2STAT_SPIROV_MASK;
+
+	DCH2SSA = KVA_TO_PA(x->tx ? x->tx : x->rx);		//rx only: the rx buffer, filled with 0xff by spi2Transfer(), is the source
+	DCH2SSIZ = x->len;
+	DCH2INTCLR = 0x00ff00ff;						//clear flags / enables
+	if (x->rx) {
+		//completion signaled by the rx channel
+		DCH3DSA = KVA_TO_PA(x->rx);
+		DCH3DSIZ = x->len;
+		DCH3INTCLR = 0x00ff00ff;
+		DCH3INTSET = _DCH3INT_CHBCIE_MASK;			//interrupt on block done
+		IFS1CLR = _IFS1_DMA3IF_MASK;
+		IEC1SET = _IEC1_DMA3IE_MASK;
+		DCH3CONSET = _DCH3CON_CHEN_MASK;			//arm the rx channel first
+	} else {
+		//tx only: tx channel done -> wait for the shift register to empty
+		DCH2INTSET = _DCH2INT_CHBCIE_MASK;			//interrupt on block done
+		IFS1CLR = _IFS1_DMA2IF_MASK;
+		IEC1SET = _IEC1_DMA2IE_MASK;
+	}
+	DCH2CONSET = _DCH2CON_CHEN_MASK;				//arm the tx channel
+	DCH2ECONSET = _DCH2ECON_CFORCE_MASK;			//and kick off the first byte
+}
+
+//current transfer done: notify the user and start the next one
+static void _spi2DMADone(void) {
+	void (*callback)(void) = _spi2_q[_spi2_qtail & SPI_DMAQMASK].callback;
+
+	_spi2_qtail += 1;
+	if (callback) callback();					//e.g. deassert chip select
+	if (_spi2_qtail != _spi2_qhead) _spi2DMAStart();	//chain the next transfer
+	else _spi2_busy = 0;
+}
+
+//rx channel block done - full duplex / rx only transfer complete
+void __ISR(_DMA_3_VECTOR) _DMA3Interrupt(void) {
+	ISR_ENTER(ISR_DMA3, 0);
+	DCH3INTCLR = _DCH3INT_CHBCIF_MASK;			//clear the flags
+	IFS1CLR = _IFS1_DMA3IF_MASK;
+	IEC1CLR = _IEC1_DMA3IE_MASK;
+	_spi2DMADone();
+	ISR_EXIT(ISR_DMA3);
+}
+
+//tx channel block done - tx only transfer: last bytes still in the fifo
+void __ISR(_DMA_2_VECTOR) _DMA2Interrupt(void) {
+	ISR_ENTER(ISR_DMA2, 0);
+	DCH2INTCLR = _DCH2INT_CHBCIF_MASK;			//clear the flags
+	IFS1CLR = _IFS1_DMA2IF_MASK;
+	IEC1CLR = _IEC1_DMA2IE_MASK;
+	SPI2CONbits.STXISEL = 0;					//00->interrupt when the last byte has been shifted out
+	IFS1CLR = _IFS1_SPI2TXIF_MASK;
+	IEC1SET = _IEC1_SPI2TXIE_MASK;
+	ISR_EXIT(ISR_DMA2);
+}
+
+//spi2 tx isr - tx only transfer complete
+void __ISR(_SPI_2_VECTOR) _SPI2Interrupt(void) {
+	ISR_ENTER(ISR_SPI2, 0);
+	IEC1CLR = _IEC1_SPI2TXIE_MASK;
+	SPI2CONbits.STXISEL = 3;					//11->back to dma pacing: tx buffer not full
+	IFS1CLR = _IFS1_SPI2TXIF_MASK;
+	while (!SPI2STATbits.SPIRBE) SPI2BUF;		//discard the received data
+	SPI2STATCLR = _SPI2STAT_SPIROV_MASK;
+	_spi2DMADone();
+	ISR_EXIT(ISR_SPI2);
+}
+
+//set up the dma channels for spi2 - called by spi2Init()
+static void _spi2DMAInit(void) {
+	IEC1CLR = SPI2_IEMASK;						//stop the engine
+	DCH2CONCLR = _DCH2CON_CHEN_MASK;
+	DCH3CONCLR = _DCH3CON_CHEN_MASK;
+	_spi2_qhead = _spi2_qtail = 0;				//empty the queue
+	_spi2_busy = 0;
+
+	//spi raises tx irq while its tx buffer has room, rx irq while its rx buffer has data
+	SPI2CONbits.STXISEL = 3;					//11->tx buffer not full
+	SPI2CONbits.SRXISEL = 1;					//01->rx buffer not empty
+
+	DMACONSET = _DMACON_ON_MASK;				//1->enable the dma controller
+	//tx channel: memory -> SPI2BUF, one byte per spi tx irq
+	DCH2CON = 3;								//priority 3, no chaining, no auto-enable
+	DCH2ECON = (_SPI2_TX_IRQ << _DCH2ECON_CHSIRQ_POSITION) | _DCH2ECON_SIRQEN_MASK;
+	DCH2DSA = KVA_TO_PA(&SPI2BUF);
+	DCH2DSIZ = 1;
+	DCH2CSIZ = 1;
+	DCH2INTCLR = 0x00ff00ff;
+	//rx channel: SPI2BUF -> memory, one byte per spi rx irq
+	DCH3CON = 3;								//priority 3, no chaining, no auto-enable
+	DCH3ECON = (_SPI2_RX_IRQ << _DCH3ECON_CHSIRQ_POSITION) | _DCH3ECON_SIRQEN_MASK;
+	DCH3SSA = KVA_TO_PA(&SPI2BUF);
+	DCH3SSIZ = 1;
+	DCH3CSIZ = 1;
+	DCH3INTCLR = 0x00ff00ff;
+
+	IFS1CLR = _IFS1_DMA2IF_MASK | _IFS1_DMA3IF_MASK | _IFS1_SPI2TXIF_MASK;
+	IPC10bits.DMA2IP = SPI_IPDEFAULT;			//interrupt priority
+	IPC10bits.DMA2IS = SPI_ISDEFAULT;			//interrupt sub-priority
+	IPC10bits.DMA3IP = SPI_IPDEFAULT;
+	IPC10bits.DMA3IS = SPI_ISDEFAULT;
+	IPC9bits.SPI2IP = SPI_IPDEFAULT;
+	IPC9bits.SPI2IS = SPI_ISDEFAULT;
+}
+
+//queue a dma transfer
+//tx=NULL -> rx only (0xff is sent), rx=NULL -> tx only
+//callback runs from the isr once the transfer has completed
+//returns 0 if the queue is full
+uint8_t spi2Transfer(const uint8_t *tx, uint8_t *rx, uint16_t len, void (*callback)(void)) {
+	SPI_XferTypeDef *x;
+	uint32_t ie;
+
+	if ((len == 0) || ((tx == NULL) && (rx == NULL))) return 0;	//nothing to do
+	if ((uint8_t) (_spi2_qhead - _spi2_qtail) >= SPI_DMAQSIZE) return 0;	//queue full
+	if (tx == NULL) memset(rx, 0xff, len);		//rx only: the rx buffer doubles as the source of 0xff - rx lags tx so nothing is overwritten before it is sent
+	x = &_spi2_q[_spi2_qhead & SPI_DMAQMASK];
+	x->tx = tx; x->rx = rx; x->len = len; x->callback = callback;
+
+	ie = IEC1 & SPI2_IEMASK;					//hold off the engine's isrs
+	IEC1CLR = SPI2_IEMASK;
+	_spi2_qhead += 1;
+	if (_spi2_busy == 0) {_spi2_busy = 1; _spi2DMAStart();}	//engine idle -> start now
+	else IEC1SET = ie;
+	return 1;
+}
+
+//number of dma transfers pending
+uint8_t spi2TransferBusy(void) {
+	return _spi2_qhead - _spi2_qtail;
+}
+
 //send data via spi
 //void spi1Write(uint8_t dat) {
 //	while (spi1Busy()) continue;		//tx buffer is full
@@ -2559,8 +5103,14 @@ void spi1Init(uint32_t br) {
 
 //rest spi2
 #define F_SPI2			1000000ul		//baud rate
+//brg from the spi speed at the current clock
+static uint32_t _spi2_br=F_SPI2;		//spi speed
+static void _spi2Rebase(void) {
+	SPI2BRG = F_PHB / 2 / _spi2_br;	//set the baudrate generator
+}
+
 void spi2Init(uint32_t br) {
-	PMD5bits.SPI2MD = 0;				//0->enable the module
+	_pmdInit(PMD_SPI2);				//0->enable the module
 
 	//map the pins
 #if defined(SCK2RP)
@@ -2578,7 +5128,9 @@ void spi2Init(uint32_t br) {
 	SPI2CON = 0; 						//reset the spi module
 	SPI2CONbits.MSTEN = 1;				//1->master mode, 0->slave mode
 	SPI2CONbits.ENHBUF= 1;				//1->enable enhanced buffer mode, 0->disable enhanced buffer mode
-	SPI2BRG = F_PHB / 2 / br;			//set the baudrate generator
+	_spi2_br = br;
+	_spi2Rebase();						//set the baudrate generator
+	SystemCoreClockNotify(_spi2Rebase);	//and again after each clock change
 	SPI2BUF;							//read the buffer to reset the flag
 	IFS1bits.SPI2TXIF = 0;				//0->reset the flag
 	IFS1bits.SPI2RXIF = 0;				//0->reset the flag
@@ -2586,9 +5138,22 @@ void spi2Init(uint32_t br) {
 	IEC1bits.SPI2TXIE = 0;				//0->disable the interrupt, 1->enable the interrupt
 	IEC1bits.SPI2RXIE = 0;				//0->disable the interrupt, 1->enable the interrupt
 	IEC1bits.SPI2EIE = 0;				//0->disable the interrupt, 1->enable the interrupt
+	_spi2DMAInit();						//set up dma transfers
 	SPI2CONbits.ON = 1;					//1->enable the module, 0->disable the module
 }
 
+//turn off the spi: wait for the pending transfers, stop the dma channels, disconnect sdo2, power down
+void spi2Deinit(void) {
+	while (spi2TransferBusy()) continue;	//queue drained
+	if (SPI2CONbits.ON) while (SPI2STATbits.SPIBUSY) continue;	//last byte clocked out
+	IEC1CLR = SPI2_IEMASK;				//stop the engine
+	DCH2CONCLR = _DCH2CON_CHEN_MASK;
+	DCH3CONCLR = _DCH3CON_CHEN_MASK;
+	SPI2CONbits.ON = 0;					//1->enable the module, 0->disable the module
+	_ppsRelease(PPS_G2 | PPS_G3, 0b0100);	//sdo2: groups 2 and 3, 0b0100
+	_pmdDeinit(PMD_SPI2);				//power down the module
+}
+
 //send data via spi
 //void spi2Write(uint8_t dat) {
 //	while (spi2Busy()) continue;		//tx buffer is full
@@ -2596,20 +5161,239 @@ void spi2Init(uint32_t br) {
 //}
 //end spi
 
+//i2c transaction
+typedef struct {
+	uint8_t addr;								//7-bit slave address
+	uint8_t regn;								//1->send reg ahead of wbuf
+	uint8_t reg;								//register address
+	const uint8_t *wbuf;						//bytes to write
+	uint16_t wlen;
+	uint8_t *rbuf;								//bytes to read, after a repeated start
+	uint16_t rlen;
+	void (*callback)(uint8_t status);			//run from the isr when done, may be NULL
+	volatile uint8_t *status;					//status written here when done, may be NULL
+} I2C_XferTypeDef;
+#define I2C_PENDING		0xff					//not done yet - *status of a queued transaction
+#define I2C_QMASK		(I2C_QSIZE - 1)
+#if (I2C_QSIZE & I2C_QMASK)
+#error "pic32duino.c: I2C_QSIZE must be a power of 2!"
+#endif
+
+//engine states: the event that has just completed
+#define I2C_S_IDLE		0
+#define I2C_S_START		1						//start condition
+#define I2C_S_WRITE		2						//address+W or data byte
+#define I2C_S_RESTART	3						//repeated start
+#define I2C_S_RADDR		4						//address+R
+#define I2C_S_READ		5						//data byte received
+#define I2C_S_ACK		6						//ack / nack
+#define I2C_S_STOP		7						//stop condition
+
+//i2c1 transaction engine
+//driven by the master interrupt: each start / address / data / ack / stop event advances the state machine
+static I2C_XferTypeDef _i2c1_q[I2C_QSIZE];				//transaction queue
+static volatile uint8_t _i2c1_qhead=0, _i2c1_qtail=0;	//write / read index
+static volatile uint8_t _i2c1_state=I2C_S_IDLE;			//engine state
+static volatile uint8_t _i2c1_status=I2C_OK;			//status of the current / last transaction
+static uint16_t _i2c1_idx;								//bytes done in the current phase
+static volatile uint32_t _i2c1_t0;						//time of the last bus event
+#define I2C1_IEMASK	(_IEC1_I2C1MIE_MASK | _IEC1_I2C1BIE_MASK)	//interrupts used by the engine
+
+//start the transaction at the tail of the queue
+static void _i2c1Next(void) {
+	if (_i2c1_qtail == _i2c1_qhead) {			//queue empty
+		_i2c1_state = I2C_S_IDLE;
+		IEC1CLR = I2C1_IEMASK;
+		return;
+	}
+	_i2c1_idx = 0;
+	_i2c1_t0 = coreticks();
+	_i2c1_state = I2C_S_START;
+	IFS1CLR = _IFS1_I2C1MIF_MASK | _IFS1_I2C1BIF_MASK;
+	IEC1SET = I2C1_IEMASK;
+	I2C1CONSET = _I2C1CON_SEN_MASK;			//send a start condition
+}
+
+//current transaction done: notify the user and start the next one
+static void _i2c1Done(uint8_t status) {
+	I2C_XferTypeDef *x = &_i2c1_q[_i2c1_qtail & I2C_QMASK];
+	void (*callback)(uint8_t status) = x->callback;
+
+	if (x->status) *x->status = status;
+	_i2c1_status = status;
+	_i2c1_qtail += 1;
+	if (callback) callback(status);
+	_i2c1Next();
+}
+
+//end the transaction with a stop condition
+static void _i2c1Stop(uint8_t status) {
+	_i2c1_status = status;
+	_i2c1_state = I2C_S_STOP;
+	I2C1CONSET = _I2C1CON_PEN_MASK;			//send a stop condition
+}
+
+//i2c1 isr: master / bus collision events
+void __ISR(_I2C_1_VECTOR) _I2C1Interrupt(void) {
+	I2C_XferTypeDef *x = &_i2c1_q[_i2c1_qtail & I2C_QMASK];
+
+	ISR_ENTER(ISR_I2C1, 0);
+	if (IFS1 & _IFS1_I2C1BIF_MASK) {				//bus collision: the module is back to idle
+		IFS1CLR = _IFS1_I2C1BIF_MASK | _IFS1_I2C1MIF_MASK;
+		I2C1STATCLR = _I2C1STAT_BCL_MASK;
+		_i2c1Done(I2C_ERR_BCL);
+		ISR_EXIT(ISR_I2C1);
+		return;
+	}
+	IFS1CLR = _IFS1_I2C1MIF_MASK;				//clear the flag
+	_i2c1_t0 = coreticks();
+	switch (_i2c1_state) {
+	case I2C_S_START:							//start sent -> address
+		if ((x->regn + x->wlen == 0) && x->rlen) {I2C1TRN = (x->addr << 1) | I2C_CMD_READ; _i2c1_state = I2C_S_RADDR;}
+		else {I2C1TRN = (x->addr << 1) | I2C_CMD_WRITE; _i2c1_state = I2C_S_WRITE;}
+		break;
+	case I2C_S_WRITE:							//address+W or data byte sent
+		if (I2C1STATbits.ACKSTAT) {_i2c1Stop(I2C_ERR_NACK); break;}
+		if (_i2c1_idx < x->regn) {I2C1TRN = x->reg; _i2c1_idx++;}	//register address
+		else if (_i2c1_idx < x->regn + x->wlen) {I2C1TRN = x->wbuf[_i2c1_idx - x->regn]; _i2c1_idx++;}	//next byte
+		else if (x->rlen) {I2C1CONSET = _I2C1CON_RSEN_MASK; _i2c1_state = I2C_S_RESTART;}
+		else _i2c1Stop(I2C_OK);
+		break;
+	case I2C_S_RESTART:							//repeated start sent -> address+R
+		_i2c1_idx = 0;
+		I2C1TRN = (x->addr << 1) | I2C_CMD_READ;
+		_i2c1_state = I2C_S_RADDR;
+		break;
+	case I2C_S_RADDR:							//address+R sent
+		if (I2C1STATbits.ACKSTAT) {_i2c1Stop(I2C_ERR_NACK); break;}
+		I2C1CONSET = _I2C1CON_RCEN_MASK;		//receive a byte
+		_i2c1_state = I2C_S_READ;
+		break;
+	case I2C_S_READ:							//byte received -> ack it, nack the last one
+		x->rbuf[_i2c1_idx++] = I2C1RCV;
+		I2C1CONbits.ACKDT = (_i2c1_idx < x->rlen) ? I2C_ACK : I2C_NOACK;
+		I2C1CONSET = _I2C1CON_ACKEN_MASK;
+		_i2c1_state = I2C_S_ACK;
+		break;
+	case I2C_S_ACK:								//ack / nack sent
+		if (_i2c1_idx < x->rlen) {I2C1CONSET = _I2C1CON_RCEN_MASK; _i2c1_state = I2C_S_READ;}
+		else _i2c1Stop(I2C_OK);
+		break;
+	case I2C_S_STOP:							//stop sent
+		_i2c1Done(_i2c1_status);
+		break;
+	default: break;								//not ours - blocking calls
+	}
+	ISR_EXIT(ISR_I2C1);
+}
+
+//queue a transaction, with an optional register address (regn=1) ahead of wbuf
+static uint8_t _i2c1Queue(uint8_t addr, uint8_t regn, uint8_t reg, const uint8_t *wbuf, uint16_t wlen, uint8_t *rbuf, uint16_t rlen, void (*callback)(uint8_t status), volatile uint8_t *status) {
+	I2C_XferTypeDef *x;
+	uint32_t ie;
+
+	if ((uint8_t) (_i2c1_qhead - _i2c1_qtail) >= I2C_QSIZE) return 0;	//queue full
+	x = &_i2c1_q[_i2c1_qhead & I2C_QMASK];
+	x->addr = addr; x->regn = regn; x->reg = reg;
+	x->wbuf = wbuf; x->wlen = wlen; x->rbuf = rbuf; x->rlen = rlen; x->callback = callback; x->status = status;
+
+	ie = IEC1 & I2C1_IEMASK;					//hold off the isr
+	IEC1CLR = I2C1_IEMASK;
+	_i2c1_qhead += 1;
+	if (_i2c1_state == I2C_S_IDLE) _i2c1Next();	//engine idle -> start now
+	else IEC1SET = ie;
+	return 1;
+}
+
+//queue a transaction
+uint8_t i2c1Xfer(uint8_t addr, const uint8_t *wbuf, uint16_t wlen, uint8_t *rbuf, uint16_t rlen, void (*callback)(uint8_t status)) {
+	return _i2c1Queue(addr, 0, 0, wbuf, wlen, rbuf, rlen, callback, NULL);
+}
+
+//number of transactions pending
+//aborts the current transaction if the bus has made no progress for I2C_TIMEOUT ms
+uint8_t i2c1XferBusy(void) {
+	uint32_t ie = IEC1 & I2C1_IEMASK;
+
+	IEC1CLR = I2C1_IEMASK;						//hold off the isr
+	if ((_i2c1_state != I2C_S_IDLE) && (coreticks() - _i2c1_t0 > I2C_TIMEOUT * cyclesPerMillisecond())) {
+		I2C1CONbits.ON = 0;						//reset the module - releases the bus
+		I2C1CONbits.ON = 1;
+		_i2c1Done(I2C_ERR_TIMEOUT);
+	} else IEC1SET = ie;
+	return _i2c1_qhead - _i2c1_qtail;
+}
+
+//status of the last completed transaction
+uint8_t i2c1XferStatus(void) {
+	return _i2c1_status;
+}
+
+//queue a transaction and wait for it to complete
+//returns its own status, not that of whatever was queued behind it
+static uint8_t _i2c1XferSync(uint8_t addr, uint8_t regn, uint8_t reg, const uint8_t *wbuf, uint16_t wlen, uint8_t *rbuf, uint16_t rlen) {
+	volatile uint8_t status = I2C_PENDING;
+
+	while (_i2c1Queue(addr, regn, reg, wbuf, wlen, rbuf, rlen, NULL, &status) == 0) i2c1XferBusy();	//queue full
+	while (status == I2C_PENDING) i2c1XferBusy();	//also runs the timeout
+	return status;
+}
+
+//write n bytes to consecutive registers from reg, in one transaction
+uint8_t i2c1WriteReg(uint8_t addr, uint8_t reg, const uint8_t *buf, uint16_t n) {
+	return _i2c1XferSync(addr, 1, reg, buf, n, NULL, 0);
+}
+
+//read n bytes from consecutive registers from reg, in one transaction
+uint8_t i2c1ReadReg(uint8_t addr, uint8_t reg, uint8_t *buf, uint16_t n) {
+	return _i2c1XferSync(addr, 1, reg, NULL, 0, buf, n);
+}
+
+//probe addresses 0x08..0x77, store the ones that ack in found[]
+//returns the number of devices found
+uint8_t i2c1Scan(uint8_t *found, uint8_t max) {
+	uint8_t addr, cnt=0;
+
+	for (addr=0x08; (addr < 0x78) && (cnt < max); addr++)
+		if (_i2c1XferSync(addr, 0, 0, NULL, 0, NULL, 0) == I2C_OK) found[cnt++] = addr;
+	return cnt;
+}
+
 //i2c1
 //wait for i2c
 #define i2c1Wait()		do {while (I2C1CON & 0x1f); while (I2C1STATbits.TRSTAT);} while (0)		//wait for i2c1
 
 //#define F_I2C1			100000ul		//I2C frequency
+//brg from the bus speed at the current clock
+static uint32_t _i2c1_bps=100000ul;	//bus speed
+static void _i2c1Rebase(void) {
+	I2C1BRG = F_PHB / 2 / _i2c1_bps - 1 - (F_PHB / 2 / 10000000ul);	//TPGOB = 130ns, minimum of 4
+	if (I2C1BRG < 0x04) I2C1BRG = 0x04;	//values 0..3 prohibited
+}
+
 //initialize the i2c
 void i2c1Init(uint32_t bps) {
-	PMD5bits.I2C1MD = 0;				//0->enable the module, 1->disable the module
+	_pmdInit(PMD_I2C1);				//0->enable the module, 1->disable the module
 	I2C1CON = 0;						//reset i2c
-	I2C1BRG = F_PHB / 2 / bps - 1 - (F_PHB / 2 / 10000000ul);	//TPGOB = 130ns, minimum of 4
-	if (I2C1BRG < 0x04) I2C1BRG = 0x04;	//values 0..3 prohibited
+	_i2c1_bps = bps;
+	_i2c1Rebase();						//set the brg
+	SystemCoreClockNotify(_i2c1Rebase);	//and again after each clock change
+	_i2c1_qhead = _i2c1_qtail = 0;		//empty the transaction queue
+	_i2c1_state = I2C_S_IDLE;
+	IEC1CLR = I2C1_IEMASK;				//engine isr enabled while transactions are pending
+	IPC8bits.I2C1IP = I2C_IPDEFAULT;		//interrupt priority
+	IPC8bits.I2C1IS = I2C_ISDEFAULT;		//interrupt sub-priority
 	I2C1CONbits.ON = 1;					//1->turn on the i2c, 0->turn off the i2c
 }
 
+//turn off the i2c: wait for the pending transactions, power down
+void i2c1Deinit(void) {
+	while (i2c1XferBusy()) continue;	//queue drained
+	IEC1CLR = I2C1_IEMASK;				//engine off
+	I2C1CONbits.ON = 0;					//1->turn on the i2c, 0->turn off the i2c
+	_pmdDeinit(PMD_I2C1);				//power down the module
+}
+
 //send a start condition
 void i2c1Start(void) {
 	i2c1Wait();
@@ -2637,8 +5421,8 @@ unsigned char i2c1Write(unsigned char dat) {
 	//while (I2C1STATbits.TRSTAT == 1) continue;	// Wait until transmit buffer is empty
 	while (I2C1STATbits.TBF == 1) continue;		// Wait until transmit buffer is empty
 	//i2c1Wait();								//wait for i2c bus to idle
-	while (I2C1STATbits.ACKSTAT == 1) continue;	//wait for the ack signal
-	return I2C1STATbits.ACKSTAT; 				// Wait until ACK is received
+	while (I2C1STATbits.TRSTAT == 1) continue;	//wait for the 9th clock (ack) to complete
+	return I2C1STATbits.ACKSTAT; 				//0->ack, 1->nack
 }
 
 //read i2c
@@ -2652,20 +5436,211 @@ unsigned char i2c1Read(unsigned char ack) {
 	return I2C1RCV;						// Retrieve value from I2C1RCV
 }
 
+//i2c2 transaction engine
+//driven by the master interrupt: each start / address / data / ack / stop event advances the state machine
+static I2C_XferTypeDef _i2c2_q[I2C_QSIZE];				//transaction queue
+static volatile uint8_t _i2c2_qhead=0, _i2c2_qtail=0;	//write / read index
+static volatile uint8_t _i2c2_state=I2C_S_IDLE;			//engine state
+static volatile uint8_t _i2c2_status=I2C_OK;			//status of the current / last transaction
+static uint16_t _i2c2_idx;								//bytes done in the current phase
+static volatile uint32_t _i2c2_t0;						//time of the last bus event
+#define I2C2_IEMASK	(_IEC1_I2C2MIE_MASK | _IEC1_I2C2BIE_MASK)	//interrupts used by the engine
+
+//start the transaction at the tail of the queue
+static void _i2c2Next(void) {
+	if (_i2c2_qtail == _i2c2_qhead) {			//queue empty
+		_i2c2_state = I2C_S_IDLE;
+		IEC1CLR = I2C2_IEMASK;
+		return;
+	}
+	_i2c2_idx = 0;
+	_i2c2_t0 = coreticks();
+	_i2c2_state = I2C_S_START;
+	IFS1CLR = _IFS1_I2C2MIF_MASK | _IFS1_I2C2BIF_MASK;
+	IEC1SET = I2C2_IEMASK;
+	I2C2CONSET = _I2C2CON_SEN_MASK;			//send a start condition
+}
+
+//current transaction done: notify the user and start the next one
+static void _i2c2Done(uint8_t status) {
+	I2C_XferTypeDef *x = &_i2c2_q[_i2c2_qtail & I2C_QMASK];
+	void (*callback)(uint8_t status) = x->callback;
+
+	if (x->status) *x->status = status;
+	_i2c2_status = status;
+	_i2c2_qtail += 1;
+	if (callback) callback(status);
+	_i2c2Next();
+}
+
+//end the transaction with a stop condition
+static void _i2c2Stop(uint8_t status) {
+	_i2c2_status = status;
+	_i2c2_state = I2C_S_STOP;
+	I2C2CONSET = _I2C2CON_PEN_MASK;			//send a stop condition
+}
+
+//i2c2 isr: master / bus collision events
+void __ISR(_I2C_2_VECTOR) _I2C2Interrupt(void) {
+	I2C_XferTypeDef *x = &_i2c2_q[_i2c2_qtail & I2C_QMASK];
+
+	ISR_ENTER(ISR_I2C2, 0);
+	if (IFS1 & _IFS1_I2C2BIF_MASK) {				//bus collision: the module is back to idle
+		IFS1CLR = _IFS1_I2C2BIF_MASK | _IFS1_I2C2MIF_MASK;
+		I2C2STATCLR = _I2C2STAT_BCL_MASK;
+		_i2c2Done(I2C_ERR_BCL);
+		ISR_EXIT(ISR_I2C2);
+		return;
+	}
+	IFS1CLR = _IFS1_I2C2MIF_MASK;				//clear the flag
+	_i2c2_t0 = coreticks();
+	switch (_i2c2_state) {
+	case I2C_S_START:							//start sent -> address
+		if ((x->regn + x->wlen == 0) && x->rlen) {I2C2TRN = (x->addr << 1) | I2C_CMD_READ; _i2c2_state = I2C_S_RADDR;}
+		else {I2C2TRN = (x->addr << 1) | I2C_CMD_WRITE; _i2c2_state = I2C_S_WRITE;}
+		break;
+	case I2C_S_WRITE:							//address+W or data byte sent
+		if (I2C2STATbits.ACKSTAT) {_i2c2Stop(I2C_ERR_NACK); break;}
+		if (_i2c2_idx < x->regn) {I2C2TRN = x->reg; _i2c2_idx++;}	//register address
+		else if (_i2c2_idx < x->regn + x->wlen) {I2C2TRN = x->wbuf[_i2c2_idx - x->regn]; _i2c2_idx++;}	//next byte
+		else if (x->rlen) {I2C2CONSET = _I2C2CON_RSEN_MASK; _i2c2_state = I2C_S_RESTART;}
+		else _i2c2Stop(I2C_OK);
+		break;
+	case I2C_S_RESTART:							//repeated start sent -> address+R
+		_i2c2_idx = 0;
+		I2C2TRN = (x->addr << 1) | I2C_CMD_READ;
+		_i2c2_state = I2C_S_RADDR;
+		break;
+	case I2C_S_RADDR:							//address+R sent
+		if (I2C2STATbits.ACKSTAT) {_i2c2Stop(I2C_ERR_NACK); break;}
+		I2C2CONSET = _I2C2CON_RCEN_MASK;		//receive a byte
+		_i2c2_state = I2C_S_READ;
+		break;
+	case I2C_S_READ:							//byte received -> ack it, nack the last one
+		x->rbuf[_i2c2_idx++] = I2C2RCV;
+		I2C2CONbits.ACKDT = (_i2c2_idx < x->rlen) ? I2C_ACK : I2C_NOACK;
+		I2C2CONSET = _I2C2CON_ACKEN_MASK;
+		_i2c2_state = I2C_S_ACK;
+		break;
+	case I2C_S_ACK:								//ack / nack sent
+		if (_i2c2_idx < x->rlen) {I2C2CONSET = _I2C2CON_RCEN_MASK; _i2c2_state = I2C_S_READ;}
+		else _i2c2Stop(I2C_OK);
+		break;
+	case I2C_S_STOP:							//stop sent
+		_i2c2Done(_i2c2_status);
+		break;
+	default: break;								//not ours - blocking calls
+	}
+	ISR_EXIT(ISR_I2C2);
+}
+
+//queue a transaction, with an optional register address (regn=1) ahead of wbuf
+static uint8_t _i2c2Queue(uint8_t addr, uint8_t regn, uint8_t reg, const uint8_t *wbuf, uint16_t wlen, uint8_t *rbuf, uint16_t rlen, void (*callback)(uint8_t status), volatile uint8_t *status) {
+	I2C_XferTypeDef *x;
+	uint32_t ie;
+
+	if ((uint8_t) (_i2c2_qhead - _i2c2_qtail) >= I2C_QSIZE) return 0;	//queue full
+	x = &_i2c2_q[_i2c2_qhead & I2C_QMASK];
+	x->addr = addr; x->regn = regn; x->reg = reg;
+	x->wbuf = wbuf; x->wlen = wlen; x->rbuf = rbuf; x->rlen = rlen; x->callback = callback; x->status = status;
+
+	ie = IEC1 & I2C2_IEMASK;					//hold off the isr
+	IEC1CLR = I2C2_IEMASK;
+	_i2c2_qhead += 1;
+	if (_i2c2_state == I2C_S_IDLE) _i2c2Next();	//engine idle -> start now
+	else IEC1SET = ie;
+	return 1;
+}
+
+//queue a transaction
+uint8_t i2c2Xfer(uint8_t addr, const uint8_t *wbuf, uint16_t wlen, uint8_t *rbuf, uint16_t rlen, void (*callback)(uint8_t status)) {
+	return _i2c2Queue(addr, 0, 0, wbuf, wlen, rbuf, rlen, callback, NULL);
+}
+
+//number of transactions pending
+//aborts the current transaction if the bus has made no progress for I2C_TIMEOUT ms
+uint8_t i2c2XferBusy(void) {
+	uint32_t ie = IEC1 & I2C2_IEMASK;
+
+	IEC1CLR = I2C2_IEMASK;						//hold off the isr
+	if ((_i2c2_state != I2C_S_IDLE) && (coreticks() - _i2c2_t0 > I2C_TIMEOUT * cyclesPerMillisecond())) {
+		I2C2CONbits.ON = 0;						//reset the module - releases the bus
+		I2C2CONbits.ON = 1;
+		_i2c2Done(I2C_ERR_TIMEOUT);
+	} else IEC1SET = ie;
+	return _i2c2_qhead - _i2c2_qtail;
+}
+
+//status of the last completed transaction
+uint8_t i2c2XferStatus(void) {
+	return _i2c2_status;
+}
+
+//queue a transaction and wait for it to complete
+//returns its own status, not that of whatever was queued behind it
+static uint8_t _i2c2XferSync(uint8_t addr, uint8_t regn, uint8_t reg, const uint8_t *wbuf, uint16_t wlen, uint8_t *rbuf, uint16_t rlen) {
+	volatile uint8_t status = I2C_PENDING;
+
+	while (_i2c2Queue(addr, regn, reg, wbuf, wlen, rbuf, rlen, NULL, &status) == 0) i2c2XferBusy();	//queue full
+	while (status == I2C_PENDING) i2c2XferBusy();	//also runs the timeout
+	return status;
+}
+
+//write n bytes to consecutive registers from reg, in one transaction
+uint8_t i2c2WriteReg(uint8_t addr, uint8_t reg, const uint8_t *buf, uint16_t n) {
+	return _i2c2XferSync(addr, 1, reg, buf, n, NULL, 0);
+}
+
+//read n bytes from consecutive registers from reg, in one transaction
+uint8_t i2c2ReadReg(uint8_t addr, uint8_t reg, uint8_t *buf, uint16_t n) {
+	return _i2c2XferSync(addr, 1, reg, NULL, 0, buf, n);
+}
+
+//probe addresses 0x08..0x77, store the ones that ack in found[]
+//returns the number of devices found
+uint8_t i2c2Scan(uint8_t *found, uint8_t max) {
+	uint8_t addr, cnt=0;
+
+	for (addr=0x08; (addr < 0x78) && (cnt < max); addr++)
+		if (_i2c2XferSync(addr, 0, 0, NULL, 0, NULL, 0) == I2C_OK) found[cnt++] = addr;
+	return cnt;
+}
+
 //i2c2
 //wait for i2c
 #define i2c2Wait()		do {while (I2C2CON & 0x1f); while (I2C2STATbits.TRSTAT);} while (0)		//wait for i2c2
 
 //#define F_I2C2			100000ul		//I2C frequency
+//brg from the bus speed at the current clock
+static uint32_t _i2c2_bps=100000ul;	//bus speed
+static void _i2c2Rebase(void) {
+	I2C2BRG = F_PHB / 2 / _i2c2_bps - 1 - (F_PHB / 2 / 10000000ul);	//TPGOB = 130ns, minimum of 4
+	if (I2C2BRG < 0x04) I2C2BRG = 0x04;	//values 0..3 prohibited
+}
+
 //initialize the i2c
 void i2c2Init(uint32_t bps) {
-	PMD5bits.I2C2MD = 0;				//0->enable the module, 1->disable the module
+	_pmdInit(PMD_I2C2);				//0->enable the module, 1->disable the module
 	I2C2CON = 0;						//reset i2c
-	I2C2BRG = F_PHB / 2 / bps - 1 - (F_PHB / 2 / 10000000ul);	//TPGOB = 130ns
-	if (I2C2BRG < 0x04) I2C2BRG = 0x04;	//values 0x00-0x03 prohibited
+	_i2c2_bps = bps;
+	_i2c2Rebase();						//set the brg
+	SystemCoreClockNotify(_i2c2Rebase);	//and again after each clock change
+	_i2c2_qhead = _i2c2_qtail = 0;		//empty the transaction queue
+	_i2c2_state = I2C_S_IDLE;
+	IEC1CLR = I2C2_IEMASK;				//engine isr enabled while transactions are pending
+	IPC9bits.I2C2IP = I2C_IPDEFAULT;		//interrupt priority
+	IPC9bits.I2C2IS = I2C_ISDEFAULT;		//interrupt sub-priority
 	I2C2CONbits.ON = 1;					//1->turn on the i2c, 0->turn off the i2c
 }
 
+//turn off the i2c: wait for the pending transactions, power down
+void i2c2Deinit(void) {
+	while (i2c2XferBusy()) continue;	//queue drained
+	IEC1CLR = I2C2_IEMASK;				//engine off
+	I2C2CONbits.ON = 0;					//1->turn on the i2c, 0->turn off the i2c
+	_pmdDeinit(PMD_I2C2);				//power down the module
+}
+
 //send a start condition
 void i2c2Start(void) {
 	i2c2Wait();
@@ -2693,8 +5668,8 @@ unsigned char i2c2Write(unsigned char dat) {
 	//while (I2C2STATbits.TRSTAT == 1) continue;	// Wait until transmit buffer is empty
 	while (I2C2STATbits.TBF == 1) continue;		// Wait until transmit buffer is empty
 	//i2c2Wait();								//wait for i2c bus to idle
-	while (I2C2STATbits.ACKSTAT == 1) continue;	//wait for the ack signal
-	return I2C2STATbits.ACKSTAT; 				// Wait until ACK is received
+	while (I2C2STATbits.TRSTAT == 1) continue;	//wait for the 9th clock (ack) to complete
+	return I2C2STATbits.ACKSTAT; 				//0->ack, 1->nack
 }
 
 //read i2c
@@ -2726,7 +5701,7 @@ unsigned char i2c2Read(unsigned char ack) {
 //initialize the RTCC
 //Need to turn on FSOSCEN fuse bit
 void RTCCInit(void) {
-	PMD6bits.RTCCMD = 0;						//enable power to RTCC
+	_pmdInit(PMD_RTCC);						//enable power to RTCC
 	RTCC_WREN();								//allows write to rtc registers
 	//RTCCON |= 1<<15;							//start the RTCC
 	RTCCONbits.ON=1;
@@ -2784,25 +5759,51 @@ void (* _cnb_isrptr) (void)=empty_handler;
 void (* _cnc_isrptr) (void)=empty_handler;
 #endif
 
-void __ISR(_CHANGE_NOTICE_VECTOR) _CNInterrupt(void) {
+#if defined(CNA_HANDLER)
+#define CN_DIRECT
+#else
+#define CNA_HANDLER()		_cna_isrptr()
+#endif
+#if defined(CNB_HANDLER)
+#define CN_DIRECT
+#else
+#define CNB_HANDLER()		_cnb_isrptr()
+#endif
+#if defined(_PORTC)
+#if defined(CNC_HANDLER)
+#define CN_DIRECT
+#else
+#define CNC_HANDLER()		_cnc_isrptr()
+#endif
+#endif
+#if defined(CN_DIRECT) || !defined(USE_ISR_DIRECT)
+#if defined(CN_ISRIPL)
+#define CN_ISR		__ISR(_CHANGE_NOTICE_VECTOR, CN_ISRIPL)
+#else
+#define CN_ISR		__ISR(_CHANGE_NOTICE_VECTOR)
+#endif
+void CN_ISR _CNInterrupt(void) {
+	ISR_ENTER(ISR_CN, 0);
 	if (IFS1bits.CNAIF) {
 		PORTA;    //run the isr
 		IFS1bits.CNAIF = 0;
-		_cna_isrptr();
+		CNA_HANDLER();
 	}
 	if (IFS1bits.CNBIF) {
 		PORTB;    //run the isr
 		IFS1bits.CNBIF = 0;
-		_cnb_isrptr();
+		CNB_HANDLER();
 	}
 #if defined(_PORTC)
 	if (IFS1bits.CNCIF) {
 		PORTC;    //run the isr
 		IFS1bits.CNCIF = 0;
-		_cnc_isrptr();
+		CNC_HANDLER();
 	}
 #endif
+	ISR_EXIT(ISR_CN);
 }
+#endif	//CN_DIRECT
 
 //initialize change notification
 void cnaInit(uint16_t pins) {
@@ -2820,14 +5821,19 @@ void cnaInit(uint16_t pins) {
 	GPIOA->CNCON |= (1<<15);					//0->disable cn, 1->enable cn
 }
 
+#if defined(CN_DIRECT) || !defined(USE_ISR_DIRECT)
 //attach user isr
-void cnaAttachISR(void (*isrptr) (void)) {
+void cnaAttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub) {
+#if defined(CN_ISRIPL)
+	if (ipl != ISRIPL_PRIO(CN_ISRIPL)) return;		//the vector is built for another priority: leave it off
+#endif
 	_cna_isrptr = isrptr;						//point the isrptr
 	IFS1bits.CNAIF= 0;							//0->clear the flag
 	IEC1bits.CNAIE= 1;							//0->disable the interrupt
-	IPC8bits.CNIP = CN_IPDEFAULT;				//interrupt priority.
-	IPC8bits.CNIS = CN_ISDEFAULT;				//interrupt sur-priority
+	IPC8bits.CNIP = ipl;				//interrupt priority.
+	IPC8bits.CNIS = sub;				//interrupt sur-priority
 }
+#endif
 
 //initialize change notification
 void cnbInit(uint16_t pins) {
@@ -2843,14 +5849,19 @@ void cnbInit(uint16_t pins) {
 	GPIOB->CNCON |= (1<<15);					//0->disable cn, 1->enable cn
 }
 
+#if defined(CN_DIRECT) || !defined(USE_ISR_DIRECT)
 //attach user isr
-void cnbAttachISR(void (*isrptr) (void)) {
+void cnbAttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub) {
+#if defined(CN_ISRIPL)
+	if (ipl != ISRIPL_PRIO(CN_ISRIPL)) return;		//the vector is built for another priority: leave it off
+#endif
 	_cnb_isrptr = isrptr;						//point the isrptr
 	IFS1bits.CNBIF= 0;							//0->clear the flag
 	IEC1bits.CNBIE= 1;							//0->disable the interrupt
-	IPC8bits.CNIP = CN_IPDEFAULT;				//interrupt priority.
-	IPC8bits.CNIS = CN_ISDEFAULT;				//interrupt sur-priority
+	IPC8bits.CNIP = ipl;				//interrupt priority.
+	IPC8bits.CNIS = sub;				//interrupt sur-priority
 }
+#endif
 
 #if defined(_PORTC)
 //initialize change notification
@@ -2867,14 +5878,19 @@ void cncInit(uint16_t pins) {
 	GPIOC->CNCON |= (1<<15);					//0->disable cn, 1->enable cn
 }
 
+#if defined(CN_DIRECT) || !defined(USE_ISR_DIRECT)
 //attach user isr
-void cncAttachISR(void (*isrptr) (void)) {
+void cncAttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub) {
+#if defined(CN_ISRIPL)
+	if (ipl != ISRIPL_PRIO(CN_ISRIPL)) return;		//the vector is built for another priority: leave it off
+#endif
 	_cnc_isrptr = isrptr;						//point the isrptr
 	IFS1bits.CNCIF= 0;							//0->clear the flag
 	IEC1bits.CNCIE= 1;							//0->disable the interrupt
-	IPC8bits.CNIP = CN_IPDEFAULT;				//interrupt priority.
-	IPC8bits.CNIS = CN_ISDEFAULT;				//interrupt sur-priority
+	IPC8bits.CNIP = ipl;				//interrupt priority.
+	IPC8bits.CNIS = sub;				//interrupt sur-priority
 }
+#endif
 #endif 	//_PORTC
 //end cnint
 
@@ -2882,7 +5898,7 @@ void cncAttachISR(void (*isrptr) (void)) {
 //initialize the comparator
 void CVrefInit(void) {
 	//enable the module
-	PMD1bits.CVRMD = 0;							//0->enable the module
+	_pmdInit(PMD_CVR);							//0->enable the module
 
 	CVRCON = 0;									//reset the module
 	CVRCONbits.CVRR = 0;						//1->0..0.67CVrsrc, in 24 steps; 0->0.25..0.75CVrsrc in 32 steps
@@ -2897,7 +5913,7 @@ void CVrefInit(void) {
 //comparator
 //initialize comparator
 void CM1Init(void) {
-	PMD2bits.CMP1MD = 0;						//0->enable the module
+	_pmdInit(PMD_CMP1);						//0->enable the module
 
 	CM1CON = 0;									//reset the comparator
 	//output disabled
@@ -2909,7 +5925,7 @@ void CM1Init(void) {
 //comparator
 //initialize comparator
 void CM2Init(void) {
-	PMD2bits.CMP2MD = 0;						//0->enable the module
+	_pmdInit(PMD_CMP2);						//0->enable the module
 
 	CM2CON = 0;									//reset the comparator
 	//output disabled
@@ -2921,7 +5937,7 @@ void CM2Init(void) {
 //comparator
 //initialize comparator
 void CM3Init(void) {
-	PMD2bits.CMP3MD = 0;						//0->enable the module
+	_pmdInit(PMD_CMP3);						//0->enable the module
 
 	CM3CON = 0;									//reset the comparator
 	//output disabled
@@ -57,6 +57,7 @@
 #error "PIC32Duino.h: unsupported compiler!"
 #endif
 #include <sys/attribs.h>					//attributes for interrupts
+#include <sys/kmem.h>						//KVA_TO_PA() for dma addresses
 #include <stdint.h>							//we use uint types
 #include <string.h>							//we use strcpy()
 
@@ -64,17 +65,28 @@
 //oscillator configuration by user
 //#define USE_MAIN							//use self-defined main() in user code
 //#define USE_SYSTICK							//comment out if you want to use coretick for timing
+//#define USE_PROFILE							//comment out to compile PROFILE_BEGIN()/PROFILE_END() to nothing
+//#define USE_ISRSTATS						//comment out to leave the library isrs uninstrumented
+//#define USE_ISR_DIRECT						//drop the tmr1/3/4/5, oc, int and cn vectors that have no XXX_HANDLER() bound below
+//#define USE_DFS								//comment out to keep the clock fixed. otherwise the dfs governor scales it with the load
+//#define USE_FASTBOOT						//comment out to decode osccon at boot. otherwise the clock comes from F_BOOT
+//#define USE_BOOTTICKS						//comment out to skip the reset -> setup() / loop() timestamps
 #define F_XTAL				20000000ul		//crystal frequency, user-specified
 #define F_SOSC				32768			//SOSC = 32768Hz, user-specified
+#define F_BOOT				F_FRC			//SYSCLK set by the config bits, for USE_FASTBOOT: F_FRC for FNOSC=FRC, F_XTAL/FPLLIDIV*FPLLMUL/FPLLODIV for FNOSC=PRIPLL
 //end user specification
 
 //uart1 pin configuration
 #define U1TX2RP()			PPS_U1TX_TO_RPB3()			//map u1tx pin to an rp pin: A0, B3, B4, B15, B7, C7, C0, C5
 #define U1RX2RP()			PPS_U1RX_TO_RPA2()			//map u1rx pin to an rp pin: A2, B6, A4, B13, B2, C6, C1, C3
+#define U1RX_BUFSIZE		64							//u1rx ring buffer size, power of 2. comment out for polled reception
 
 //uart2 pin configuration
 #define U2TX2RP()			PPS_U2TX_TO_RPB0()			//u2tx pin: A3, B14, B0, B10, B9, C9, C2, C4
 #define U2RX2RP()			PPS_U2RX_TO_RPA1()			//u2rx pin: A1, B5, B1, B11, B8, A8, C8, A9
+#define U2TX_BUFSIZE		64							//u2tx ring buffer size, power of 2. comment out for polled transmission
+#define U2TX_OVERFLOW		UART_OVF_BLOCK				//when u2tx buffer is full: UART_OVF_BLOCK, UART_OVF_DROPNEW, UART_OVF_DROPOLD
+#define U2RX_BUFSIZE		64							//u2rx ring buffer size, power of 2. comment out for polled reception
 
 //pwm/oc pin configuration
 //#define PWM12RP()			PPS_OC1_TO_RPB7()			//oc1 pin: A0, B3, B4, B15, B7, C7, C0, C5
@@ -89,6 +101,12 @@
 #define IC32RP()			PPS_IC3_TO_RPB8()			//ic3 pin: A1, B5, B1, B11, B8, A8, C8, A9
 #define IC42RP()			PPS_IC4_TO_RPA0()			//ic4 pin: A0, B3, B4, B15, B7, C7, C0, C5
 #define IC52RP()			PPS_IC5_TO_RPA2()			//ic5 pin: A2, B6, A4, B13, B2, C6, C1, C3
+//pins for pulseIn() via input capture: must match ICx2RP() above. comment out to free the module
+#define IC1PIN				PB6
+#define IC2PIN				PA3
+#define IC3PIN				PB8
+#define IC4PIN				PA0
+#define IC5PIN				PA2
 
 //spi
 #define SCK1RP()										//not remappable
@@ -97,6 +115,11 @@
 #define SCK2RP()										//not remappable
 #define SDO2RP()			PPS_SDO2_TO_RPB1()			//sdo1 pin: A1, B5, B1, B11, B8, A8, C8, A9, A2, B6, A4, B13, B2, C6, C1, C3
 #define SDI2RP()			PPS_SDI2_TO_RPA2()			//SDI1 pin: A2, B6, A4, B13, B2, C6, C1, C3
+//pins for shiftOut() over spi: must match SCKxRP()/SDOxRP() above. comment out to always bit-bang
+#define SCK1PIN				PB14						//fixed
+#define SDO1PIN				PB1
+#define SCK2PIN				PB15						//fixed
+#define SDO2PIN				PB1
 
 //extint pin configuration
 //#define INT02RP()			PPS_INT1_TO_RPA3()			//int0 pin: fixed to rp7
@@ -148,7 +171,8 @@
 #define NOP40()				{NOP32(); NOP8();}
 #define NOP64()				{NOP32(); NOP32();}
 
-#define sleep()				asm("sleep")					//put the mcu into sleep
+#define sleep()				do {SYS_UNLOCK(); OSCCONSET = _OSCCON_SLPEN_MASK; SYS_LOCK(); asm volatile ("wait");} while (0)	//put the mcu into sleep: clocks stop
+#define idle()				do {SYS_UNLOCK(); OSCCONCLR = _OSCCON_SLPEN_MASK; SYS_LOCK(); asm volatile ("wait");} while (0)	//put the cpu into idle: peripherals and core timer keep running
 
 #ifndef ei
 #if defined(__XC__)
@@ -160,7 +184,7 @@
 
 #ifndef di
 #if defined(__XC__)
-#define di()				__builtin_enable_interrupts();	//asm volatile ("di")	INTDisableInterrupts()			//__builtin_disable_interrupts()	//
+#define di()				__builtin_disable_interrupts();	//asm volatile ("di")	INTDisableInterrupts()			//__builtin_disable_interrupts()	//
 #else
 #define di()				do {INTDisableInterrupts(); /*INTDisableSystemMultiVectoredInt();*/} while (0)			//__builtin_disable_interrupts()	//
 #endif		//__XC__
@@ -840,6 +864,20 @@ uint32_t SystemCoreClockSwitch(uint8_t nosc);
 #define SystemCoreClockFRC16()		SystemCoreClockSwitch(0b110)
 #define SystemCoreClockFRCDIV()	SystemCoreClockSwitch(0b111)
 
+//flash wait states / predictive prefetch / kseg0 cacheability for SystemCoreClock
+//done by mcuInit() and SystemCoreClockSwitch(). call it after changing the clock any other way
+#define F_FLASH				40000000ul		//fastest SYSCLK per flash wait state: 0 wait states up to 40Mhz
+void SystemPerformanceConfig(void);
+
+//run from the pll at the fastest clock not above hz: picks PLLMULT / PLLODIV / PBDIV and switches
+//the tick conversions and the peripherals registered with SystemCoreClockNotify() follow the new clock
+//uart1/2, spi1/2 and i2c1/2 register themselves in their xxxInit(). don't change the clock in the middle of a transfer
+#define F_SYSMAX			40000000ul		//fastest SYSCLK of the part: 40Mhz or 50Mhz
+#define F_PHBMAX			F_SYSMAX		//fastest peripheral bus clock
+#define CLK_NOTIFYMAX		8				//max number of clock change callbacks
+uint32_t SystemCoreClockSet(uint32_t hz);	//returns SystemCoreClock
+uint8_t SystemCoreClockNotify(void (*fn)(void));	//call fn after each clock change. returns 0 if the list is full
+
 //gpio definitions
 
 //pin enum - matches GPIO_PinDef[]
@@ -946,35 +984,239 @@ void pinMode(PIN_TypeDef pin, uint8_t mode);
 void digitalWrite(PIN_TypeDef pin, uint8_t mode);
 int digitalRead(PIN_TypeDef pin);
 
+//fast gpio: port / mask computed from the pin enum - a constant pin folds to a single LATxSET/LATxCLR/LATxINV store
+//pins are laid out as in GPIO_PinDef[]: PA0..15, PB0..15, PC0..15
+#if defined(_PORTC)
+#define PIN2GPIOx(pin)		(((pin) < PB0) ? GPIOA : (((pin) < PC0) ? GPIOB : GPIOC))
+#else
+#define PIN2GPIOx(pin)		(((pin) < PB0) ? GPIOA : GPIOB)
+#endif
+#define PIN2MASK(pin)		(1ul << ((pin) & 0x0f))
+#define pinSet(pin)			FIO_SET(PIN2GPIOx(pin), PIN2MASK(pin))		//set pin
+#define pinClr(pin)			FIO_CLR(PIN2GPIOx(pin), PIN2MASK(pin))		//clear pin
+#define pinToggle(pin)		FIO_FLP(PIN2GPIOx(pin), PIN2MASK(pin))		//flip pin via LATINV
+#define pinGet(pin)			FIO_GET(PIN2GPIOx(pin), PIN2MASK(pin))		//read pin, 0 or mask
+#define pinOutput(pin)		FIO_OUT(PIN2GPIOx(pin), PIN2MASK(pin))		//pin as output
+#define pinInput(pin)		FIO_IN(PIN2GPIOx(pin), PIN2MASK(pin))		//pin as input
+#define digitalWriteFast(pin, val)	do {if (val) pinSet(pin); else pinClr(pin);} while (0)
+#define digitalReadFast(pin)		(pinGet(pin) ? HIGH : LOW)
+
+//port i/o: pins in mask are written / read / configured together
+void portWrite(GPIO_TypeDef *gpio, uint16_t mask, uint16_t val);	//pins in mask take the corresponding bits in val
+uint16_t portRead(GPIO_TypeDef *gpio, uint16_t mask);				//read pins in mask
+void portMode(GPIO_TypeDef *gpio, uint16_t mask, uint8_t mode);		//INPUT, OUTPUT or INPUT_PULLUP for pins in mask
+
+//pin group: up to PINGRP_MAX pins spread over several ports, bit i of a value <-> pins[i]
+#if defined(_PORTC)
+#define GPIO_PORTS			3			//PA, PB, PC
+#else
+#define GPIO_PORTS			2			//PA, PB
+#endif
+#define PINGRP_MAX			16			//max number of pins in a group
+typedef struct {
+	uint8_t n;							//number of pins
+	uint8_t port[PINGRP_MAX];			//port of pin i: 0->GPIOA, 1->GPIOB, 2->GPIOC
+	uint16_t mask[PINGRP_MAX];			//mask of pin i
+	uint16_t pmask[GPIO_PORTS];			//pins of the group on each port
+} PINGRP_TypeDef;
+void pinGroupInit(PINGRP_TypeDef *grp, const PIN_TypeDef *pins, uint8_t n);	//build a group: pins[0] -> lsb
+void pinGroupWrite(PINGRP_TypeDef *grp, uint16_t val);			//write val to the group, two stores per port at most
+uint16_t pinGroupRead(PINGRP_TypeDef *grp);						//read the group, one read per port
+void pinGroupMode(PINGRP_TypeDef *grp, uint8_t mode);				//INPUT, OUTPUT or INPUT_PULLUP for the group
+
 //time base
-#if defined(USE_SYSTICK)
+//F_TICK: ticks() per second. with USE_DFS ticks() counts F_SYSMAX cycles whatever the clock, so intervals stay valid across clock changes
+#if defined(USE_DFS)
+#define ticks()				dfsticks()			//core timer scaled to F_SYSMAX
+#define F_TICK				F_SYSMAX
+#elif defined(USE_SYSTICK)
 #define ticks()				systicks()			//use tmr2 as tick / systick generator
+#define F_TICK				F_PHB
 #else
 #define ticks()				coreticks()			//use core timer as tick generator
-#endif	//USE_SYSTICK
+#define F_TICK				F_CPU
+#endif	//USE_DFS / USE_SYSTICK
 
 #define coreticks()			(2*_CP0_GET_COUNT())	//core timer advances every 2 ticks
 #define coretick_init()		coretimer_init()		//for compatability with older syntax
 uint32_t systicks(void);							//use tmr2 as systick
-#define millis()			(ticks() / cyclesPerMillisecond())
-#define micros()			(ticks() / cyclesPerMicrosecond())
+uint32_t dfsticks(void);							//F_SYSMAX cycles since reset, continuous across clock changes. with USE_DFS
+
+//tick conversions, recomputed by SystemCoreClockUpdate() on every clock change
+//they convert coreticks() at the current clock - the unit of idleUntil() / delayIdle() / the scheduler. ticks() too, except with USE_DFS: use F_TICK there
+//x * num / den is done as (x * mul) >> sh: no divisions at run time
+typedef struct {
+	uint32_t mul;								//multiplier
+	uint8_t sh;									//right shift
+} TIME_RecipTypeDef;
+extern TIME_RecipTypeDef _time_tick2us, _time_tick2ms, _time_us2tick, _time_ms2tick;
+extern uint32_t _time_cpus, _time_cpms;			//F_CPU / 1000000, F_CPU / 1000
+#define TIME_RECIP(x, r)	((uint32_t) (((uint64_t) (x) * (r).mul) >> (r).sh))
+#define ticks2us(t)			TIME_RECIP(t, _time_tick2us)	//ticks -> us
+#define ticks2ms(t)			TIME_RECIP(t, _time_tick2ms)	//ticks -> ms
+#define us2ticks(us)		TIME_RECIP(us, _time_us2tick)	//us -> ticks
+#define ms2ticks(ms)		TIME_RECIP(ms, _time_ms2tick)	//ms -> ticks
+#if defined(USE_DFS)
+#define millis()			((uint32_t) millis64())			//continuous across the governor's clock changes
+#define micros()			((uint32_t) micros64())
+#else
+#define millis()			ticks2ms(ticks())
+#define micros()			ticks2us(ticks())
+#endif	//USE_DFS
 void delay(uint32_t ms);
 void delayMicroseconds(uint32_t us);
-#define cyclesPerMicrosecond()			(F_CPU / 1000000ul)
-#define cyclesPerMillisecond()			(F_CPU / 1000)
+
+//64-bit time base: coreticks() extended to 64 bits, never wraps
+//the high word advances on every ticks64() / micros64() / millis64() read, every tmr2 interrupt and every core timer interrupt:
+//one of them at least once per coreticks() wrap (~107s at 40Mhz) keeps it exact, tmr2Init() / tmr23Init() leave it intact
+//micros64()/millis64() stay monotonic across clock changes, as long as SystemCoreClockUpdate() is called after each change
+uint64_t ticks64(void);							//64-bit coreticks()
+uint64_t micros64(void);						//microseconds since reset
+uint64_t millis64(void);						//milliseconds since reset
+
+//low power: idle the cpu until a core timer deadline
+//idleUntil() takes over the core timer compare - don't combine with coretimer_setpr()/schedAttachCoreTimer()
+//deadlines are in ticks: a clock change (from an isr) while one is pending moves it in time. dfsRun() steps the clock between loop()s, with none pending
+#define IDLE_LATENCY		40			//initial wake-up latency estimate, in ticks. refined on every wake-up
+#define IDLE_MIN			200			//deadlines closer than this (plus the latency) are spun out
+uint8_t idleUntil(uint32_t t);					//idle until coreticks() reaches t or another interrupt wakes the cpu. returns 1 if t was reached
+void delayIdle(uint32_t ms);					//delay() that idles the cpu in between
+#define cyclesPerMicrosecond()			(_time_cpus)
+#define cyclesPerMillisecond()			(_time_cpms)
+
+//scheduler: timer wheel on coreticks()
+//run schedRun() from loop(), or schedAttachCoreTimer() to run it from the core timer isr - not both
+//periods / delays in ticks, rounded up to SCHED_JIFFY, up to 2^31 ticks
+//after a clock change through SystemCoreClockSwitch() / SystemCoreClockSet() the pending delays and the periods are rescaled: tasks keep their timing
+#define SCHED_MAX			16			//max number of scheduled tasks, up to 254
+#define SCHED_SHIFT			12			//wheel resolution: 2^SCHED_SHIFT ticks per slot (~100us at 40Mhz)
+#define SCHED_JIFFY			(1ul << SCHED_SHIFT)
+#define SCHED_NONE			0xff		//invalid task id
+uint8_t schedEvery(uint32_t period, void (*fn)(void));	//run fn every period ticks, returns the task id or SCHED_NONE
+uint8_t schedAfter(uint32_t dly, void (*fn)(void));		//run fn once after dly ticks, returns the task id or SCHED_NONE
+void schedCancel(uint8_t id);					//remove a task
+void schedRun(void);							//run the tasks that are due
+void schedIdle(void);							//idle until the next task is due (or an interrupt), then run the tasks that are due
+#define schedAttachCoreTimer()	do {coretimer_setpr(SCHED_JIFFY); coretimerAttachISR(schedRun);} while (0)
+
+//profiler: per-region statistics in coreticks(), with the cost of PROFILE_BEGIN()/PROFILE_END() taken out
+//PROFILE_BEGIN(id); ...code to measure...; PROFILE_END(id); id = 0..PROFILE_MAX-1
+//works in loop() and in isrs, as long as a region isn't entered again (nested or from an isr) before it ends
+#define PROFILE_MAX			8			//number of regions
+typedef struct {
+	uint32_t t0;						//start of the current run
+	uint32_t cnt;						//number of runs
+	uint32_t min, max;					//shortest / longest run, in ticks
+	uint64_t sum;						//total, in ticks. mean = sum / cnt
+} PROFILE_TypeDef;
+#if defined(USE_PROFILE)
+extern PROFILE_TypeDef _profile[PROFILE_MAX];
+#define PROFILE_BEGIN(id)	do {_profile[id].t0 = coreticks();} while (0)
+#define PROFILE_END(id)		_profileEnd(id, coreticks())	//timestamp first, then book-keeping
+#else
+#define PROFILE_BEGIN(id)
+#define PROFILE_END(id)
+#endif	//USE_PROFILE
+void _profileEnd(uint8_t id, uint32_t t1);		//close a run of region id - use PROFILE_END()
+void profileReset(void);						//clear all regions and measure the overhead. done by mcuInit()
+void profileReport(void (*putch)(char));		//csv dump of the active regions: id,count,min,max,mean - e.g. profileReport(uart2Putch)
+
+//isr statistics: per-vector count, longest run and worst entry latency, in coreticks()
+//recorded by every library isr with USE_ISRSTATS defined
+//latency is taken from the hardware event where the isr can see it: core timer compare, tmr1-5 period match, oc1-5 match on tmr2. 0 elsewhere
+//run time covers the isr body and the user handler, not the compiler's context save / restore
+typedef struct {
+	uint32_t cnt;						//number of runs
+	uint32_t dur;						//longest run, in ticks
+	uint32_t lat;						//worst entry latency, in ticks
+} ISR_StatTypeDef;
+#define ISR_CT				0			//core timer
+#define ISR_U1				1
+#define ISR_U2				2
+#define ISR_T1				3
+#define ISR_T2				4
+#define ISR_T3				5
+#define ISR_T4				6
+#define ISR_T5				7
+#define ISR_ADC				8
+#define ISR_OC1				9
+#define ISR_OC2				10
+#define ISR_OC3				11
+#define ISR_OC4				12
+#define ISR_OC5				13
+#define ISR_IC1				14
+#define ISR_IC2				15
+#define ISR_IC3				16
+#define ISR_IC4				17
+#define ISR_IC5				18
+#define ISR_INT0			19
+#define ISR_INT1			20
+#define ISR_INT2			21
+#define ISR_INT3			22
+#define ISR_INT4			23
+#define ISR_DMA0			24
+#define ISR_DMA1			25
+#define ISR_DMA2			26
+#define ISR_DMA3			27
+#define ISR_SPI1			28
+#define ISR_SPI2			29
+#define ISR_I2C1			30
+#define ISR_I2C2			31
+#define ISR_CN				32			//change notification
+#define ISR_MAX				33
+#if defined(USE_ISRSTATS)
+volatile ISR_StatTypeDef *isrStats(uint8_t v);	//statistics of vector v, ISR_xxx
+void isrStatsReset(void);						//clear all statistics
+void isrReport(void (*putch)(char));			//csv dump of the vectors that have run: isr,count,max,lat - e.g. isrReport(uart2Putch)
+#endif	//USE_ISRSTATS
+
+//dfs governor: steps the clock between the DFS_OPP operating points with the load, with USE_DFS defined
+//load = time outside idle() over a DFS_WINDOW window: loop() and the isrs. loop() has to idle for the load to drop -
+//delayIdle() / idleUntil() / schedIdle(), not delay()
+//above DFS_UP: one point faster at once. below DFS_DOWN for DFS_HOLD windows: one point slower, if the load stays under DFS_UP there
+//each step goes through SystemCoreClockSet() (SystemCoreClockFRC() for F_FRC): the uarts / spis / i2cs are rebased,
+//millis() / micros() / delay() follow the new clock, the scheduler's tasks and the core timer period are rescaled
+//ticks() counts F_SYSMAX cycles (F_TICK per second) whatever the clock. coreticks() and tmr2 / pwm change rate with the clock
+//main() runs dfsRun() after each loop() - call it from your own loop if USE_MAIN is defined
+#define DFS_OPP				{40000000ul, 20000000ul, 10000000ul, F_FRC}	//operating points, fastest first
+#define DFS_WINDOW			100			//load measurement window, in ms
+#define DFS_UP				80			//load (%) to step up
+#define DFS_DOWN			30			//load (%) to step down
+#define DFS_HOLD			4			//windows below DFS_DOWN before stepping down
+void dfsRun(void);								//measure the load and change the clock if needed
+uint8_t dfsLoad(void);							//load over the last window, in %
+uint8_t dfsLevel(void);							//current operating point, 0 = fastest
 
 //advanced IO
 //void tone(void);									//tone frequency specified by F_TONE in STM8Sduino.h
 //void noTone(void);
 //shiftin/out: bitOrder = MSBFIRST or LSBFIRST
+//data changes while clock is low, clock pulses high
+//shiftOut() goes through spix if dataPin/clockPin are SDOxPIN/SCKxPIN and spix is on as a master with an idle-low clock (CKP=0):
+//spix is switched to 8-bit mode 0 (CKE=1) for the transfer and its mode is restored afterwards
 uint8_t shiftIn(PIN_TypeDef dataPin, PIN_TypeDef clockPin, uint8_t bitOrder);
 void shiftOut(PIN_TypeDef dataPin, PIN_TypeDef clockPin, uint8_t bitOrder, uint8_t val);
+void shiftOutBuffer(PIN_TypeDef dataPin, PIN_TypeDef clockPin, uint8_t bitOrder, const uint8_t *buf, uint16_t len);	//shift out len bytes, buf[0] first - for 74HC595 chains
+//constant pins: direct LATxSET/LATxCLR stores
+#define shiftOutFast(dataPin, clockPin, bitOrder, val)	do {uint8_t _i; for (_i=0; _i<8; _i++) {digitalWriteFast(dataPin, ((bitOrder)==MSBFIRST)?((val) & (0x80>>_i)):((val) & (1<<_i))); pinSet(clockPin); pinClr(clockPin);}} while (0)
+//pulseIn(): pulse width in us, 0 on timeout. input capture if pin is an ICxPIN, polling otherwise
+//pulseMeasureStart(): arm input capture on pin for one pulse of state, returns 0 if pin is not an ICxPIN
+//or if ICx_HANDLER() is defined for its module: that vector runs the user's handler, never the pulse measurement's
+//pulseMeasureResult(): pulse width in tmr2 ticks (1/F_PHB), 0 if not yet complete
+#define PULSE_TIMEOUT		1000000ul					//pulseIn() timeout, in us
 uint32_t pulseIn(PIN_TypeDef pin, uint8_t state);		//wait for a pulse and return timing
+uint8_t pulseMeasureStart(PIN_TypeDef pin, uint8_t state);
+uint32_t pulseMeasureResult(PIN_TypeDef pin);
 
 //pwm output
-//dc = 0x00..0x0fff for pwm2/3/4/5, 0x00..0xffff for pwm1
-//RP4=PWM1, RP12=PWM2, RP13=PWM3, RP14=PWM4, RP15=PWM5
-void analogWrite(uint8_t pin, uint16_t dc);
+//dc = 0x00..PWM_PR, on tmr2
+//the first call on a pin maps it to a free oc1..5 that can reach it and starts the pwm; later calls write OCxRS only
+//an oc a driver holds (pwmxInit() / ocxInit() / pmdOn(), or OCxCON.ON set) is never taken: the pin gets no pwm if no other oc reaches it
+//oc1: A0, B3, B4, B15, B7, C7, C0, C5
+//oc2: A1, B5, B1, B11, B8, A8, C8, A9
+//oc3: A3, B14, B0, B10, B9, C9, C2, C4
+//oc4/oc5: A2, B6, A4, B13, B2, C6, C1, C3
+void analogWrite(PIN_TypeDef pin, uint16_t dc);
 
 //analog read on ADC1
 //read DRL first for right aligned results
@@ -1002,15 +1244,113 @@ void analogWrite(uint8_t pin, uint16_t dc);
 //core timer
 //initialize core timer - used for ticks()
 void coretimer_init(void);
-//set core timer period
+//set core timer period, in ticks. rescaled after a clock change through SystemCoreClockSwitch() / SystemCoreClockSet(): the isr keeps its rate
 uint32_t coretimer_setpr(uint32_t pr);
 uint32_t coretimer_getpr();
+//interrupt priorities: xxxAttachISR() uses the module's _IPDEFAULT / _ISDEFAULT, xxxAttachISRPrio() takes them per isr
+//with XXX_ISRIPL defined, xxxAttachISR() uses the priority it names and xxxAttachISRPrio() at any other ipl leaves the interrupt off
+//isr context save: define XXX_ISRIPL (e.g. TMR1_ISRIPL) to compile that isr as __ISR(vector, XXX_ISRIPL)
+//IPLnSRS: shadow register set, no context save - the vector must run at priority n, and the shadow set serves ipl7 only on PIC32MX1xx/2xx
+//IPLnAUTO: the compiler checks for the shadow set on entry. otherwise the compiler's default software context save is used
+//direct dispatch: define XXX_HANDLER() (e.g. TMR1_HANDLER()) to have the vector run it in place of the pointer set by xxxAttachISR()
+//a function-like macro with the handler's code is expanded in the vector itself - no call, no caller-saved register spill
+//or bind a function: #define TMR1_HANDLER()	tmr1_handler() - a direct call, and declare tmr1_handler() here
+//xxxAttachISR() / xxxAttachISRPrio() of a vector USE_ISR_DIRECT dropped don't compile - nothing would service the interrupt they enable
+#define ISR_DROPPED(vec)	do {typedef char vec##_VECTOR_DROPPED_BY_USE_ISR_DIRECT[-1];} while (0)
+//priority an XXX_ISRIPL builds the vector for: ISRIPL_PRIO(IPL7SRS) = 7
+#define ISRIPL_PRIO(isripl)	_ISRIPL_PRIO(isripl)
+#define _ISRIPL_PRIO(isripl)	_ISRIPL_##isripl
+#define _ISRIPL_IPL1SOFT	1
+#define _ISRIPL_IPL1SRS	1
+#define _ISRIPL_IPL1AUTO	1
+#define _ISRIPL_ipl1		1
+#define _ISRIPL_IPL2SOFT	2
+#define _ISRIPL_IPL2SRS	2
+#define _ISRIPL_IPL2AUTO	2
+#define _ISRIPL_ipl2		2
+#define _ISRIPL_IPL3SOFT	3
+#define _ISRIPL_IPL3SRS	3
+#define _ISRIPL_IPL3AUTO	3
+#define _ISRIPL_ipl3		3
+#define _ISRIPL_IPL4SOFT	4
+#define _ISRIPL_IPL4SRS	4
+#define _ISRIPL_IPL4AUTO	4
+#define _ISRIPL_ipl4		4
+#define _ISRIPL_IPL5SOFT	5
+#define _ISRIPL_IPL5SRS	5
+#define _ISRIPL_IPL5AUTO	5
+#define _ISRIPL_ipl5		5
+#define _ISRIPL_IPL6SOFT	6
+#define _ISRIPL_IPL6SRS	6
+#define _ISRIPL_IPL6AUTO	6
+#define _ISRIPL_ipl6		6
+#define _ISRIPL_IPL7SOFT	7
+#define _ISRIPL_IPL7SRS	7
+#define _ISRIPL_IPL7AUTO	7
+#define _ISRIPL_ipl7		7
+#define CT_IPDEFAULT		2
+#define CT_ISDEFAULT		0
+//#define CT_ISRIPL			IPL7SRS		//with coretimerAttachISRPrio(isr, 7, 0)
+//#define CT_HANDLER()		ct_handler()	//runs in the core timer vector, after the compare is advanced
 //install core timer isr
-void coretimerAttachISR(void (*isrptr)(void));
+void coretimerAttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub);	//activate the isr handler at priority ipl (1-7), sub-priority sub (0-3)
+#if defined(CT_ISRIPL)
+#define coretimerAttachISR(isrptr)	coretimerAttachISRPrio(isrptr, ISRIPL_PRIO(CT_ISRIPL), CT_ISDEFAULT)
+#else
+#define coretimerAttachISR(isrptr)	coretimerAttachISRPrio(isrptr, CT_IPDEFAULT, CT_ISDEFAULT)
+#endif
 
 //reset the mcu
+//with USE_FASTBOOT: FPBDIV is 1:1 in the config bits so PBDIV isn't unlocked and rewritten, SystemCoreClock = F_BOOT
+//without the osccon decode, the flash is tuned first and the pmd registers are written once
+//the peripherals are powered up by their xxxInit(), tmr2 (pwm / systick / ticks64()) is the only one on from the start
 void mcuInit(void);
 
+//boot time, with USE_BOOTTICKS defined: coreticks() from the reset vector, at the clock(s) of the time
+//the core timer is zeroed in _on_reset() - don't define your own
+extern uint32_t _boot_setup, _boot_loop;
+#define bootTicksSetup()	(_boot_setup)	//reset -> setup()
+#define bootTicksLoop()		(_boot_loop)	//reset -> first loop()
+
+//peripheral power: reference counted PMD bits
+//pmdOn() powers a module up with the first reference, pmdOff() powers it down with the last one
+//xxxInit() takes one reference for its driver however often it runs. xxxDeinit() stops the module, disconnects its
+//pps outputs and drops that reference. pps inputs are left mapped: they don't drive the pin
+//mcuInit() holds a reference on tmr2 for pwm / systick / ticks64()
+#define PMD_AD1				0
+#define PMD_CMP1			1
+#define PMD_CMP2			2
+#define PMD_CMP3			3
+#define PMD_CVR				4
+#define PMD_IC1				5
+#define PMD_IC2				6
+#define PMD_IC3				7
+#define PMD_IC4				8
+#define PMD_IC5				9
+#define PMD_OC1				10
+#define PMD_OC2				11
+#define PMD_OC3				12
+#define PMD_OC4				13
+#define PMD_OC5				14
+#define PMD_T1				15
+#define PMD_T2				16
+#define PMD_T3				17
+#define PMD_T4				18
+#define PMD_T5				19
+#define PMD_U1				20
+#define PMD_U2				21
+#define PMD_SPI1			22
+#define PMD_SPI2			23
+#define PMD_I2C1			24
+#define PMD_I2C2			25
+#define PMD_RTCC			26
+#define PMD_MAX				27
+void pmdOn(uint8_t id);							//take a reference on module id, PMD_xxx. powers it up with the first one
+void pmdOff(uint8_t id);						//drop a reference on module id. powers it down with the last one
+uint8_t pmdRefs(uint8_t id);					//references held on module id
+uint32_t pmdPowered(void);						//bit id set -> module id powered, read from the PMD registers
+void pmdReport(void (*putch)(char));			//csv dump of the powered modules: module,refs - e.g. pmdReport(uart2Putch)
+
 //empty interrupt handler
 void empty_handler(void);
 
@@ -1028,13 +1368,33 @@ void empty_handler(void);
 #define UART_BR57600		57600ul		//buadrate=57600
 #define UART_BR115200		115200ul	//buadrate=115200
 
+//uart interrupt priority - tx/rx buffers
+#define UART_IPDEFAULT		3
+#define UART_ISDEFAULT		0
+
+//tx buffer overflow policy
+#define UART_OVF_BLOCK		0			//wait for the isr to free up space
+#define UART_OVF_DROPNEW	1			//discard the new char
+#define UART_OVF_DROPOLD	2			//discard the oldest char in the buffer
+
+//rx error counters
+typedef struct {
+	uint32_t OERR;						//receive buffer overruns - hardware fifo overflowed
+	uint32_t FERR;						//framing errors
+	uint32_t PERR;						//parity errors
+	uint32_t DROPPED;					//chars lost because the rx ring buffer was full
+} UART_ErrTypeDef;
+
 //for uart1
 void uart1Init(unsigned long baud_rate);	//initiate the hardware usart
+void uart1Deinit(void);					//wait for tx to finish, then turn off the usart
 void uart1Putch(char ch);					//send a char
 void uart1Puts(char *str);					//send a string
 void uart1Putline(char *ln);				//send a string + line return
 uint8_t uart1Getch(void);					//read a char from usart
-uint16_t uart1Available(void);				//test if data rx is available
+uint16_t uart1Available(void);				//number of chars received
+uint16_t uart1Read(uint8_t *buf, uint16_t n);	//read up to n chars, return the number of chars read
+volatile UART_ErrTypeDef *uart1Errors(void);	//rx error counters
 uint16_t uart1Busy(void);					//test if uart tx is busy
 void u1Print(char *str, int32_t dat);		//print to uart1
 #define u1Println()			uart1Puts("\r\n")
@@ -1045,12 +1405,16 @@ void u1Print(char *str, int32_t dat);		//print to uart1
 
 //for uart2
 void uart2Init(unsigned long baud_rate);	//initiate the hardware usart
+void uart2Deinit(void);					//wait for tx to finish, then turn off the usart
 void uart2Putch(char ch);					//send a char
 void uart2Puts(char *str);					//send a string
 void uart2Putline(char *ln);				//send a string + line return
 uint8_t uart2Getch(void);					//read a char from usart
-uint16_t uart2Available(void);				//test if data rx is available
+uint16_t uart2Available(void);				//number of chars received
+uint16_t uart2Read(uint8_t *buf, uint16_t n);	//read up to n chars, return the number of chars read
+volatile UART_ErrTypeDef *uart2Errors(void);	//rx error counters
 uint16_t uart2Busy(void);					//test if uart tx is busy
+uint32_t uart2TxDropped(void);				//number of chars dropped on tx buffer overflow
 void u2Print(char *str, int32_t dat);		//print to uart2
 #define u2Println()			uart2Puts("\r\n")
 //for compatability
@@ -1080,22 +1444,70 @@ void u2Print(char *str, int32_t dat);		//print to uart2
 
 #define TMR_IPDEFAULT		2
 #define TMR_ISDEFAULT		0
+//#define TMR1_ISRIPL		IPL7SRS		//with tmr1AttachISRPrio(isr, 7, 0). TMR2_ISRIPL .. TMR5_ISRIPL likewise
+//#define TMR1_HANDLER()		do {LATBINV = 1<<7;} while (0)	//runs in the tmr1 vector. TMR2_HANDLER() .. TMR5_HANDLER() likewise
 
 void tmr1Init(uint8_t ps, uint16_t period);		//initialize the timer1 (16bit)
-void tmr1AttachISR(void (*isrptr)(void));		//activate the isr handler
-void tmr2Init(uint8_t ps, uint16_t period);		//initialize the timer2 (16bit)
-void tmr2AttachISR(void (*isrptr)(void));		//activate the isr handler
+#if defined(USE_ISR_DIRECT) && !defined(TMR1_HANDLER)
+#define tmr1AttachISRPrio(isrptr, ipl, sub)	ISR_DROPPED(TMR1)	//the tmr1 vector is dropped: compile error
+#else
+void tmr1AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub);	//activate the isr handler at priority ipl (1-7), sub-priority sub (0-3)
+#endif
+#if defined(TMR1_ISRIPL)
+#define tmr1AttachISR(isrptr)	tmr1AttachISRPrio(isrptr, ISRIPL_PRIO(TMR1_ISRIPL), TMR_ISDEFAULT)
+#else
+#define tmr1AttachISR(isrptr)	tmr1AttachISRPrio(isrptr, TMR_IPDEFAULT, TMR_ISDEFAULT)
+#endif
+void tmr1Deinit(void);							//stop the timer and turn it off
+void tmr2Init(uint8_t ps, uint16_t period);		//initialize the timer2 (16bit), its interrupt stays on for the time base
+void tmr2AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub);	//activate the isr handler at priority ipl (1-7), sub-priority sub (0-3)
+#if defined(TMR2_ISRIPL)
+#define tmr2AttachISR(isrptr)	tmr2AttachISRPrio(isrptr, ISRIPL_PRIO(TMR2_ISRIPL), TMR_ISDEFAULT)
+#else
+#define tmr2AttachISR(isrptr)	tmr2AttachISRPrio(isrptr, TMR_IPDEFAULT, TMR_ISDEFAULT)
+#endif
+//no tmr2Deinit(): tmr2 is the pwm / systick / ticks64() time base
 void tmr3Init(uint8_t ps, uint16_t period);		//initialize the timer1 (16bit)
-void tmr3AttachISR(void (*isrptr)(void));		//activate the isr handler
+#if defined(USE_ISR_DIRECT) && !defined(TMR3_HANDLER)
+#define tmr3AttachISRPrio(isrptr, ipl, sub)	ISR_DROPPED(TMR3)	//the tmr3 vector is dropped: compile error
+#else
+void tmr3AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub);	//activate the isr handler at priority ipl (1-7), sub-priority sub (0-3)
+#endif
+#if defined(TMR3_ISRIPL)
+#define tmr3AttachISR(isrptr)	tmr3AttachISRPrio(isrptr, ISRIPL_PRIO(TMR3_ISRIPL), TMR_ISDEFAULT)
+#else
+#define tmr3AttachISR(isrptr)	tmr3AttachISRPrio(isrptr, TMR_IPDEFAULT, TMR_ISDEFAULT)
+#endif
+void tmr3Deinit(void);							//stop the timer and turn it off
 void tmr4Init(uint8_t ps, uint16_t period);		//initialize the timer2 (16bit)
-void tmr4AttachISR(void (*isrptr)(void));		//activate the isr handler
+#if defined(USE_ISR_DIRECT) && !defined(TMR4_HANDLER)
+#define tmr4AttachISRPrio(isrptr, ipl, sub)	ISR_DROPPED(TMR4)	//the tmr4 vector is dropped: compile error
+#else
+void tmr4AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub);	//activate the isr handler at priority ipl (1-7), sub-priority sub (0-3)
+#endif
+#if defined(TMR4_ISRIPL)
+#define tmr4AttachISR(isrptr)	tmr4AttachISRPrio(isrptr, ISRIPL_PRIO(TMR4_ISRIPL), TMR_ISDEFAULT)
+#else
+#define tmr4AttachISR(isrptr)	tmr4AttachISRPrio(isrptr, TMR_IPDEFAULT, TMR_ISDEFAULT)
+#endif
+void tmr4Deinit(void);							//stop the timer and turn it off
 void tmr5Init(uint8_t ps, uint16_t period);		//initialize the timer1 (16bit)
-void tmr5AttachISR(void (*isrptr)(void));		//activate the isr handler
+#if defined(USE_ISR_DIRECT) && !defined(TMR5_HANDLER)
+#define tmr5AttachISRPrio(isrptr, ipl, sub)	ISR_DROPPED(TMR5)	//the tmr5 vector is dropped: compile error
+#else
+void tmr5AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub);	//activate the isr handler at priority ipl (1-7), sub-priority sub (0-3)
+#endif
+#if defined(TMR5_ISRIPL)
+#define tmr5AttachISR(isrptr)	tmr5AttachISRPrio(isrptr, ISRIPL_PRIO(TMR5_ISRIPL), TMR_ISDEFAULT)
+#else
+#define tmr5AttachISR(isrptr)	tmr5AttachISRPrio(isrptr, TMR_IPDEFAULT, TMR_ISDEFAULT)
+#endif
+void tmr5Deinit(void);							//stop the timer and turn it off
 void tmr23Init(uint8_t ps, uint32_t period);		//initialize the timer1 (16bit)
-void tmr23AttachISR(void (*isrptr)(void));		//activate the isr handler
+#define tmr23AttachISR(isrptr)	tmr3AttachISR(isrptr)	//activate the isr handler
 uint32_t tmr23Get(void);						//read tmr23
 void tmr45Init(uint8_t ps, uint32_t period);		//initialize the timer1 (16bit)
-void tmr45AttachISR(void (*isrptr)(void));		//activate the isr handler
+#define tmr45AttachISR(isrptr)	tmr5AttachISR(isrptr)	//activate the isr handler
 uint32_t tmr45Get(void);						//read tmr45
 
 //pwm / oc
@@ -1143,58 +1555,164 @@ void pwm5Init(void);
 #define ADC_AN14					14			//internal reference IVref
 #define ADC_AN15					15			//Open
 
+#define ADC_IPDEFAULT		3
+#define ADC_ISDEFAULT		0
+#define ADC_SCANMAX			8			//max number of channels in a scan = half of ADC1BUF
+#define ADC_SCANDEPTH		16			//sample sets per half of the scan double buffer. comment out to remove the scan sampler
+
 //rest the adc
 //automatic sampling (ASAM=1), manual conversion
 void adcInit(void);
+void adcDeinit(void);							//turn off the adc
 
 //read the adc
 uint16_t analogRead(uint16_t ch);
+void analogReadStart(uint16_t ch);				//start a conversion on ch - non-blocking
+#define analogReadReady()		(AD1CON1bits.DONE)	//1->conversion done, 0->conversion on going
+#define analogReadResult()		(ADC1BUF0)			//result of the last conversion
+
+//scan sampler: tmr3 paces the conversions, each end-of-scan interrupt stores a sample set into a double buffer
+//a sample set holds one sample per channel, in ascending channel order
+void adcScanInit(uint16_t chmask, uint32_t rate);	//scan channels in chmask (bit n -> ADC_ANn, up to ADC_SCANMAX) at rate sample sets per second. uses tmr3
+void adcScanStop(void);							//stop scanning, back to adcInit() settings
+uint16_t *adcScanGet(void);						//return the filled half of the double buffer (ADC_SCANDEPTH sample sets), NULL if none ready. valid for ADC_SCANDEPTH sample periods
+uint32_t adcScanOverruns(void);					//number of filled halves not collected in time
 //end ADC
 
 //output compare
 #define OC_IPDEFAULT		2
 #define OC_ISDEFAULT		0
+//#define OC1_ISRIPL		IPL7SRS		//with oc1AttachISRPrio(isr, 7, 0). OC2_ISRIPL .. OC5_ISRIPL likewise
+//#define OC1_HANDLER()		oc1_handler()	//runs in the oc1 vector. OC2_HANDLER() .. OC5_HANDLER() likewise
 
 void oc1Init(uint16_t pr);						//initialize output compare
-void oc1AttachISR(void (*isrptr)(void));		//activate usr isr
+#if defined(USE_ISR_DIRECT) && !defined(OC1_HANDLER)
+#define oc1AttachISRPrio(isrptr, ipl, sub)	ISR_DROPPED(OC1)	//the oc1 vector is dropped: compile error
+#else
+void oc1AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub);	//activate the isr handler at priority ipl (1-7), sub-priority sub (0-3)
+#endif
+#if defined(OC1_ISRIPL)
+#define oc1AttachISR(isrptr)	oc1AttachISRPrio(isrptr, ISRIPL_PRIO(OC1_ISRIPL), OC_ISDEFAULT)
+#else
+#define oc1AttachISR(isrptr)	oc1AttachISRPrio(isrptr, OC_IPDEFAULT, OC_ISDEFAULT)
+#endif
+void oc1Deinit(void);							//stop the oc and turn it off, unless analogWrite() uses it
+#define pwm1Deinit()			oc1Deinit()
 void oc2Init(uint16_t pr);						//initialize output compare
-void oc2AttachISR(void (*isrptr)(void));		//activate usr isr
+#if defined(USE_ISR_DIRECT) && !defined(OC2_HANDLER)
+#define oc2AttachISRPrio(isrptr, ipl, sub)	ISR_DROPPED(OC2)	//the oc2 vector is dropped: compile error
+#else
+void oc2AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub);	//activate the isr handler at priority ipl (1-7), sub-priority sub (0-3)
+#endif
+#if defined(OC2_ISRIPL)
+#define oc2AttachISR(isrptr)	oc2AttachISRPrio(isrptr, ISRIPL_PRIO(OC2_ISRIPL), OC_ISDEFAULT)
+#else
+#define oc2AttachISR(isrptr)	oc2AttachISRPrio(isrptr, OC_IPDEFAULT, OC_ISDEFAULT)
+#endif
+void oc2Deinit(void);							//stop the oc and turn it off, unless analogWrite() uses it
+#define pwm2Deinit()			oc2Deinit()
 void oc3Init(uint16_t pr);						//initialize output compare
-void oc3AttachISR(void (*isrptr)(void));		//activate usr isr
+#if defined(USE_ISR_DIRECT) && !defined(OC3_HANDLER)
+#define oc3AttachISRPrio(isrptr, ipl, sub)	ISR_DROPPED(OC3)	//the oc3 vector is dropped: compile error
+#else
+void oc3AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub);	//activate the isr handler at priority ipl (1-7), sub-priority sub (0-3)
+#endif
+#if defined(OC3_ISRIPL)
+#define oc3AttachISR(isrptr)	oc3AttachISRPrio(isrptr, ISRIPL_PRIO(OC3_ISRIPL), OC_ISDEFAULT)
+#else
+#define oc3AttachISR(isrptr)	oc3AttachISRPrio(isrptr, OC_IPDEFAULT, OC_ISDEFAULT)
+#endif
+void oc3Deinit(void);							//stop the oc and turn it off, unless analogWrite() uses it
+#define pwm3Deinit()			oc3Deinit()
 void oc4Init(uint16_t pr);						//initialize output compare
-void oc4AttachISR(void (*isrptr)(void));		//activate usr isr
+#if defined(USE_ISR_DIRECT) && !defined(OC4_HANDLER)
+#define oc4AttachISRPrio(isrptr, ipl, sub)	ISR_DROPPED(OC4)	//the oc4 vector is dropped: compile error
+#else
+void oc4AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub);	//activate the isr handler at priority ipl (1-7), sub-priority sub (0-3)
+#endif
+#if defined(OC4_ISRIPL)
+#define oc4AttachISR(isrptr)	oc4AttachISRPrio(isrptr, ISRIPL_PRIO(OC4_ISRIPL), OC_ISDEFAULT)
+#else
+#define oc4AttachISR(isrptr)	oc4AttachISRPrio(isrptr, OC_IPDEFAULT, OC_ISDEFAULT)
+#endif
+void oc4Deinit(void);							//stop the oc and turn it off, unless analogWrite() uses it
+#define pwm4Deinit()			oc4Deinit()
 void oc5Init(uint16_t pr);						//initialize output compare
-void oc5AttachISR(void (*isrptr)(void));		//activate usr isr
+#if defined(USE_ISR_DIRECT) && !defined(OC5_HANDLER)
+#define oc5AttachISRPrio(isrptr, ipl, sub)	ISR_DROPPED(OC5)	//the oc5 vector is dropped: compile error
+#else
+void oc5AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub);	//activate the isr handler at priority ipl (1-7), sub-priority sub (0-3)
+#endif
+#if defined(OC5_ISRIPL)
+#define oc5AttachISR(isrptr)	oc5AttachISRPrio(isrptr, ISRIPL_PRIO(OC5_ISRIPL), OC_ISDEFAULT)
+#else
+#define oc5AttachISR(isrptr)	oc5AttachISRPrio(isrptr, OC_IPDEFAULT, OC_ISDEFAULT)
+#endif
+void oc5Deinit(void);							//stop the oc and turn it off, unless analogWrite() uses it
+#define pwm5Deinit()			oc5Deinit()
 
 //input capture
 
 #define IC_IPDEFAULT		1
 #define IC_ISDEFAULT		0
+//#define IC1_ISRIPL		IPL7SRS		//with ic1AttachISRPrio(isr, 7, 0). IC2_ISRIPL .. IC5_ISRIPL likewise
+//#define IC1_HANDLER()		ic1_handler()	//runs in the ic1 vector in place of any handler attached. IC2_HANDLER() .. IC5_HANDLER() likewise
+//with ICx_HANDLER() defined icxAttachISR() only sets the priority and enables the interrupt, and pulseMeasureStart() on ICxPIN returns 0
 
 //16-bit mode, rising edge, single capture, Timer2 as timebase
 //interrupt disabled
 void ic1Init(void);
-void ic1AttachISR(void (*isrptr)(void));		//activate user ptr
+void ic1AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub);	//activate the isr handler at priority ipl (1-7), sub-priority sub (0-3)
+#if defined(IC1_ISRIPL)
+#define ic1AttachISR(isrptr)	ic1AttachISRPrio(isrptr, ISRIPL_PRIO(IC1_ISRIPL), IC_ISDEFAULT)
+#else
+#define ic1AttachISR(isrptr)	ic1AttachISRPrio(isrptr, IC_IPDEFAULT, IC_ISDEFAULT)
+#endif
+void ic1Deinit(void);							//stop the input capture and turn it off
 //uint16_t ic1Get(void);							//read buffer value
 #define ic1Get()			IC1BUF				//read buffer value
 
 void ic2Init(void);
-void ic2AttachISR(void (*isrptr)(void));		//activate user ptr
+void ic2AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub);	//activate the isr handler at priority ipl (1-7), sub-priority sub (0-3)
+#if defined(IC2_ISRIPL)
+#define ic2AttachISR(isrptr)	ic2AttachISRPrio(isrptr, ISRIPL_PRIO(IC2_ISRIPL), IC_ISDEFAULT)
+#else
+#define ic2AttachISR(isrptr)	ic2AttachISRPrio(isrptr, IC_IPDEFAULT, IC_ISDEFAULT)
+#endif
+void ic2Deinit(void);							//stop the input capture and turn it off
 //uint16_t ic2Get(void);							//read buffer value
 #define ic2Get()			IC2BUF				//read buffer value
 
 void ic3Init(void);
-void ic3AttachISR(void (*isrptr)(void));		//activate user ptr
+void ic3AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub);	//activate the isr handler at priority ipl (1-7), sub-priority sub (0-3)
+#if defined(IC3_ISRIPL)
+#define ic3AttachISR(isrptr)	ic3AttachISRPrio(isrptr, ISRIPL_PRIO(IC3_ISRIPL), IC_ISDEFAULT)
+#else
+#define ic3AttachISR(isrptr)	ic3AttachISRPrio(isrptr, IC_IPDEFAULT, IC_ISDEFAULT)
+#endif
+void ic3Deinit(void);							//stop the input capture and turn it off
 //uint16_t ic3Get(void);							//read buffer value
 #define ic3Get()			IC3BUF				//read buffer value
 
 void ic4Init(void);
-void ic4AttachISR(void (*isrptr)(void));		//activate user ptr
+void ic4AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub);	//activate the isr handler at priority ipl (1-7), sub-priority sub (0-3)
+#if defined(IC4_ISRIPL)
+#define ic4AttachISR(isrptr)	ic4AttachISRPrio(isrptr, ISRIPL_PRIO(IC4_ISRIPL), IC_ISDEFAULT)
+#else
+#define ic4AttachISR(isrptr)	ic4AttachISRPrio(isrptr, IC_IPDEFAULT, IC_ISDEFAULT)
+#endif
+void ic4Deinit(void);							//stop the input capture and turn it off
 //uint16_t ic4Get(void);							//read buffer value
 #define ic4Get()			IC4BUF				//read buffer value
 
 void ic5Init(void);
-void ic5AttachISR(void (*isrptr)(void));		//activate user ptr
+void ic5AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub);	//activate the isr handler at priority ipl (1-7), sub-priority sub (0-3)
+#if defined(IC5_ISRIPL)
+#define ic5AttachISR(isrptr)	ic5AttachISRPrio(isrptr, ISRIPL_PRIO(IC5_ISRIPL), IC_ISDEFAULT)
+#else
+#define ic5AttachISR(isrptr)	ic5AttachISRPrio(isrptr, IC_IPDEFAULT, IC_ISDEFAULT)
+#endif
+void ic5Deinit(void);							//stop the input capture and turn it off
 //uint16_t ic5Get(void);							//read buffer value
 #define ic5Get()			IC5BUF				//read buffer value
 //end input capture
@@ -1202,32 +1720,94 @@ void ic5AttachISR(void (*isrptr)(void));		//activate user ptr
 //extint
 #define INT_IPDEFAULT		6
 #define INT_ISDEFAULT		0
+//#define INT0_ISRIPL		IPL7SRS		//with int0AttachISRPrio(isr, 7, 0). INT1_ISRIPL .. INT4_ISRIPL likewise
+//#define INT0_HANDLER()		int0_handler()	//runs in the int0 vector. INT1_HANDLER() .. INT4_HANDLER() likewise
 
 void int0Init(void);							//initialize the module
-void int0AttachISR(void (*isrptr) (void));		//attach user isr
+#if defined(USE_ISR_DIRECT) && !defined(INT0_HANDLER)
+#define int0AttachISRPrio(isrptr, ipl, sub)	ISR_DROPPED(INT0)	//the int0 vector is dropped: compile error
+#else
+void int0AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub);	//activate the isr handler at priority ipl (1-7), sub-priority sub (0-3)
+#endif
+#if defined(INT0_ISRIPL)
+#define int0AttachISR(isrptr)	int0AttachISRPrio(isrptr, ISRIPL_PRIO(INT0_ISRIPL), INT_ISDEFAULT)
+#else
+#define int0AttachISR(isrptr)	int0AttachISRPrio(isrptr, INT_IPDEFAULT, INT_ISDEFAULT)
+#endif
 
 void int1Init(void);							//initialize the module
-void int1AttachISR(void (*isrptr) (void));		//attach user isr
+#if defined(USE_ISR_DIRECT) && !defined(INT1_HANDLER)
+#define int1AttachISRPrio(isrptr, ipl, sub)	ISR_DROPPED(INT1)	//the int1 vector is dropped: compile error
+#else
+void int1AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub);	//activate the isr handler at priority ipl (1-7), sub-priority sub (0-3)
+#endif
+#if defined(INT1_ISRIPL)
+#define int1AttachISR(isrptr)	int1AttachISRPrio(isrptr, ISRIPL_PRIO(INT1_ISRIPL), INT_ISDEFAULT)
+#else
+#define int1AttachISR(isrptr)	int1AttachISRPrio(isrptr, INT_IPDEFAULT, INT_ISDEFAULT)
+#endif
 
 void int2Init(void);							//initialize the module
-void int2AttachISR(void (*isrptr) (void));		//attach user isr
+#if defined(USE_ISR_DIRECT) && !defined(INT2_HANDLER)
+#define int2AttachISRPrio(isrptr, ipl, sub)	ISR_DROPPED(INT2)	//the int2 vector is dropped: compile error
+#else
+void int2AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub);	//activate the isr handler at priority ipl (1-7), sub-priority sub (0-3)
+#endif
+#if defined(INT2_ISRIPL)
+#define int2AttachISR(isrptr)	int2AttachISRPrio(isrptr, ISRIPL_PRIO(INT2_ISRIPL), INT_ISDEFAULT)
+#else
+#define int2AttachISR(isrptr)	int2AttachISRPrio(isrptr, INT_IPDEFAULT, INT_ISDEFAULT)
+#endif
 
 void int3Init(void);							//initialize the module
-void int3AttachISR(void (*isrptr) (void));		//attach user isr
+#if defined(USE_ISR_DIRECT) && !defined(INT3_HANDLER)
+#define int3AttachISRPrio(isrptr, ipl, sub)	ISR_DROPPED(INT3)	//the int3 vector is dropped: compile error
+#else
+void int3AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub);	//activate the isr handler at priority ipl (1-7), sub-priority sub (0-3)
+#endif
+#if defined(INT3_ISRIPL)
+#define int3AttachISR(isrptr)	int3AttachISRPrio(isrptr, ISRIPL_PRIO(INT3_ISRIPL), INT_ISDEFAULT)
+#else
+#define int3AttachISR(isrptr)	int3AttachISRPrio(isrptr, INT_IPDEFAULT, INT_ISDEFAULT)
+#endif
 
 void int4Init(void);							//initialize the module
-void int4AttachISR(void (*isrptr) (void));		//attach user isr
+#if defined(USE_ISR_DIRECT) && !defined(INT4_HANDLER)
+#define int4AttachISRPrio(isrptr, ipl, sub)	ISR_DROPPED(INT4)	//the int4 vector is dropped: compile error
+#else
+void int4AttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub);	//activate the isr handler at priority ipl (1-7), sub-priority sub (0-3)
+#endif
+#if defined(INT4_ISRIPL)
+#define int4AttachISR(isrptr)	int4AttachISRPrio(isrptr, ISRIPL_PRIO(INT4_ISRIPL), INT_ISDEFAULT)
+#else
+#define int4AttachISR(isrptr)	int4AttachISRPrio(isrptr, INT_IPDEFAULT, INT_ISDEFAULT)
+#endif
 //end extint
 
 //spi
+#define SPI_IPDEFAULT		3
+#define SPI_ISDEFAULT		0
+#define SPI_DMAQSIZE		4							//depth of the spi dma transfer queue, power of 2
+
+//dma transfers: spi1 uses dma channel 0 (tx) / 1 (rx), spi2 uses dma channel 2 (tx) / 3 (rx)
+//tx=NULL -> rx only (0xff is sent: rx is filled with 0xff when queued, it is the tx source), rx=NULL -> tx only (received data discarded)
+//callback (may be NULL) runs from the isr once the last byte has been clocked out
+//returns 0 if the queue is full
+//don't use spixWrite()/spixRead() while transfers are pending
 
 void spi1Init(uint32_t br);						//reset the spi
+void spi1Deinit(void);							//wait for the pending transfers, then turn off the spi
+uint8_t spi1Transfer(const uint8_t *tx, uint8_t *rx, uint16_t len, void (*callback)(void));	//queue a dma transfer
+uint8_t spi1TransferBusy(void);					//number of dma transfers pending
 #define spi1Busy()			(SPI1STATbits.SPITBF)	//transmit buffer full, must wait before writing to SPIxBUF
 #define spi1Available()		(!SPI1STATbits.SPIRBE)	//receive buffer not empty -> there is data
 #define spi1Write(dat)		SPI1BUF = (dat)		//send data via spi
 #define spi1Read()			(SPI1BUF)			//read from the buffer
 
 void spi2Init(uint32_t br);						//reset the spi
+void spi2Deinit(void);							//wait for the pending transfers, then turn off the spi
+uint8_t spi2Transfer(const uint8_t *tx, uint8_t *rx, uint16_t len, void (*callback)(void));	//queue a dma transfer
+uint8_t spi2TransferBusy(void);					//number of dma transfers pending
 #define spi2Busy()			(SPI2STATbits.SPITBF)	//transmit buffer full, must wait before writing to SPIxBUF
 #define spi2Available()		(!SPI2STATbits.SPIRBE)	//receive buffer not empty -> there is data
 #define spi2Write(dat)		SPI2BUF = (dat)		//send data via spi
@@ -1240,26 +1820,58 @@ void spi2Init(uint32_t br);						//reset the spi
 #define I2C_NOACK		1
 #define I2C_CMD_WRITE	0
 #define I2C_CMD_READ	1
+#define I2C_IPDEFAULT	3
+#define I2C_ISDEFAULT	0
+#define I2C_QSIZE		4				//depth of the transaction queue, power of 2
+#define I2C_TIMEOUT		10				//ms without bus progress before a transaction is aborted
+
+//transaction status, passed to the callback
+#define I2C_OK			0				//completed
+#define I2C_ERR_NACK	1				//address or data byte not acknowledged
+#define I2C_ERR_BCL		2				//bus collision
+#define I2C_ERR_TIMEOUT	3				//no bus progress for I2C_TIMEOUT ms
+
+//transactions: start, addr+W, wlen bytes from wbuf, repeated start, addr+R, rlen bytes into rbuf, stop
+//wlen=0 -> read only, rlen=0 -> write only, both 0 -> address probe
+//callback (may be NULL) runs from the isr with the status once the stop has been sent
+//returns 0 if the queue is full
+//timeouts are detected in i2cxXferBusy() - poll it if the bus can stall
+//don't use the blocking i2cx calls while transactions are pending
+//i2cxWriteReg()/i2cxReadReg()/i2cxScan() queue behind pending transactions and block until their own one completes
 
 //i2c1
 //#define F_I2C1			100000ul		//I2C frequency
 void i2c1Init(uint32_t bps);			//initialize the i2c
+void i2c1Deinit(void);					//wait for the pending transactions, then turn off the i2c
 void i2c1Start(void);					//send a start condition
 void i2c1Stop(void);					//send a stop condition
 void i2c1Restart(void);					//send a restart condition
 //#define i2c1Wait()		do {while (I2C1CON & 0x1f); while (I2C1STATbits.TRSTAT);} while (0)		//wait for i2c
 unsigned char i2c1Write(unsigned char dat);			//send i2c
 unsigned char i2c1Read(unsigned char ack);			//read i2c
+uint8_t i2c1Xfer(uint8_t addr, const uint8_t *wbuf, uint16_t wlen, uint8_t *rbuf, uint16_t rlen, void (*callback)(uint8_t status));	//queue a transaction
+uint8_t i2c1XferBusy(void);					//number of transactions pending
+uint8_t i2c1XferStatus(void);					//status of the last completed transaction
+uint8_t i2c1WriteReg(uint8_t addr, uint8_t reg, const uint8_t *buf, uint16_t n);	//burst write to registers from reg, returns the status
+uint8_t i2c1ReadReg(uint8_t addr, uint8_t reg, uint8_t *buf, uint16_t n);		//burst read from registers from reg, returns the status
+uint8_t i2c1Scan(uint8_t *found, uint8_t max);	//list the addresses that ack, returns the count
 
 //i2c2
 //#define F_I2C2			100000ul		//I2C frequency
 void i2c2Init(uint32_t bps);			//initialize the i2c
+void i2c2Deinit(void);					//wait for the pending transactions, then turn off the i2c
 void i2c2Start(void);					//send a start condition
 void i2c2Stop(void);					//send a stop condition
 void i2c2Restart(void);					//send a restart condition
 //#define i2c1Wait()		do {while (I2C2CON & 0x1f); while (I2C2STATbits.TRSTAT);} while (0)		//wait for i2c
 unsigned char i2c2Write(unsigned char dat);			//send i2c
 unsigned char i2c2Read(unsigned char ack);			//read i2c
+uint8_t i2c2Xfer(uint8_t addr, const uint8_t *wbuf, uint16_t wlen, uint8_t *rbuf, uint16_t rlen, void (*callback)(uint8_t status));	//queue a transaction
+uint8_t i2c2XferBusy(void);					//number of transactions pending
+uint8_t i2c2XferStatus(void);					//status of the last completed transaction
+uint8_t i2c2WriteReg(uint8_t addr, uint8_t reg, const uint8_t *buf, uint16_t n);	//burst write to registers from reg, returns the status
+uint8_t i2c2ReadReg(uint8_t addr, uint8_t reg, uint8_t *buf, uint16_t n);		//burst read from registers from reg, returns the status
+uint8_t i2c2Scan(uint8_t *found, uint8_t max);	//list the addresses that ack, returns the count
 //end i2c
 
 //RTCC
@@ -1284,14 +1896,43 @@ uint32_t RTCCSetCal(uint32_t offset);			//set calibration
 //cnint
 #define CN_IPDEFAULT		1
 #define CN_ISDEFAULT		0
+//#define CN_ISRIPL			IPL7SRS		//with cnxAttachISRPrio(isr, 7, 0) - one vector for all ports
+//#define CNA_HANDLER()		cna_handler()	//runs in the cn vector on a porta change. CNB_HANDLER() / CNC_HANDLER() likewise
 
 void cnaInit(uint16_t pins);					//initialize change notification
-void cnaAttachISR(void (*isrptr) (void));		//attach user isr
+#if defined(USE_ISR_DIRECT) && !defined(CNA_HANDLER) && !defined(CNB_HANDLER) && !defined(CNC_HANDLER)
+#define cnaAttachISRPrio(isrptr, ipl, sub)	ISR_DROPPED(CN)	//the cn vector is dropped: compile error
+#else
+void cnaAttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub);	//activate the isr handler at priority ipl (1-7), sub-priority sub (0-3)
+#endif
+#if defined(CN_ISRIPL)
+#define cnaAttachISR(isrptr)	cnaAttachISRPrio(isrptr, ISRIPL_PRIO(CN_ISRIPL), CN_ISDEFAULT)
+#else
+#define cnaAttachISR(isrptr)	cnaAttachISRPrio(isrptr, CN_IPDEFAULT, CN_ISDEFAULT)
+#endif
 void cnbInit(uint16_t pins);					//initialize change notification
-void cnbAttachISR(void (*isrptr) (void));		//attach user isr
+#if defined(USE_ISR_DIRECT) && !defined(CNA_HANDLER) && !defined(CNB_HANDLER) && !defined(CNC_HANDLER)
+#define cnbAttachISRPrio(isrptr, ipl, sub)	ISR_DROPPED(CN)	//the cn vector is dropped: compile error
+#else
+void cnbAttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub);	//activate the isr handler at priority ipl (1-7), sub-priority sub (0-3)
+#endif
+#if defined(CN_ISRIPL)
+#define cnbAttachISR(isrptr)	cnbAttachISRPrio(isrptr, ISRIPL_PRIO(CN_ISRIPL), CN_ISDEFAULT)
+#else
+#define cnbAttachISR(isrptr)	cnbAttachISRPrio(isrptr, CN_IPDEFAULT, CN_ISDEFAULT)
+#endif
 #if defined(_PORTC)
 void cncInit(uint16_t pins);					//initialize change notification
-void cncAttachISR(void (*isrptr) (void));		//attach user isr
+#if defined(USE_ISR_DIRECT) && !defined(CNA_HANDLER) && !defined(CNB_HANDLER) && !defined(CNC_HANDLER)
+#define cncAttachISRPrio(isrptr, ipl, sub)	ISR_DROPPED(CN)	//the cn vector is dropped: compile error
+#else
+void cncAttachISRPrio(void (*isrptr)(void), uint8_t ipl, uint8_t sub);	//activate the isr handler at priority ipl (1-7), sub-priority sub (0-3)
+#endif
+#if defined(CN_ISRIPL)
+#define cncAttachISR(isrptr)	cncAttachISRPrio(isrptr, ISRIPL_PRIO(CN_ISRIPL), CN_ISDEFAULT)
+#else
+#define cncAttachISR(isrptr)	cncAttachISRPrio(isrptr, CN_IPDEFAULT, CN_ISDEFAULT)
+#endif
 #endif		//_PORTC
 //end cnint
 
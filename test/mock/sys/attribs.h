@@ -0,0 +1,2 @@
+//host stand-in for <sys/attribs.h>: __ISR() becomes a plain function
+#define __ISR(...)
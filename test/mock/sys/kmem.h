@@ -0,0 +1,2 @@
+//host stand-in for <sys/kmem.h>
+#define KVA_TO_PA(v)		((uint32_t) (uintptr_t) (v))
@@ -0,0 +1,117 @@
+//host model of the uart status / data registers, for the uart tests: include before pic32duino.h
+//4-deep tx and rx fifos. the test feeds the rx line with mockRx() and shifts the tx line out with mockShift()
+//UxSTACLR / UxSTASET writes take effect at the next register access: clearing OERR empties the rx fifo, as on the chip
+#ifndef _MOCK_UART_H
+#define _MOCK_UART_H
+
+#define MOCK_UART									//xc.h leaves UxSTA / UxTXREG / UxRXREG to this model
+#include <xc.h>
+#define MOCK_FIFO			4						//hardware fifo depth
+#define MOCK_OUT			4096					//chars kept of the tx line
+
+#define MOCK_FERR			1						//mockRx() flags: framing error
+#define MOCK_PERR			2						//parity error
+
+typedef struct {
+	uint32_t URXDA, OERR, FERR, PERR, RIDLE, ADDEN, URXISEL, TRMT, UTXBF, UTXEN, UTXBRK, URXEN, UTXINV, UTXISEL;
+} MOCK_StaTypeDef;
+
+typedef struct {
+	MOCK_StaTypeDef bits;							//UxSTAbits
+	uint8_t rx[MOCK_FIFO], rxerr[MOCK_FIFO];		//rx fifo and the FERR / PERR of each char, top at [0]
+	uint8_t rxn;									//chars in the rx fifo
+	uint32_t rxlost;								//chars lost to an overrun
+	volatile uint32_t tx[MOCK_FIFO];				//tx fifo, oldest at [0]
+	uint8_t txn;									//chars in the tx fifo
+	uint32_t txover;								//writes to a full tx fifo - lost, never expected
+	uint8_t out[MOCK_OUT];							//the tx line
+	uint32_t nout;
+	volatile uint32_t clr, set;						//pending UxSTACLR / UxSTASET writes
+	uint8_t drain;									//1->the transmitter frees a fifo entry on each status read while the fifo is full
+} MOCK_UartTypeDef;
+
+static MOCK_UartTypeDef mock_u1, mock_u2;
+
+//shift n chars out of the tx fifo onto the line
+static inline void mockShift(MOCK_UartTypeDef *u, uint32_t n) {
+	uint8_t i;
+
+	while (n-- && u->txn) {
+		if (u->nout < MOCK_OUT) u->out[u->nout] = u->tx[0];
+		u->nout += 1;
+		for (i=1; i<u->txn; i++) u->tx[i - 1] = u->tx[i];
+		u->txn -= 1;
+	}
+}
+
+//apply pending UxSTACLR / UxSTASET writes, update the status bits
+static inline void mockSync(MOCK_UartTypeDef *u) {
+	if (u->clr & _U1STA_OERR_MASK) {u->bits.OERR = 0; u->rxn = 0;}	//clearing OERR resets the rx fifo
+	u->clr = u->set = 0;
+	if (u->drain && (u->txn == MOCK_FIFO)) mockShift(u, 1);	//time passes while the driver polls
+	u->bits.URXDA = (u->rxn != 0);
+	u->bits.FERR = u->rxn && (u->rxerr[0] & MOCK_FERR);
+	u->bits.PERR = u->rxn && (u->rxerr[0] & MOCK_PERR);
+	u->bits.TRMT = (u->txn == 0);
+	u->bits.UTXBF = (u->txn == MOCK_FIFO);
+}
+
+//a char arrives on the rx line: into the fifo, or lost to an overrun
+static inline void mockRx(MOCK_UartTypeDef *u, uint8_t ch, uint8_t err) {
+	mockSync(u);
+	if (u->bits.OERR || (u->rxn == MOCK_FIFO)) {u->bits.OERR = 1; u->rxlost += 1; return;}	//receiver stalls until OERR is cleared
+	u->rx[u->rxn] = ch;
+	u->rxerr[u->rxn] = err;
+	u->rxn += 1;
+}
+
+static inline uint32_t mockSta(MOCK_UartTypeDef *u) {
+	mockSync(u);
+	return (u->bits.URXDA ? _U1STA_URXDA_MASK : 0) | (u->bits.OERR ? _U1STA_OERR_MASK : 0) |
+		(u->bits.FERR ? _U1STA_FERR_MASK : 0) | (u->bits.PERR ? _U1STA_PERR_MASK : 0) |
+		(u->bits.TRMT ? _U1STA_TRMT_MASK : 0) | (u->bits.UTXBF ? _U1STA_UTXBF_MASK : 0);
+}
+
+static inline MOCK_StaTypeDef *mockBits(MOCK_UartTypeDef *u) {
+	mockSync(u);
+	return &u->bits;
+}
+
+//read the top of the rx fifo
+static inline uint8_t mockRxreg(MOCK_UartTypeDef *u) {
+	uint8_t i, ch;
+
+	mockSync(u);
+	if (u->rxn == 0) return 0;
+	ch = u->rx[0];
+	for (i=1; i<u->rxn; i++) {u->rx[i - 1] = u->rx[i]; u->rxerr[i - 1] = u->rxerr[i];}
+	u->rxn -= 1;
+	return ch;
+}
+
+//write to the tx fifo
+static inline volatile uint32_t *mockTxreg(MOCK_UartTypeDef *u) {
+	static volatile uint32_t lost;
+
+	mockSync(u);
+	if (u->txn == MOCK_FIFO) {u->txover += 1; return &lost;}
+	return &u->tx[u->txn++];
+}
+
+static inline volatile uint32_t *mockClr(MOCK_UartTypeDef *u) {mockSync(u); return &u->clr;}
+static inline volatile uint32_t *mockSet(MOCK_UartTypeDef *u) {mockSync(u); return &u->set;}
+
+#define U1STA				mockSta(&mock_u1)
+#define U1STAbits			(*mockBits(&mock_u1))
+#define U1STACLR			(*mockClr(&mock_u1))
+#define U1STASET			(*mockSet(&mock_u1))
+#define U1TXREG				(*mockTxreg(&mock_u1))
+#define U1RXREG				mockRxreg(&mock_u1)
+#define U2STA				mockSta(&mock_u2)
+#define U2STAbits			(*mockBits(&mock_u2))
+#define U2STACLR			(*mockClr(&mock_u2))
+#define U2STASET			(*mockSet(&mock_u2))
+#define U2TXREG				(*mockTxreg(&mock_u2))
+#define U2RXREG				mockRxreg(&mock_u2)
+
+#endif	//_MOCK_UART_H
@@ -0,0 +1,448 @@
+//host stand-in for <xc.h>, for the tests only
+//every special function register pic32duino.c touches is a plain variable, bit fields are plain members:
+//writes are stored, reads return the last write - no hardware behaviour, bit positions are not modelled but for the UxSTA and i2c bits the tests use
+//one test = one translation unit that includes pic32duino.c, so the registers are defined here
+//with MOCK_UART defined the test models U1STA/U2STA/UxTXREG/UxRXREG itself
+#ifndef _MOCK_XC_H
+#define _MOCK_XC_H
+
+#include <stdint.h>
+
+#define __32MX250F128B_H								//28-pin part, no port c
+
+//core timer: count / compare are set by the test
+volatile uint32_t mock_count, mock_compare;
+#define _CP0_GET_COUNT()				(mock_count)
+#define _CP0_SET_COUNT(x)				(mock_count = (x))
+#define _CP0_GET_COMPARE()				(mock_compare)
+#define _CP0_SET_COMPARE(x)				(mock_compare = (x))
+#define _CP0_GET_STATUS()				0
+#define _CP0_SET_STATUS(x)				(void) (x)
+#define _CP0_GET_CONFIG()				0
+#define _CP0_SET_CONFIG(x)				(void) (x)
+#define _wait()							do {} while (0)
+
+//interrupts: the test calls the isrs itself
+#define __builtin_enable_interrupts()	((void) 0)
+#define __builtin_disable_interrupts()	((void) 0)
+#define __builtin_get_isr_state()		0
+#define __builtin_set_isr_state(x)		(void) (x)
+#define Nop()							do {} while (0)
+
+//adc result buffer: ADC1BUF0..ADC1BUF15 are 16 bytes apart
+volatile uint32_t mock_adcbuf[16 * 4];
+#define ADC1BUF0						(mock_adcbuf[0])
+#define ADC1BUF8						(mock_adcbuf[8 * 4])
+
+//UxSTA bits
+#define _U1STA_URXDA_MASK		0x00000001
+#define _U1STA_OERR_MASK		0x00000002
+#define _U1STA_FERR_MASK		0x00000004
+#define _U1STA_PERR_MASK		0x00000008
+#define _U1STA_RIDLE_MASK		0x00000010
+#define _U1STA_ADDEN_MASK		0x00000020
+#define _U1STA_TRMT_MASK		0x00000100
+#define _U1STA_UTXBF_MASK		0x00000200
+#define _U1STA_UTXEN_MASK		0x00000400
+#define _U1STA_UTXBRK_MASK		0x00000800
+#define _U1STA_URXEN_MASK		0x00001000
+#define _U1STA_UTXINV_MASK		0x00002000
+#define _U2STA_URXDA_MASK		0x00000001
+#define _U2STA_OERR_MASK		0x00000002
+#define _U2STA_FERR_MASK		0x00000004
+#define _U2STA_PERR_MASK		0x00000008
+#define _U2STA_RIDLE_MASK		0x00000010
+#define _U2STA_ADDEN_MASK		0x00000020
+#define _U2STA_TRMT_MASK		0x00000100
+#define _U2STA_UTXBF_MASK		0x00000200
+#define _U2STA_UTXEN_MASK		0x00000400
+#define _U2STA_UTXBRK_MASK		0x00000800
+#define _U2STA_URXEN_MASK		0x00001000
+#define _U2STA_UTXINV_MASK		0x00002000
+
+//i2c bits
+#define _I2C1CON_ACKEN_MASK		0x00000010
+#define _I2C1CON_PEN_MASK		0x00000004
+#define _I2C1CON_RCEN_MASK		0x00000008
+#define _I2C1CON_RSEN_MASK		0x00000002
+#define _I2C1CON_SEN_MASK		0x00000001
+#define _I2C1STAT_BCL_MASK		0x00000400
+#define _I2C2CON_ACKEN_MASK		0x00000010
+#define _I2C2CON_PEN_MASK		0x00000004
+#define _I2C2CON_RCEN_MASK		0x00000008
+#define _I2C2CON_RSEN_MASK		0x00000002
+#define _I2C2CON_SEN_MASK		0x00000001
+#define _I2C2STAT_BCL_MASK		0x00000400
+#define _IEC1_I2C1BIE_MASK		0x00000400
+#define _IEC1_I2C1MIE_MASK		0x00001000
+#define _IEC1_I2C2BIE_MASK		0x01000000
+#define _IEC1_I2C2MIE_MASK		0x04000000
+#define _IFS1_I2C1BIF_MASK		0x00000400
+#define _IFS1_I2C1MIF_MASK		0x00001000
+#define _IFS1_I2C2BIF_MASK		0x01000000
+#define _IFS1_I2C2MIF_MASK		0x04000000
+
+//registers
+volatile uint32_t AD1CON1;
+volatile uint32_t AD1CON1CLR;
+volatile uint32_t AD1CON1SET;
+volatile uint32_t AD1CON2;
+volatile uint32_t AD1CON3;
+volatile uint32_t AD1CSSL;
+volatile uint32_t ANSELA;
+volatile uint32_t ANSELB;
+volatile uint32_t CM1CON;
+volatile uint32_t CM2CON;
+volatile uint32_t CM3CON;
+volatile uint32_t CVRCON;
+volatile uint32_t DCH0CON;
+volatile uint32_t DCH0CONCLR;
+volatile uint32_t DCH0CONSET;
+volatile uint32_t DCH0CSIZ;
+volatile uint32_t DCH0DSA;
+volatile uint32_t DCH0DSIZ;
+volatile uint32_t DCH0ECON;
+volatile uint32_t DCH0ECONSET;
+volatile uint32_t DCH0INTCLR;
+volatile uint32_t DCH0INTSET;
+volatile uint32_t DCH0SSA;
+volatile uint32_t DCH0SSIZ;
+volatile uint32_t DCH1CON;
+volatile uint32_t DCH1CONCLR;
+volatile uint32_t DCH1CONSET;
+volatile uint32_t DCH1CSIZ;
+volatile uint32_t DCH1DSA;
+volatile uint32_t DCH1DSIZ;
+volatile uint32_t DCH1ECON;
+volatile uint32_t DCH1INTCLR;
+volatile uint32_t DCH1INTSET;
+volatile uint32_t DCH1SSA;
+volatile uint32_t DCH1SSIZ;
+volatile uint32_t DCH2CON;
+volatile uint32_t DCH2CONCLR;
+volatile uint32_t DCH2CONSET;
+volatile uint32_t DCH2CSIZ;
+volatile uint32_t DCH2DSA;
+volatile uint32_t DCH2DSIZ;
+volatile uint32_t DCH2ECON;
+volatile uint32_t DCH2ECONSET;
+volatile uint32_t DCH2INTCLR;
+volatile uint32_t DCH2INTSET;
+volatile uint32_t DCH2SSA;
+volatile uint32_t DCH2SSIZ;
+volatile uint32_t DCH3CON;
+volatile uint32_t DCH3CONCLR;
+volatile uint32_t DCH3CONSET;
+volatile uint32_t DCH3CSIZ;
+volatile uint32_t DCH3DSA;
+volatile uint32_t DCH3DSIZ;
+volatile uint32_t DCH3ECON;
+volatile uint32_t DCH3INTCLR;
+volatile uint32_t DCH3INTSET;
+volatile uint32_t DCH3SSA;
+volatile uint32_t DCH3SSIZ;
+volatile uint32_t DMACONSET;
+volatile uint32_t I2C1BRG;
+volatile uint32_t I2C1CON;
+volatile uint32_t I2C1CONSET;
+volatile uint32_t I2C1RCV;
+volatile uint32_t I2C1STATCLR;
+volatile uint32_t I2C1TRN;
+volatile uint32_t I2C2BRG;
+volatile uint32_t I2C2CON;
+volatile uint32_t I2C2CONSET;
+volatile uint32_t I2C2RCV;
+volatile uint32_t I2C2STATCLR;
+volatile uint32_t I2C2TRN;
+volatile uint32_t IC1BUF;
+volatile uint32_t IC1CON;
+volatile uint32_t IC1R;
+volatile uint32_t IC2BUF;
+volatile uint32_t IC2CON;
+volatile uint32_t IC2R;
+volatile uint32_t IC3BUF;
+volatile uint32_t IC3CON;
+volatile uint32_t IC3R;
+volatile uint32_t IC4BUF;
+volatile uint32_t IC4CON;
+volatile uint32_t IC4R;
+volatile uint32_t IC5BUF;
+volatile uint32_t IC5CON;
+volatile uint32_t IC5R;
+volatile uint32_t IEC0;
+volatile uint32_t IEC0CLR;
+volatile uint32_t IEC0SET;
+volatile uint32_t IEC1;
+volatile uint32_t IEC1CLR;
+volatile uint32_t IEC1SET;
+volatile uint32_t IFS0;
+volatile uint32_t IFS0CLR;
+volatile uint32_t IFS1;
+volatile uint32_t IFS1CLR;
+volatile uint32_t INT1R;
+volatile uint32_t INT2R;
+volatile uint32_t INT3R;
+volatile uint32_t INT4R;
+volatile uint32_t IPC0CLR;
+volatile uint32_t IPC0SET;
+volatile uint32_t OC1CON;
+volatile uint32_t OC1R;
+volatile uint32_t OC1RS;
+volatile uint32_t OC2CON;
+volatile uint32_t OC2R;
+volatile uint32_t OC2RS;
+volatile uint32_t OC3CON;
+volatile uint32_t OC3R;
+volatile uint32_t OC3RS;
+volatile uint32_t OC4CON;
+volatile uint32_t OC4R;
+volatile uint32_t OC4RS;
+volatile uint32_t OC5CON;
+volatile uint32_t OC5R;
+volatile uint32_t OC5RS;
+volatile uint32_t OSCCON;
+volatile uint32_t OSCCONCLR;
+volatile uint32_t OSCCONSET;
+volatile uint32_t PMD1;
+volatile uint32_t PMD2;
+volatile uint32_t PMD3;
+volatile uint32_t PMD4;
+volatile uint32_t PMD5;
+volatile uint32_t PMD6;
+volatile uint32_t PORTA;
+volatile uint32_t PORTB;
+volatile uint32_t PR1;
+volatile uint32_t PR2;
+volatile uint32_t PR3;
+volatile uint32_t PR4;
+volatile uint32_t PR5;
+volatile uint32_t RPA0R;
+volatile uint32_t RPA1R;
+volatile uint32_t RPA2R;
+volatile uint32_t RPA3R;
+volatile uint32_t RPA4R;
+volatile uint32_t RPB0R;
+volatile uint32_t RPB10R;
+volatile uint32_t RPB11R;
+volatile uint32_t RPB13R;
+volatile uint32_t RPB14R;
+volatile uint32_t RPB15R;
+volatile uint32_t RPB1R;
+volatile uint32_t RPB2R;
+volatile uint32_t RPB3R;
+volatile uint32_t RPB4R;
+volatile uint32_t RPB5R;
+volatile uint32_t RPB6R;
+volatile uint32_t RPB7R;
+volatile uint32_t RPB8R;
+volatile uint32_t RPB9R;
+volatile uint32_t RTCCON;
+volatile uint32_t RTCDATE;
+volatile uint32_t RTCTIME;
+volatile uint32_t SDI1R;
+volatile uint32_t SDI2R;
+volatile uint32_t SPI1BRG;
+volatile uint32_t SPI1BUF;
+volatile uint32_t SPI1CON;
+volatile uint32_t SPI1STAT;
+volatile uint32_t SPI1STATCLR;
+volatile uint32_t SPI2BRG;
+volatile uint32_t SPI2BUF;
+volatile uint32_t SPI2CON;
+volatile uint32_t SPI2STAT;
+volatile uint32_t SPI2STATCLR;
+volatile uint32_t SYSKEY;
+volatile uint32_t T2CON;
+volatile uint32_t TMR1;
+volatile uint32_t TMR2;
+volatile uint32_t TMR3;
+volatile uint32_t TMR4;
+volatile uint32_t TMR5;
+volatile uint32_t U1BRG;
+volatile uint32_t U1RXR;
+volatile uint32_t U2BRG;
+volatile uint32_t U2RXR;
+#define _AD1CON1_DONE_MASK		1u
+#define _AD1CON1_SAMP_MASK		1u
+#define _DCH0CON_CHEN_MASK		1u
+#define _DCH0ECON_CFORCE_MASK		1u
+#define _DCH0ECON_CHSIRQ_POSITION		1u
+#define _DCH0ECON_SIRQEN_MASK		1u
+#define _DCH0INT_CHBCIE_MASK		1u
+#define _DCH0INT_CHBCIF_MASK		1u
+#define _DCH1CON_CHEN_MASK		1u
+#define _DCH1ECON_CHSIRQ_POSITION		1u
+#define _DCH1ECON_SIRQEN_MASK		1u
+#define _DCH1INT_CHBCIE_MASK		1u
+#define _DCH1INT_CHBCIF_MASK		1u
+#define _DCH2CON_CHEN_MASK		1u
+#define _DCH2ECON_CFORCE_MASK		1u
+#define _DCH2ECON_CHSIRQ_POSITION		1u
+#define _DCH2ECON_SIRQEN_MASK		1u
+#define _DCH2INT_CHBCIE_MASK		1u
+#define _DCH2INT_CHBCIF_MASK		1u
+#define _DCH3CON_CHEN_MASK		1u
+#define _DCH3ECON_CHSIRQ_POSITION		1u
+#define _DCH3ECON_SIRQEN_MASK		1u
+#define _DCH3INT_CHBCIE_MASK		1u
+#define _DCH3INT_CHBCIF_MASK		1u
+#define _DMACON_ON_MASK		1u
+#define _IEC0_AD1IE_MASK		1u
+#define _IEC0_CTIE_MASK		1u
+#define _IEC0_CTIE_POSITION		1u
+#define _IEC0_IC1IE_MASK		1u
+#define _IEC0_IC2IE_MASK		1u
+#define _IEC0_IC3IE_MASK		1u
+#define _IEC0_IC4IE_MASK		1u
+#define _IEC0_IC5IE_MASK		1u
+#define _IEC0_OC1IE_MASK		1u
+#define _IEC0_OC2IE_MASK		1u
+#define _IEC0_OC3IE_MASK		1u
+#define _IEC0_OC4IE_MASK		1u
+#define _IEC0_OC5IE_MASK		1u
+#define _IEC0_T1IE_MASK		1u
+#define _IEC0_T3IE_MASK		1u
+#define _IEC0_T4IE_MASK		1u
+#define _IEC0_T5IE_MASK		1u
+#define _IEC1_DMA0IE_MASK		1u
+#define _IEC1_DMA1IE_MASK		1u
+#define _IEC1_DMA2IE_MASK		1u
+#define _IEC1_DMA3IE_MASK		1u
+#define _IEC1_SPI1TXIE_MASK		1u
+#define _IEC1_SPI2TXIE_MASK		1u
+#define _IEC1_U1EIE_MASK		1u
+#define _IEC1_U1RXIE_MASK		1u
+#define _IEC1_U1TXIE_MASK		1u
+#define _IEC1_U2EIE_MASK		1u
+#define _IEC1_U2RXIE_MASK		1u
+#define _IEC1_U2TXIE_MASK		1u
+#define _IFS0_AD1IF_MASK		1u
+#define _IFS0_CTIF_MASK		1u
+#define _IFS1_DMA0IF_MASK		1u
+#define _IFS1_DMA1IF_MASK		1u
+#define _IFS1_DMA2IF_MASK		1u
+#define _IFS1_DMA3IF_MASK		1u
+#define _IFS1_SPI1TXIF_MASK		1u
+#define _IFS1_SPI2TXIF_MASK		1u
+#define _IFS1_U1EIF_MASK		1u
+#define _IFS1_U1RXIF_MASK		1u
+#define _IFS1_U2EIF_MASK		1u
+#define _IFS1_U2RXIF_MASK		1u
+#define _IFS1_U2TXIF_MASK		1u
+#define _IPC0_CTIP_MASK		1u
+#define _IPC0_CTIP_POSITION		1u
+#define _IPC0_CTIS_MASK		1u
+#define _IPC0_CTIS_POSITION		1u
+#define _OSCCON_SLPEN_MASK		1u
+#define _PMD1_AD1MD_MASK		1u
+#define _PMD1_CVRMD_MASK		1u
+#define _PMD2_CMP1MD_MASK		1u
+#define _PMD2_CMP2MD_MASK		1u
+#define _PMD2_CMP3MD_MASK		1u
+#define _PMD3_IC1MD_MASK		1u
+#define _PMD3_IC2MD_MASK		1u
+#define _PMD3_IC3MD_MASK		1u
+#define _PMD3_IC4MD_MASK		1u
+#define _PMD3_IC5MD_MASK		1u
+#define _PMD3_OC1MD_MASK		1u
+#define _PMD3_OC2MD_MASK		1u
+#define _PMD3_OC3MD_MASK		1u
+#define _PMD3_OC4MD_MASK		1u
+#define _PMD3_OC5MD_MASK		1u
+#define _PMD4_T1MD_MASK		1u
+#define _PMD4_T2MD_MASK		1u
+#define _PMD4_T3MD_MASK		1u
+#define _PMD4_T4MD_MASK		1u
+#define _PMD4_T5MD_MASK		1u
+#define _PMD5_I2C1MD_MASK		1u
+#define _PMD5_I2C2MD_MASK		1u
+#define _PMD5_SPI1MD_MASK		1u
+#define _PMD5_SPI2MD_MASK		1u
+#define _PMD5_U1MD_MASK		1u
+#define _PMD5_U2MD_MASK		1u
+#define _PMD6_RTCCMD_MASK		1u
+#define _SPI1CON_ON_MASK		1u
+#define _SPI1STAT_SPIRBE_MASK		1u
+#define _SPI1STAT_SPIROV_MASK		1u
+#define _SPI1STAT_SPITBF_MASK		1u
+#define _SPI1_RX_IRQ		1u
+#define _SPI1_TX_IRQ		1u
+#define _SPI2CON_ON_MASK		1u
+#define _SPI2STAT_SPIROV_MASK		1u
+#define _SPI2_RX_IRQ		1u
+#define _SPI2_TX_IRQ		1u
+#if !defined(MOCK_UART)
+volatile uint32_t U1STA;
+volatile uint32_t U1STACLR;
+volatile uint32_t U1STASET;
+volatile uint32_t U1TXREG;
+volatile uint32_t U1RXREG;
+volatile uint32_t U2STA;
+volatile uint32_t U2STACLR;
+volatile uint32_t U2STASET;
+volatile uint32_t U2TXREG;
+volatile uint32_t U2RXREG;
+#endif
+
+//bit fields
+volatile struct {uint32_t CH0NA; uint32_t CH0SA;} AD1CHSbits;
+volatile struct {uint32_t ASAM; uint32_t DONE; uint32_t FORM; uint32_t ON; uint32_t SSRC;} AD1CON1bits;
+volatile struct {uint32_t ALTS; uint32_t BUFM; uint32_t BUFS; uint32_t CSCNA; uint32_t SMPI; uint32_t VCFG;} AD1CON2bits;
+volatile struct {uint32_t ADCS; uint32_t ADRC; uint32_t SAMC;} AD1CON3bits;
+volatile struct {uint32_t IOLOCK;} CFGCONbits;
+volatile struct {uint32_t PFMWS; uint32_t PREFEN;} CHECONbits;
+volatile struct {uint32_t CCH; uint32_t COE; uint32_t COUT; uint32_t CREF; uint32_t ON;} CM1CONbits;
+volatile struct {uint32_t CCH; uint32_t COE; uint32_t COUT; uint32_t CREF; uint32_t ON;} CM2CONbits;
+volatile struct {uint32_t CCH; uint32_t COE; uint32_t COUT; uint32_t CREF; uint32_t ON;} CM3CONbits;
+volatile struct {uint32_t CVR; uint32_t CVROE; uint32_t CVRR; uint32_t ON;} CVRCONbits;
+volatile struct {uint32_t FPLLIDIV;} DEVCFG2bits;
+volatile struct {uint32_t ACKDT; uint32_t ACKEN; uint32_t ON; uint32_t PEN; uint32_t RCEN; uint32_t RSEN; uint32_t SEN;} I2C1CONbits;
+volatile struct {uint32_t ACKSTAT; uint32_t I2COV; uint32_t TBF; uint32_t TRSTAT;} I2C1STATbits;
+volatile struct {uint32_t ACKDT; uint32_t ACKEN; uint32_t ON; uint32_t PEN; uint32_t RCEN; uint32_t RSEN; uint32_t SEN;} I2C2CONbits;
+volatile struct {uint32_t ACKSTAT; uint32_t I2COV; uint32_t TBF; uint32_t TRSTAT;} I2C2STATbits;
+volatile struct {uint32_t FEDGE; uint32_t ICBNE; uint32_t ICM; uint32_t ICTMR; uint32_t ON;} IC1CONbits;
+volatile struct {uint32_t FEDGE; uint32_t ICBNE; uint32_t ICM; uint32_t ICTMR; uint32_t ON;} IC2CONbits;
+volatile struct {uint32_t FEDGE; uint32_t ICBNE; uint32_t ICM; uint32_t ICTMR; uint32_t ON;} IC3CONbits;
+volatile struct {uint32_t FEDGE; uint32_t ICBNE; uint32_t ICM; uint32_t ICTMR; uint32_t ON;} IC4CONbits;
+volatile struct {uint32_t FEDGE; uint32_t ICBNE; uint32_t ICM; uint32_t ICTMR; uint32_t ON;} IC5CONbits;
+volatile struct {uint32_t IC1IE; uint32_t IC2IE; uint32_t IC3IE; uint32_t IC4IE; uint32_t IC5IE; uint32_t INT0IE; uint32_t INT1IE; uint32_t INT2IE; uint32_t INT3IE; uint32_t INT4IE; uint32_t OC1IE; uint32_t OC2IE; uint32_t OC3IE; uint32_t OC4IE; uint32_t OC5IE; uint32_t T1IE; uint32_t T2IE; uint32_t T3IE; uint32_t T4IE; uint32_t T5IE;} IEC0bits;
+volatile struct {uint32_t CNAIE; uint32_t CNBIE; uint32_t CNCIE; uint32_t SPI1EIE; uint32_t SPI1RXIE; uint32_t SPI1TXIE; uint32_t SPI2EIE; uint32_t SPI2RXIE; uint32_t SPI2TXIE; uint32_t U1RXIE; uint32_t U1TXIE; uint32_t U2RXIE; uint32_t U2TXIE;} IEC1bits;
+volatile struct {uint32_t IC1IF; uint32_t IC2IF; uint32_t IC3IF; uint32_t IC4IF; uint32_t IC5IF; uint32_t INT0IF; uint32_t INT1IF; uint32_t INT2IF; uint32_t INT3IF; uint32_t INT4IF; uint32_t OC1IF; uint32_t OC2IF; uint32_t OC3IF; uint32_t OC4IF; uint32_t OC5IF; uint32_t T1IF; uint32_t T2IF; uint32_t T3IF; uint32_t T4IF; uint32_t T5IF;} IFS0bits;
+volatile struct {uint32_t CNAIF; uint32_t CNBIF; uint32_t CNCIF; uint32_t SPI1EIF; uint32_t SPI1RXIF; uint32_t SPI1TXIF; uint32_t SPI2EIF; uint32_t SPI2RXIF; uint32_t SPI2TXIF; uint32_t U1EIF; uint32_t U1RXIF; uint32_t U1TXIF; uint32_t U2EIF; uint32_t U2RXIF; uint32_t U2TXIF;} IFS1bits;
+volatile struct {uint32_t INT0EP; uint32_t INT1EP; uint32_t INT2EP; uint32_t INT3EP; uint32_t INT4EP; uint32_t MVEC;} INTCONbits;
+volatile struct {uint32_t INT0IP; uint32_t INT0IS;} IPC0bits;
+volatile struct {uint32_t IC1IP; uint32_t IC1IS; uint32_t INT1IP; uint32_t INT1IS; uint32_t OC1IP; uint32_t OC1IS; uint32_t T1IP; uint32_t T1IS;} IPC1bits;
+volatile struct {uint32_t DMA0IP; uint32_t DMA0IS; uint32_t DMA1IP; uint32_t DMA1IS; uint32_t DMA2IP; uint32_t DMA2IS; uint32_t DMA3IP; uint32_t DMA3IS;} IPC10bits;
+volatile struct {uint32_t IC2IP; uint32_t IC2IS; uint32_t INT2IP; uint32_t INT2IS; uint32_t OC2IP; uint32_t OC2IS; uint32_t T2IP; uint32_t T2IS;} IPC2bits;
+volatile struct {uint32_t IC3IP; uint32_t IC3IS; uint32_t INT3IP; uint32_t INT3IS; uint32_t OC3IP; uint32_t OC3IS; uint32_t T3IP; uint32_t T3IS;} IPC3bits;
+volatile struct {uint32_t IC4IP; uint32_t IC4IS; uint32_t INT4IP; uint32_t INT4IS; uint32_t OC4IP; uint32_t OC4IS; uint32_t T4IP; uint32_t T4IS;} IPC4bits;
+volatile struct {uint32_t AD1IP; uint32_t AD1IS; uint32_t IC5IP; uint32_t IC5IS; uint32_t OC5IP; uint32_t OC5IS; uint32_t T5IP; uint32_t T5IS;} IPC5bits;
+volatile struct {uint32_t SPI1IP; uint32_t SPI1IS;} IPC7bits;
+volatile struct {uint32_t CNIP; uint32_t CNIS; uint32_t I2C1IP; uint32_t I2C1IS; uint32_t U1IP; uint32_t U1IS;} IPC8bits;
+volatile struct {uint32_t I2C2IP; uint32_t I2C2IS; uint32_t SPI2IP; uint32_t SPI2IS; uint32_t U2IP; uint32_t U2IS;} IPC9bits;
+volatile struct {uint32_t OC32; uint32_t OCM; uint32_t OCTSEL; uint32_t ON;} OC1CONbits;
+volatile struct {uint32_t OC32; uint32_t OCM; uint32_t OCTSEL; uint32_t ON;} OC2CONbits;
+volatile struct {uint32_t OC32; uint32_t OCM; uint32_t OCTSEL; uint32_t ON;} OC3CONbits;
+volatile struct {uint32_t OC32; uint32_t OCM; uint32_t OCTSEL; uint32_t ON;} OC4CONbits;
+volatile struct {uint32_t OC32; uint32_t OCM; uint32_t OCTSEL; uint32_t ON;} OC5CONbits;
+volatile struct {uint32_t FRCDIV; uint32_t NOSC; uint32_t OSWEN; uint32_t PBDIV;} OSCCONbits;
+volatile struct {uint32_t CAL; uint32_t ON; uint32_t RTCWREN;} RTCCONbits;
+volatile struct {uint32_t CKE; uint32_t CKP; uint32_t ENHBUF; uint32_t MODE16; uint32_t MODE32; uint32_t MSTEN; uint32_t ON; uint32_t SRXISEL; uint32_t STXISEL;} SPI1CONbits;
+volatile struct {uint32_t SPIBUSY; uint32_t SPIRBE; uint32_t SPITBF;} SPI1STATbits;
+volatile struct {uint32_t CKE; uint32_t CKP; uint32_t ENHBUF; uint32_t MODE16; uint32_t MODE32; uint32_t MSTEN; uint32_t ON; uint32_t SRXISEL; uint32_t STXISEL;} SPI2CONbits;
+volatile struct {uint32_t SPIBUSY; uint32_t SPIRBE; uint32_t SPITBF;} SPI2STATbits;
+volatile struct {uint32_t T32; uint32_t TCKPS; uint32_t TCS; uint32_t TGATE; uint32_t TON;} T1CONbits;
+volatile struct {uint32_t T32; uint32_t TCKPS; uint32_t TCS; uint32_t TGATE; uint32_t TON;} T2CONbits;
+volatile struct {uint32_t T32; uint32_t TCKPS; uint32_t TCS; uint32_t TGATE; uint32_t TON;} T3CONbits;
+volatile struct {uint32_t T32; uint32_t TCKPS; uint32_t TCS; uint32_t TGATE; uint32_t TON;} T4CONbits;
+volatile struct {uint32_t T32; uint32_t TCKPS; uint32_t TCS; uint32_t TGATE; uint32_t TON;} T5CONbits;
+volatile struct {uint32_t ABAUD; uint32_t BRGH; uint32_t IREN; uint32_t LPBACK; uint32_t PDSEL; uint32_t PDSEL0; uint32_t PDSEL1; uint32_t RTSMD; uint32_t RXINV; uint32_t STSEL; uint32_t UARTEN; uint32_t UEN; uint32_t UEN1; uint32_t WAKE;} U1MODEbits;
+#if !defined(MOCK_UART)
+volatile struct {uint32_t TRMT; uint32_t URXDA; uint32_t URXEN; uint32_t URXISEL; uint32_t URXISEL0; uint32_t URXISEL1; uint32_t UTXBF; uint32_t UTXBRK; uint32_t UTXEN; uint32_t UTXINV; uint32_t UTXISEL; uint32_t UTXISEL0; uint32_t UTXISEL1;} U1STAbits;
+#endif
+volatile struct {uint32_t ABAUD; uint32_t BRGH; uint32_t IREN; uint32_t LPBACK; uint32_t PDSEL; uint32_t PDSEL0; uint32_t PDSEL1; uint32_t RTSMD; uint32_t RXINV; uint32_t STSEL; uint32_t UARTEN; uint32_t UEN; uint32_t UEN0; uint32_t UEN1; uint32_t WAKE;} U2MODEbits;
+#if !defined(MOCK_UART)
+volatile struct {uint32_t TRMT; uint32_t URXDA; uint32_t URXEN; uint32_t URXISEL; uint32_t URXISEL0; uint32_t URXISEL1; uint32_t UTXBF; uint32_t UTXBRK; uint32_t UTXEN; uint32_t UTXINV; uint32_t UTXISEL; uint32_t UTXISEL0; uint32_t UTXISEL1;} U2STAbits;
+#endif
+
+#endif	//_MOCK_XC_H
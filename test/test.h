@@ -0,0 +1,13 @@
+//host test helpers: include after pic32duino.c
+#include <stdio.h>
+
+static uint32_t _test_run=0, _test_fail=0;		//checks run / failed
+
+//count a check, report it if it failed
+#define TEST(c)			do {_test_run += 1; if (!(c)) {_test_fail += 1; printf("%s:%d: %s\n", __FILE__, __LINE__, #c);}} while (0)
+//summary line, exit code for main()
+#define TEST_END()		(printf("%s: %lu checks, %lu failed\n", __FILE__, (unsigned long) _test_run, (unsigned long) _test_fail), _test_fail != 0)
+
+//the library's main() is renamed, the sketch is empty
+void setup(void) {}
+void loop(void) {}
@@ -0,0 +1,131 @@
+//host test: the adc scan sampler's double buffer, driven through its end of scan isr
+//BUFS half selection, the adcScanGet() handoff, the overrun counter, AD1IE as adcScanGet() leaves it
+#include "../pic32duino.h"
+#define main pic32duino_main
+#include "../pic32duino.c"
+#undef main
+#include "test.h"
+
+#define NCH					3				//channels scanned: AN0, AN1, AN4
+#define CHMASK				((1 << 0) | (1 << 1) | (1 << 4))
+
+//IEC0SET / IEC0CLR writes into IEC0, as the chip does: clear then set, the order the driver writes them in
+static void _iec(void) {
+	IEC0 = (IEC0 & ~IEC0CLR) | IEC0SET;
+	IEC0CLR = IEC0SET = 0;
+}
+#define AD1IE				((IEC0 & _IEC0_AD1IE_MASK) != 0)
+
+//sample k of channel i in the half of ADC1BUF the isr is to read
+static uint16_t _sample(uint32_t k, uint8_t i) {return (k * 16 + i) & 0x3ff;}
+
+//one end of scan: the adc filled one 8-word half and moves to the other (BUFS toggles), the isr reads the filled one
+//the half being filled holds garbage
+static uint32_t _k=0;								//sample sets so far
+static void _scan(void) {
+	uint8_t i, rd = AD1CON2bits.BUFS ? 0 : 8;		//1->adc filling 8..15, read 0..7
+
+	for (i = 0; i < 8; i++) {
+		mock_adcbuf[(rd + i) * 4] = (i < NCH) ? _sample(_k, i) : 0x3ff;
+		mock_adcbuf[((rd ^ 8) + i) * 4] = 0xdead;
+	}
+	_ADCInterrupt();
+	_k += 1;
+	AD1CON2bits.BUFS ^= 1;
+}
+
+//the sample sets k0.. in a half handed over
+static uint8_t _check(const uint16_t *buf, uint32_t k0) {
+	uint32_t k;
+	uint8_t i, ok = 1;
+
+	for (k = 0; k < ADC_SCANDEPTH; k++)
+		for (i = 0; i < NCH; i++) if (buf[k * NCH + i] != _sample(k0 + k, i)) ok = 0;
+	return ok;
+}
+
+static void _start(void) {
+	IEC0 = 0;
+	adcScanInit(CHMASK, 1000);
+	_iec();
+	_k = 0;
+	AD1CON2bits.BUFS = 0;
+}
+
+//the scan is set up for the channels asked for, isr on
+static void _testInit(void) {
+	_start();
+	TEST(AD1CSSL == CHMASK);
+	TEST(AD1CON2bits.SMPI == NCH - 1);
+	TEST(AD1CON2bits.BUFM == 1 && AD1CON2bits.CSCNA == 1);
+	TEST(AD1IE);
+	TEST(adcScanGet() == NULL);						//nothing filled yet
+	_iec();
+	TEST(AD1IE);									//still on
+}
+
+//a full half is handed over once, in order, from the half BUFS says is not being filled
+//it stays intact while the isr fills the other half
+static void _testHandoff(void) {
+	uint16_t *buf, *buf2;
+	uint32_t i;
+
+	_start();
+	for (i = 0; i < ADC_SCANDEPTH - 1; i++) _scan();
+	TEST(adcScanGet() == NULL);						//one set short
+	_scan();
+	buf = adcScanGet();
+	_iec();
+	TEST(buf != NULL);
+	if (buf == NULL) return;
+	TEST(_check(buf, 0));
+	TEST(AD1IE);									//isr back on
+	TEST(adcScanGet() == NULL);						//handed over once
+	for (i = 0; i < ADC_SCANDEPTH - 1; i++) _scan();
+	TEST(_check(buf, 0));							//untouched while the other half fills
+	_scan();
+	buf2 = adcScanGet();
+	TEST(buf2 != NULL && buf2 != buf);				//the other half
+	if (buf2) TEST(_check(buf2, ADC_SCANDEPTH));
+	TEST(adcScanOverruns() == 0);
+}
+
+//a half not collected before the next one fills is an overrun, the newest one is handed over
+static void _testOverrun(void) {
+	uint16_t *buf;
+	uint32_t i;
+
+	_start();
+	for (i = 0; i < 3 * ADC_SCANDEPTH; i++) _scan();
+	TEST(adcScanOverruns() == 2);
+	buf = adcScanGet();
+	TEST(buf != NULL);
+	if (buf) TEST(_check(buf, 2 * ADC_SCANDEPTH));
+	for (i = 0; i < ADC_SCANDEPTH; i++) _scan();
+	TEST(adcScanGet() != NULL);						//collected in time
+	TEST(adcScanOverruns() == 2);
+}
+
+//adcScanGet() with no scan running leaves the adc isr off
+static void _testStopped(void) {
+	_start();
+	adcScanStop();
+	_iec();
+	TEST(!AD1IE);
+	TEST(adcScanGet() == NULL);
+	_iec();
+	TEST(!AD1IE);
+	adcDeinit();
+	_iec();
+	adcScanGet();
+	_iec();
+	TEST(!AD1IE);
+}
+
+int main(void) {
+	_testInit();
+	_testHandoff();
+	_testOverrun();
+	_testStopped();
+	return TEST_END();
+}
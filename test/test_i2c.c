@@ -0,0 +1,219 @@
+//host test: the i2c1 / i2c2 transaction engines against a simulated bus and slave, driven through their isrs
+//address nack, data nack, bus collision, timeout, repeated start, queue chaining and a full queue
+#include "../pic32duino.h"
+#define main pic32duino_main
+#include "../pic32duino.c"
+#undef main
+#include <string.h>
+#include "test.h"
+
+//one i2c engine: the registers the bus reacts to, its isr and api
+typedef struct {
+	volatile uint32_t *conset, *trn, *rcv, *ackstat, *ackdt;
+	uint32_t mif, bif;								//IFS1 master / bus collision flags
+	void (*isr)(void);
+	uint8_t (*xfer)(uint8_t addr, const uint8_t *wbuf, uint16_t wlen, uint8_t *rbuf, uint16_t rlen, void (*callback)(uint8_t status));
+	uint8_t (*busy)(void);
+	uint8_t (*status)(void);
+} I2C_Engine;
+static const I2C_Engine _i2c[2] = {
+	{&I2C1CONSET, &I2C1TRN, &I2C1RCV, &I2C1STATbits.ACKSTAT, &I2C1CONbits.ACKDT, _IFS1_I2C1MIF_MASK, _IFS1_I2C1BIF_MASK, _I2C1Interrupt, i2c1Xfer, i2c1XferBusy, i2c1XferStatus},
+	{&I2C2CONSET, &I2C2TRN, &I2C2RCV, &I2C2STATbits.ACKSTAT, &I2C2CONbits.ACKDT, _IFS1_I2C2MIF_MASK, _IFS1_I2C2BIF_MASK, _I2C2Interrupt, i2c2Xfer, i2c2XferBusy, i2c2XferStatus},
+};
+static const I2C_Engine *_e;
+
+#define TRN_NONE			0xffff			//nothing written to I2CxTRN
+#define SLAVE				0x50			//the one slave on the bus
+
+//the slave: a register file, the first byte written is the register pointer
+static uint8_t _mem[256], _ptr;
+static uint8_t _phase;						//0->address next, 1->register pointer next, 2->data
+static uint16_t _nwr;						//data bytes written in this transaction
+static uint16_t _nackAt=0xffff;				//the slave nacks this data byte
+
+//what happened on the bus: S start, R repeated start, P stop, B bus collision, xx+ / xx- byte acked / nacked
+static char _log[512];
+static void _put(const char *s) {
+	if (_log[0]) strcat(_log, " ");
+	strcat(_log, s);
+}
+
+//bus events until the next interrupt, 0 if the engine left nothing to do
+static uint16_t _nev, _bclAt=0xffff;		//events so far, bus collision at this one
+static uint8_t _step(void) {
+	char s[8];
+	uint8_t b, ack;
+
+	if (_nev++ == _bclAt) {						//another master wins the bus
+		*_e->conset = 0; *_e->trn = TRN_NONE;
+		_put("B");
+		_phase = 0;
+		IFS1 = _e->bif;
+		_e->isr();
+		return 1;
+	}
+	if (*_e->conset & _I2C1CON_SEN_MASK) {_put("S"); _phase = 0;}
+	else if (*_e->conset & _I2C1CON_RSEN_MASK) {_put("R"); _phase = 0;}
+	else if (*_e->conset & _I2C1CON_PEN_MASK) _put("P");
+	else if (*_e->conset & _I2C1CON_RCEN_MASK) {	//slave sends the byte at the pointer
+		*_e->rcv = _mem[_ptr++];
+		sprintf(s, "%02x", (unsigned) *_e->rcv);
+		_put(s);
+	} else if (*_e->conset & _I2C1CON_ACKEN_MASK) strcat(_log, *_e->ackdt == I2C_NOACK ? "-" : "+");
+	else if (*_e->trn != TRN_NONE) {			//master sends a byte
+		b = *_e->trn;
+		if (_phase == 0) {ack = ((b >> 1) == SLAVE); _phase = 1; _nwr = 0;}
+		else if (_phase == 1) {ack = 1; _ptr = b; _phase = 2;}
+		else {ack = (_nwr != _nackAt); if (ack) _mem[_ptr++] = b; _nwr += 1;}
+		*_e->ackstat = !ack;
+		sprintf(s, "%02x%c", b, ack ? '+' : '-');
+		_put(s);
+	} else return 0;
+	*_e->conset = 0; *_e->trn = TRN_NONE;
+	IFS1 = _e->mif;
+	_e->isr();
+	return 1;
+}
+
+//run the bus until the engine is idle
+static void _run(void) {
+	uint16_t n = 0;
+
+	while (_step() && (n++ < 1000)) continue;
+}
+
+//completion callbacks: statuses in the order they ran
+static uint8_t _st[16], _nst;
+static void _cb(uint8_t status) {_st[_nst++] = status;}
+
+//engine n, quiet bus, known slave contents
+static void _reset(uint8_t n) {
+	uint16_t i;
+
+	_e = &_i2c[n];
+	if (n == 0) i2c1Init(100000ul); else i2c2Init(100000ul);
+	*_e->conset = 0; *_e->trn = TRN_NONE;
+	_log[0] = 0; _nst = 0; _nev = 0; _bclAt = 0xffff; _nackAt = 0xffff;
+	for (i = 0; i < 256; i++) _mem[i] = i ^ 0x5a;
+}
+
+//write, then read back after a repeated start, then read only
+static void _testWriteRead(uint8_t n) {
+	static const uint8_t w[3] = {0x10, 0x11, 0x22};
+	uint8_t r[3] = {0, 0, 0}, p = 0x10;
+
+	_reset(n);
+	TEST(_e->xfer(SLAVE, w, 3, NULL, 0, _cb) == 1);
+	_run();
+	TEST(strcmp(_log, "S a0+ 10+ 11+ 22+ P") == 0);
+	TEST(_mem[0x10] == 0x11 && _mem[0x11] == 0x22);
+	_log[0] = 0;
+	TEST(_e->xfer(SLAVE, &p, 1, r, 3, _cb) == 1);		//register read: write the pointer, repeated start, read
+	_run();
+	TEST(strcmp(_log, "S a0+ 10+ R a1+ 11+ 22+ 48- P") == 0);
+	TEST(r[0] == 0x11 && r[1] == 0x22 && r[2] == 0x48);
+	_log[0] = 0;
+	TEST(_e->xfer(SLAVE, NULL, 0, r, 2, _cb) == 1);		//read only: no write phase
+	_run();
+	TEST(strcmp(_log, "S a1+ 49+ 4e- P") == 0);
+	TEST(_nst == 3 && _st[0] == I2C_OK && _st[1] == I2C_OK && _st[2] == I2C_OK);
+	TEST(_e->busy() == 0 && _e->status() == I2C_OK);
+}
+
+//no slave at the address: stop right after the address, for a write and for a read
+static void _testAddrNack(uint8_t n) {
+	uint8_t w = 1, r[2] = {0xee, 0xee};
+
+	_reset(n);
+	TEST(_e->xfer(0x33, &w, 1, NULL, 0, _cb) == 1);
+	TEST(_e->xfer(0x33, NULL, 0, r, 2, _cb) == 1);
+	_run();
+	TEST(strcmp(_log, "S 66- P S 67- P") == 0);
+	TEST(_nst == 2 && _st[0] == I2C_ERR_NACK && _st[1] == I2C_ERR_NACK);
+	TEST(r[0] == 0xee);									//nothing read
+	TEST(_e->status() == I2C_ERR_NACK);
+}
+
+//the slave refuses a data byte: the rest is not sent, no read phase
+static void _testDataNack(uint8_t n) {
+	static const uint8_t w[4] = {0x20, 1, 2, 3};
+	uint8_t r[1] = {0xee};
+
+	_reset(n);
+	_nackAt = 1;										//second data byte
+	TEST(_e->xfer(SLAVE, w, 4, r, 1, _cb) == 1);
+	_run();
+	TEST(strcmp(_log, "S a0+ 20+ 01+ 02- P") == 0);
+	TEST(_nst == 1 && _st[0] == I2C_ERR_NACK);
+	TEST(r[0] == 0xee);
+}
+
+//a bus collision ends the transaction at once, the next one in the queue runs
+static void _testBcl(uint8_t n) {
+	static const uint8_t w[2] = {0x30, 0x77};
+
+	_reset(n);
+	_bclAt = 2;											//while the first data byte is sent
+	TEST(_e->xfer(SLAVE, w, 2, NULL, 0, _cb) == 1);
+	TEST(_e->xfer(SLAVE, w, 2, NULL, 0, _cb) == 1);
+	_run();
+	TEST(strcmp(_log, "S a0+ B S a0+ 30+ 77+ P") == 0);
+	TEST(_nst == 2 && _st[0] == I2C_ERR_BCL && _st[1] == I2C_OK);
+	TEST(_e->busy() == 0);
+}
+
+//no bus progress for I2C_TIMEOUT ms: the module is reset and the transaction aborted, the next one runs
+static void _testTimeout(uint8_t n) {
+	static const uint8_t w[1] = {0x40};
+	uint32_t tmo = I2C_TIMEOUT * cyclesPerMillisecond();
+
+	_reset(n);
+	TEST(_e->xfer(SLAVE, w, 1, NULL, 0, _cb) == 1);
+	TEST(_e->xfer(SLAVE, w, 1, NULL, 0, _cb) == 1);
+	_step();											//start sent, the slave holds the bus from here
+	mock_count += tmo / 2 - 10;							//not quite timed out
+	TEST(_e->busy() == 2 && _nst == 0);
+	mock_count += 20;
+	*_e->conset = 0; *_e->trn = TRN_NONE;				//the reset drops what the module was doing
+	TEST(_e->busy() == 1);
+	TEST(_nst == 1 && _st[0] == I2C_ERR_TIMEOUT);
+	TEST(_e->status() == I2C_ERR_TIMEOUT);
+	_run();
+	TEST(strcmp(_log, "S S a0+ 40+ P") == 0);
+	TEST(_nst == 2 && _st[1] == I2C_OK && _e->busy() == 0);
+}
+
+//transactions queued behind a running one run in order, a full queue refuses more
+static void _testQueue(uint8_t n) {
+	static const uint8_t w[2] = {0x50, 0x99};
+	uint8_t i, r[1];
+
+	_reset(n);
+	for (i = 0; i < I2C_QSIZE; i++) TEST(_e->xfer((i == 1) ? 0x33 : SLAVE, w, 2, NULL, 0, _cb) == 1);
+	TEST(_e->busy() == I2C_QSIZE);
+	TEST(_e->xfer(SLAVE, w, 2, NULL, 0, _cb) == 0);		//full
+	_step(); _step();									//first one under way
+	TEST(_e->busy() == I2C_QSIZE);
+	_run();
+	TEST(_e->busy() == 0 && _nst == I2C_QSIZE);
+	for (i = 0; i < I2C_QSIZE; i++) TEST(_st[i] == ((i == 1) ? I2C_ERR_NACK : I2C_OK));
+	TEST(_e->xfer(SLAVE, NULL, 0, r, 1, NULL) == 1);	//idle engine restarts, no callback
+	_run();
+	TEST(_e->busy() == 0 && _nst == I2C_QSIZE && r[0] == (0x51 ^ 0x5a));	//the pointer is past the byte written
+}
+
+int main(void) {
+	uint8_t n;
+
+	OSCCON = CLKCOSC_FRC;
+	SystemCoreClockUpdate();
+	for (n = 0; n < 2; n++) {
+		_testWriteRead(n);
+		_testAddrNack(n);
+		_testDataNack(n);
+		_testBcl(n);
+		_testTimeout(n);
+		_testQueue(n);
+	}
+	return TEST_END();
+}
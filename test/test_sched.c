@@ -0,0 +1,172 @@
+//host test: the scheduler's timer wheel on a stubbed coreticks()
+//cascades across all 3 levels, coreticks() / jiffy counter wraps, cancel from a running task, periodic tasks without drift,
+//rescaling on a clock change
+#include "../pic32duino.h"
+#define main pic32duino_main
+#include "../pic32duino.c"
+#undef main
+#include "test.h"
+
+#define J					((uint32_t) SCHED_JIFFY)
+
+//coreticks() = 2 * core timer count
+static void _set(uint32_t t) {mock_count = t / 2;}
+static void _step(uint32_t t) {mock_count += t / 2;}
+
+//empty wheel, jiffy 0 at coreticks() = t
+static void _reset(uint32_t t) {
+	_set(t);
+	_sched_init = 0;
+	_schedInit();
+}
+
+//run the wheel one jiffy at a time up to n jiffies from now
+static void _run(uint32_t n) {
+	while (n--) {_step(J); schedRun();}
+}
+
+//coreticks() at each run of a task
+#define NRUN				8
+static uint32_t _ran[NRUN], _nran[NRUN];
+static void _log(uint8_t i) {if (_nran[i] < 1) _ran[i] = coreticks(); _nran[i] += 1;}
+static void _fn0(void) {_log(0);}
+static void _fn1(void) {_log(1);}
+static void _fn2(void) {_log(2);}
+static void _fn3(void) {_log(3);}
+static void _fn4(void) {_log(4);}
+static void _clear(void) {uint8_t i; for (i=0; i<NRUN; i++) _ran[i] = _nran[i] = 0;}
+
+//one shots at each level of the wheel and beyond it run in the jiffy they are due, once
+static void _testCascade(uint32_t t0) {
+	static const uint32_t dly[5] = {5, SCHED_SLOTS + 3, SCHED_SLOTS * SCHED_SLOTS + 70, SCHED_SLOTS * SCHED_SLOTS * SCHED_SLOTS - 1, 300000ul};	//jiffies
+	static void (* const fn[5])(void) = {_fn0, _fn1, _fn2, _fn3, _fn4};
+	uint8_t i;
+
+	_reset(t0);
+	_clear();
+	for (i=0; i<5; i++) TEST(schedAfter(dly[i] * J - J / 2, fn[i]) != SCHED_NONE);	//rounded up to the jiffy
+	_run(300001ul);
+	for (i=0; i<5; i++) {
+		TEST(_nran[i] == 1);
+		TEST(_ran[i] == t0 + dly[i] * J);
+	}
+}
+
+//the jiffy counter wraps too
+static void _testJiffyWrap(void) {
+	_reset(0);
+	_sched_jiffies = 0xfffffffful - 100;		//as if the wheel had run for 2^32 jiffies
+	_clear();
+	schedAfter(50 * J, _fn0);
+	schedAfter(5000 * J, _fn1);
+	_run(6000);
+	TEST((_nran[0] == 1) && (_ran[0] == 50 * J));
+	TEST((_nran[1] == 1) && (_ran[1] == 5000 * J));
+}
+
+//a task cancels another one due in the same jiffy, a periodic task cancels itself
+static uint8_t _id0, _id1, _idp;
+static void _cancel0(void) {_log(0); schedCancel(_id1);}
+static void _cancel1(void) {_log(1); schedCancel(_id0);}
+static void _cancelSelf(void) {_log(2); if (_nran[2] == 3) schedCancel(_idp);}
+static void _readd(void) {_log(3); schedAfter(J, _fn4);}
+static void _testCancel(void) {
+	uint8_t i, n;
+
+	_reset(0);
+	_clear();
+	_id0 = schedAfter(10 * J, _cancel0);
+	_id1 = schedAfter(10 * J, _cancel1);
+	_idp = schedEvery(4 * J, _cancelSelf);
+	schedAfter(20 * J, _readd);				//adds a task from a running one
+	_run(100);
+	TEST(_nran[0] + _nran[1] == 1);			//whichever ran first cancelled the other
+	TEST(_nran[2] == 3);
+	TEST((_nran[3] == 1) && (_nran[4] == 1) && (_ran[4] == 21 * J));
+	for (i=n=0; i<SCHED_MAX; i++) n += (_sched_task[i].fn != NULL);
+	TEST(n == 0);							//all task slots free again
+	schedCancel(SCHED_NONE);				//out of range: ignored
+	schedCancel(_id0);						//cancelled twice: ignored
+}
+
+//a periodic task runs every period from the first run on, however late schedRun() is called
+static uint32_t _due, _late;
+static void _periodic(void) {
+	_nran[0] += 1;
+	_due += 37 * J;
+	if ((int32_t) (coreticks() - _due) < 0) _late += 1;	//ran early
+}
+static void _testDrift(uint32_t t0) {
+	uint32_t i, seed = 1;
+
+	_reset(t0);
+	_clear();
+	_late = 0;
+	_due = t0;
+	schedEvery(37 * J - 100, _periodic);		//rounded up to 37 jiffies
+	for (i=0; i<20000; i++) {					//called 0..3 jiffies apart, at any phase
+		seed = seed * 1664525ul + 1013904223ul;
+		_step((seed >> 8) % (3 * J));
+		schedRun();
+	}
+	_step(37 * J);								//run out the last period
+	schedRun();
+	i = coreticks() - t0;
+	TEST(_nran[0] == i / (37 * J));				//as many runs as whole periods
+	TEST(_late == 0);
+}
+
+//a clock change keeps the tasks in time: what is left of a delay and the period are rescaled
+static uint32_t _prev, _gap;
+static void _gapper(void) {uint32_t t = coreticks(); _gap = t - _prev; _prev = t;}
+static void _testRebase(void) {
+	uint32_t hz = SystemCoreClock;
+
+	_reset(0);
+	_clear();
+	_prev = 0;
+	schedEvery(10 * J, _gapper);
+	schedAfter(100 * J, _fn0);
+	_run(40);									//4 periods, 60 jiffies left on the one shot
+	TEST(_gap == 10 * J);
+	SystemCoreClock = hz / 5;					//5x slower: 10 jiffies -> 2, 60 -> 12
+	_schedRebase();
+	_run(12);
+	TEST((_nran[0] == 1) && (_ran[0] == 52 * J));
+	TEST(_gap == 2 * J);
+	SystemCoreClock = hz / 3;					//back up: 2 jiffies at hz / 5 -> 3.33, from the period as requested
+	_schedRebase();
+	_run(10);
+	TEST(_gap == 3 * J);
+	SystemCoreClock = hz;
+	_schedRebase();
+	_run(30);
+	TEST(_gap == 10 * J);						//no error build-up
+	//run from the core timer: one core timer period per jiffy at any clock
+	schedAttachCoreTimer();
+	SystemCoreClock = hz * 2;
+	_coretimerRebase();							//either order
+	_schedRebase();
+	TEST(_coretimer_pr == J / 2);
+	SystemCoreClock = hz;
+	_schedRebase();
+	_coretimerRebase();
+	TEST(_coretimer_pr == J / 2);
+	coretimerAttachISR(empty_handler);
+	coretimer_setpr(1000);						//any other period is kept in time
+	SystemCoreClock = hz * 4;
+	_coretimerRebase();
+	TEST(_coretimer_pr == 4 * 1000 / 2);
+	SystemCoreClock = hz;
+}
+
+int main(void) {
+	_testCascade(0);
+	_testCascade(0 - 1000 * J);				//coreticks() wraps during the run
+	_testJiffyWrap();
+	_testCancel();
+	_testDrift(0);
+	_testDrift(0 - 5 * J);
+	_testRebase();
+	return TEST_END();
+}
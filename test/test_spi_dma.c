@@ -0,0 +1,170 @@
+//host test: the spi1 / spi2 dma transfer engine against a modelled dma controller and slave
+//queue chaining (also from a callback), rx only (0xff sent), tx only (done only once the last byte is shifted out),
+//the busy count, a full queue and the completion callbacks
+#include "../pic32duino.h"
+#define main pic32duino_main
+#include "../pic32duino.c"
+#undef main
+#include "test.h"
+
+//one spi engine: its dma channels, isrs and api
+typedef struct {
+	volatile uint32_t *txcon, *rxcon;				//DCHxCONSET: CHEN written -> channel armed
+	volatile uint32_t *txssa, *txssiz, *rxdsa, *rxdsiz;
+	void (*rxisr)(void), (*txisr)(void), (*spiisr)(void);	//rx channel done, tx channel done, spi tx
+	uint8_t (*xfer)(const uint8_t *tx, uint8_t *rx, uint16_t len, void (*callback)(void));
+	uint8_t (*busy)(void);
+} SPI_Engine;
+static const SPI_Engine _spi[2] = {
+	{&DCH0CONSET, &DCH1CONSET, &DCH0SSA, &DCH0SSIZ, &DCH1DSA, &DCH1DSIZ, _DMA1Interrupt, _DMA0Interrupt, _SPI1Interrupt, spi1Transfer, spi1TransferBusy},
+	{&DCH2CONSET, &DCH3CONSET, &DCH2SSA, &DCH2SSIZ, &DCH3DSA, &DCH3DSIZ, _DMA3Interrupt, _DMA2Interrupt, _SPI2Interrupt, spi2Transfer, spi2TransferBusy},
+};
+
+//buffers the dma may be pointed at: KVA_TO_PA() keeps the low 32 bits of the address only
+#define LEN					40
+static uint8_t _tx[4][LEN], _rx[4][LEN];
+static uint8_t *_pa(uint32_t pa) {
+	uint8_t i;
+
+	for (i = 0; i < 4; i++) {
+		if (KVA_TO_PA(_tx[i]) == pa) return _tx[i];
+		if (KVA_TO_PA(_rx[i]) == pa) return _rx[i];
+	}
+	return NULL;
+}
+
+//the wire: bytes sent (mosi), the slave answers with a running count (miso)
+static uint8_t _mosi[8 * LEN], _miso=0;
+static uint16_t _nmosi=0;
+
+//completion callbacks, in the order they ran
+static uint8_t _done[16], _ndone=0;
+static void _cb0(void) {_done[_ndone++] = 0;}
+static void _cb1(void) {_done[_ndone++] = 1;}
+static void _cb2(void) {_done[_ndone++] = 2;}
+static void _cb3(void) {_done[_ndone++] = 3;}
+
+//run the armed transfer to its end: the dma moves the bytes, then the isrs the hardware would raise
+//returns 0 if no transfer was armed
+static uint8_t _dmaRun(const SPI_Engine *e) {
+	uint8_t *src, *dst = NULL, rx, n0 = _ndone;
+	uint16_t i, len;
+
+	if (*e->txcon == 0) return 0;					//tx channel not armed
+	rx = (*e->rxcon != 0);
+	*e->txcon = *e->rxcon = 0;						//to see the next arming
+	src = _pa(*e->txssa);
+	len = *e->txssiz;
+	TEST(src != NULL);
+	if (src == NULL) return 0;
+	if (rx) {
+		dst = _pa(*e->rxdsa);
+		TEST(dst != NULL && *e->rxdsiz == len);
+		if (dst == NULL) return 0;
+	}
+	for (i = 0; i < len; i++) {
+		_mosi[_nmosi++] = src[i];					//sent before the byte in its place is received
+		if (rx) dst[i] = _miso;
+		_miso += 1;
+	}
+	if (rx) e->rxisr();								//rx channel block done
+	else {
+		e->txisr();									//tx channel block done: last bytes still in the fifo
+		TEST(_ndone == n0);							//not complete yet
+		e->spiisr();								//last byte shifted out
+	}
+	return 1;
+}
+
+//start from an idle engine, an empty wire and no callbacks
+static void _reset(uint8_t n) {
+	uint8_t i;
+
+	if (n == 0) spi1Init(F_SPI1); else spi2Init(F_SPI1);
+	DCH0CONSET = DCH1CONSET = DCH2CONSET = DCH3CONSET = 0;
+	_nmosi = 0; _miso = 0; _ndone = 0;
+	for (i = 0; i < 4; i++) {memset(_tx[i], 0x10 * i, LEN); memset(_rx[i], 0xaa, LEN);}
+}
+
+//full duplex, rx only, tx only, queued while the first one runs: each starts once the previous one is done
+static void _testChain(uint8_t n) {
+	const SPI_Engine *e = &_spi[n];
+	uint16_t i;
+
+	_reset(n);
+	TEST(e->busy() == 0);
+	TEST(e->xfer(_tx[0], _rx[0], 10, _cb0) == 1);	//starts at once
+	TEST(*e->txcon != 0 && *e->rxcon != 0);
+	TEST(e->xfer(NULL, _rx[1], 20, _cb1) == 1);		//rx only
+	TEST(e->xfer(_tx[2], NULL, 30, _cb2) == 1);		//tx only
+	TEST(e->busy() == 3);
+	for (i = 0; i < 20; i++) TEST(_rx[1][i] == 0xff);	//filled when queued, before it runs
+
+	TEST(_dmaRun(e) == 1);
+	TEST(_ndone == 1 && _done[0] == 0 && e->busy() == 2);
+	for (i = 0; i < 10; i++) TEST(_mosi[i] == 0x00 && _rx[0][i] == i);
+	TEST(_rx[0][10] == 0xaa);						//nothing past len
+
+	TEST(_dmaRun(e) == 1);							//rx only: 0xff on the wire
+	TEST(_ndone == 2 && _done[1] == 1 && e->busy() == 1);
+	for (i = 0; i < 20; i++) TEST(_mosi[10 + i] == 0xff && _rx[1][i] == 10 + i);
+
+	TEST(_dmaRun(e) == 1);							//tx only
+	TEST(_ndone == 3 && _done[2] == 2 && e->busy() == 0);
+	for (i = 0; i < 30; i++) TEST(_mosi[30 + i] == 0x20);
+	for (i = 0; i < LEN; i++) TEST(_rx[2][i] == 0xaa);	//untouched
+
+	TEST(_dmaRun(e) == 0);							//engine idle
+	TEST(e->xfer(_tx[3], _rx[3], 5, NULL) == 1);	//idle engine restarts, no callback
+	TEST(_dmaRun(e) == 1 && e->busy() == 0 && _ndone == 3);
+}
+
+//a full queue refuses more, nothing to do is refused
+static void _testFull(uint8_t n) {
+	const SPI_Engine *e = &_spi[n];
+	uint8_t i;
+
+	_reset(n);
+	TEST(e->xfer(_tx[0], _rx[0], 0, _cb0) == 0);
+	TEST(e->xfer(NULL, NULL, 4, _cb0) == 0);
+	TEST(e->busy() == 0);
+	for (i = 0; i < SPI_DMAQSIZE; i++) TEST(e->xfer(_tx[i & 3], NULL, 4, _cb0) == 1);
+	TEST(e->busy() == SPI_DMAQSIZE);
+	TEST(e->xfer(_tx[0], NULL, 4, _cb1) == 0);		//full
+	TEST(_dmaRun(e) == 1);
+	TEST(e->xfer(_tx[0], NULL, 4, _cb1) == 1);		//room again
+	while (_dmaRun(e)) continue;
+	TEST(e->busy() == 0 && _ndone == SPI_DMAQSIZE + 1 && _done[SPI_DMAQSIZE] == 1);
+}
+
+//a callback queues the next transfer (e.g. the data phase after a command): chained from the isr
+static uint8_t _eng;
+static void _cbQueue(void) {
+	_done[_ndone++] = 9;
+	TEST(_spi[_eng].xfer(NULL, _rx[3], 8, _cb3) == 1);
+}
+static void _testCallbackQueue(uint8_t n) {
+	const SPI_Engine *e = &_spi[n];
+
+	_reset(n);
+	_eng = n;
+	TEST(e->xfer(_tx[1], NULL, 3, _cbQueue) == 1);
+	TEST(_dmaRun(e) == 1);
+	TEST(_ndone == 1 && e->busy() == 1);
+	TEST(*e->txcon != 0);							//next one already running
+	TEST(_dmaRun(e) == 1);
+	TEST(_ndone == 2 && _done[1] == 3 && e->busy() == 0);
+	TEST(_rx[3][0] == 3 && _rx[3][7] == 10);
+}
+
+int main(void) {
+	uint8_t n;
+
+	SPI1STATbits.SPIRBE = SPI2STATbits.SPIRBE = 1;	//rx fifos empty
+	for (n = 0; n < 2; n++) {
+		_testChain(n);
+		_testFull(n);
+		_testCallbackQueue(n);
+	}
+	return TEST_END();
+}
@@ -0,0 +1,116 @@
+//host test: ticks64() / millis64() across coreticks() wraps after a user reconfigures tmr2
+//the extension has to survive tmr2Init() (16-bit, any period) and tmr23Init() (32-bit, T2IF never fires):
+//it is kept by the tmr2 isr, the core timer isr or by the reads themselves, any one of them once per wrap
+//built with USE_DFS too: ticks() keeps counting F_SYSMAX cycles across clock changes
+#include "../pic32duino.h"
+#define main pic32duino_main
+#include "../pic32duino.c"
+#undef main
+#include "test.h"
+
+#define WRAP				(1ull << 32)	//coreticks() period
+
+static uint64_t _t;									//expected ticks64()
+
+//coreticks() = 2 * core timer count
+static void _step(uint32_t t) {mock_count += t / 2; _t += t;}
+
+//milliseconds since the start of the test, exact vs millis64()
+static void _checkTime(uint64_t t0, uint64_t ms0) {
+	uint64_t exact = (_t - t0) * 1000 / SystemCoreClock, ms = millis64() - ms0;
+
+	TEST(ms == exact || ms == exact + 1 || ms + 1 == exact);
+}
+
+//n wraps in steps of a third of a wrap, with isr() after each step and no reads in between
+static void _run(void (*isr)(void), uint8_t n) {
+	uint64_t t0 = ticks64(), ms0 = millis64();
+	uint8_t i;
+
+	_t = t0;
+	for (i = 0; i < 3 * n; i++) {
+		_step(0x55555554ul);
+		if (isr) isr();
+	}
+	TEST(ticks64() == _t);
+	TEST(ticks64() - t0 == (uint64_t) n * 0x55555554ul * 3);
+	_checkTime(t0, ms0);
+}
+
+//the tmr2 isr the way the hardware raises it: only with T2IE on
+static void _t2(void) {if (IEC0bits.T2IE) _T2Interrupt();}
+
+//user tmr2 at another period: the tmr2 isr keeps the time base
+static void _testTmr2(void) {
+	uint32_t s;
+
+	systick_count = 0x12340000ul;
+	s = systick_count;
+	tmr2Init(TMR_PS8x, 1000);
+	TEST(IEC0bits.T2IE == 1);						//time base isr left on
+	TEST(systick_count == s);						//extension not reset
+	_run(_t2, 3);
+}
+
+//user tmr23 (32-bit): no T2IF, the core timer isr keeps the time base
+static void _testTmr23(void) {
+	tmr23Init(TMR_PS1x, 100000ul);
+	TEST(T2CONbits.T32 == 1);
+	coretimerAttachISR(empty_handler);
+	_run(CoreTimerHandler, 3);
+}
+
+//no interrupt at all: reads alone, once per third of a wrap
+static void _read(void) {(void) ticks64();}
+static void _testReads(void) {
+	_run(_read, 4);
+}
+
+#if defined(USE_DFS)
+//coreticks() step t at the current clock, in F_SYSMAX cycles
+static uint32_t _max(uint32_t t) {return (uint64_t) t * F_TICK / SystemCoreClock;}
+
+//ticks() = dfsticks() runs at F_TICK = F_SYSMAX at every clock, wraps included
+static void _testDfsTicks(void) {
+	static const uint32_t osccon[4] = {CLKCOSC_FRC, CLKCOSC_FRCDIV | CLKFRCDIV_2, CLKCOSC_FRCDIV | CLKFRCDIV_256, CLKCOSC_FRC};
+	uint32_t t0, dt, st, exp;
+	uint8_t i, k;
+
+	for (i = 0; i < 4; i++) {
+		OSCCON = osccon[i];
+		SystemCoreClockUpdate();
+		st = (SystemCoreClock / 4) & ~1ul;			//about a quarter of a second at this clock
+		for (k = 0; k < 120; k++) {					//30s at each clock: ticks() wraps (every ~107s) on the way
+			t0 = ticks();
+			_step(st);
+			dt = ticks() - t0;
+			TEST(dt + 1 >= _max(st) && dt <= _max(st) + 1);
+		}
+	}
+	t0 = ticks();									//an interval across a clock change
+	st = SystemCoreClock / 2;
+	_step(st);
+	exp = _max(st);
+	OSCCON = CLKCOSC_FRCDIV | CLKFRCDIV_4;
+	SystemCoreClockUpdate();
+	_step(SystemCoreClock / 2);
+	exp += _max(SystemCoreClock / 2);
+	dt = ticks() - t0;
+	TEST(dt + 2 >= exp && dt <= exp + 2);
+	TEST(exp + 2 >= F_TICK && exp <= F_TICK + 2);	//one second
+}
+#endif
+
+int main(void) {
+	OSCCON = CLKCOSC_FRC;
+	SystemCoreClockUpdate();
+	mock_count = 0x7ffffff0ul;						//coreticks() close to a wrap
+	_t = ticks64();
+	_testTmr2();
+	_testTmr23();
+	_testReads();
+#if defined(USE_DFS)
+	_testDfsTicks();
+#endif
+	return TEST_END();
+}
@@ -0,0 +1,62 @@
+//host test: ticks2us() / ticks2ms() / us2ticks() / ms2ticks() at every clock SystemCoreClockUpdate() can read back
+//each conversion is compared with the exact 64-bit x * num / den: at most 1 unit off wherever the exact result fits 32 bits
+#include "../pic32duino.h"
+#define main pic32duino_main
+#include "../pic32duino.c"
+#undef main
+#include "test.h"
+
+static uint32_t _maxerr[4];							//worst error seen, per conversion
+static const char *_name[4] = {"ticks2us", "ticks2ms", "us2ticks", "ms2ticks"};
+
+//exact x * num / den vs the reciprocal, for one conversion at the current clock
+static void _check(uint8_t c, uint32_t x, uint32_t got, uint64_t num, uint64_t den) {
+	uint64_t exact = (uint64_t) x * num / den;
+	uint32_t err;
+
+	if (exact >> 32) return;						//out of range for a 32-bit result
+	err = (got > exact) ? got - exact : exact - got;
+	if (err > _maxerr[c]) _maxerr[c] = err;
+	if (err > 1) printf("%s(%lu) at %luHz: %lu, exact %llu\n", _name[c], (unsigned long) x, (unsigned long) SystemCoreClock, (unsigned long) got, (unsigned long long) exact);
+	TEST(err <= 1);
+}
+
+//all four conversions over a spread of inputs at the clock osccon selects
+static void _sweep(uint32_t osccon) {
+	uint32_t i, x, seed = 12345;
+	uint64_t f;
+
+	OSCCON = osccon;
+	SystemCoreClockUpdate();						//refreshes the conversions
+	f = SystemCoreClock;
+	for (i = 0; i < 2000; i++) {
+		if (i < 64) x = (i & 1) ? (1ul << (i >> 1)) : (1ul << (i >> 1)) - 1;	//2^k and 2^k - 1
+		else if (i < 80) x = 0xfffffffful - (i - 64);	//the top of the range
+		else x = (seed = seed * 1664525ul + 1013904223ul) >> (i % 32);	//pseudo random, all magnitudes
+		_check(0, x, ticks2us(x), 1000000ul, f);
+		_check(1, x, ticks2ms(x), 1000, f);
+		_check(2, x, us2ticks(x), f, 1000000ul);
+		_check(3, x, ms2ticks(x), f, 1000);
+	}
+}
+
+int main(void) {
+	static const uint32_t frcdiv[8] = {CLKFRCDIV_1, CLKFRCDIV_2, CLKFRCDIV_4, CLKFRCDIV_8, CLKFRCDIV_16, CLKFRCDIV_32, CLKFRCDIV_64, CLKFRCDIV_256};
+	static const uint32_t other[5] = {CLKCOSC_FRC16, CLKCOSC_LPRC, CLKCOSC_SOSC, CLKCOSC_POSC, CLKCOSC_FRC};
+	static const uint32_t pll[2] = {CLKCOSC_POSCPLL, CLKCOSC_FRCPLL};
+	uint8_t i, d, m, o;
+	uint32_t nclk = 0;
+
+	for (i = 0; i < 8; i++) {_sweep(CLKCOSC_FRCDIV | frcdiv[i]); nclk++;}
+	for (i = 0; i < 5; i++) {_sweep(other[i]); nclk++;}
+	for (i = 0; i < 2; i++)							//every FPLLIDIV x PLLMULT x PLLODIV
+		for (d = 0; d < 8; d++)
+			for (m = 0; m < 8; m++)
+				for (o = 0; o < 8; o++) {
+					DEVCFG2bits.FPLLIDIV = d;
+					_sweep(pll[i] | ((uint32_t) m << 16) | ((uint32_t) o << 27));
+					nclk++;
+				}
+	for (i = 0; i < 4; i++) printf("%s: max error %lu over %lu clocks\n", _name[i], (unsigned long) _maxerr[i], (unsigned long) nclk);
+	return TEST_END();
+}
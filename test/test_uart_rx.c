@@ -0,0 +1,152 @@
+//host test: uart1 / uart2 reception - the rx drain in uartNAvailable() / uartNRead() / _UNInterrupt(), replaying overrun bursts
+//an overrun must be cleared only after the fifo has been read out: clearing OERR empties the fifo
+#include "mock/uart.h"
+#include "../pic32duino.h"
+#define main pic32duino_main
+#include "../pic32duino.c"
+#undef main
+#include "test.h"
+
+//one uart under test
+typedef struct {
+	MOCK_UartTypeDef *m;
+	void (*init)(unsigned long baud_rate);
+	uint16_t (*avail)(void);
+	uint16_t (*rd)(uint8_t *buf, uint16_t n);
+	volatile UART_ErrTypeDef *(*err)(void);
+	void (*isr)(void);							//rx interrupt, flags raised
+	uint16_t size;								//rx ring buffer size
+} UART_TestTypeDef;
+
+static void _isr1(void) {IFS1bits.U1RXIF = 1; _U1Interrupt();}
+static void _isr2(void) {IFS1bits.U2RXIF = 1; _U2Interrupt();}
+static const UART_TestTypeDef _uart[2] = {
+	{&mock_u1, uart1Init, uart1Available, uart1Read, uart1Errors, _isr1, U1RX_BUFSIZE},
+	{&mock_u2, uart2Init, uart2Available, uart2Read, uart2Errors, _isr2, U2RX_BUFSIZE},
+};
+
+static void _reset(const UART_TestTypeDef *u) {
+	u->init(UART_BR115200);
+	mockSync(u->m);
+	u->m->rxn = 0;
+	u->m->bits.OERR = 0;
+	u->m->rxlost = 0;
+}
+
+//n chars from c0 on the rx line
+static void _send(const UART_TestTypeDef *u, uint8_t c0, uint8_t n, uint8_t err) {
+	while (n--) mockRx(u->m, c0++, err);
+}
+
+//chars below the interrupt threshold are picked up by the reader
+static void _testRead(const UART_TestTypeDef *u) {
+	uint8_t buf[16];
+
+	_reset(u);
+	_send(u, 'a', 3, 0);
+	TEST(u->avail() == 3);
+	TEST((u->rd(buf, sizeof(buf)) == 3) && (memcmp(buf, "abc", 3) == 0));
+	TEST(u->avail() == 0);
+	_send(u, 'x', 2, 0);
+	TEST((u->rd(buf, 1) == 1) && (buf[0] == 'x'));	//a short read leaves the rest
+	TEST((u->rd(buf, 1) == 1) && (buf[0] == 'y'));
+}
+
+//a burst overruns the fifo: what is in the fifo is kept, then the receiver is restarted
+static void _testOverrun(const UART_TestTypeDef *u) {
+	uint8_t buf[16];
+
+	_reset(u);
+	_send(u, '0', 10, 0);						//4 kept, 6 lost
+	TEST(u->m->bits.OERR && (u->m->rxlost == 6));
+	TEST((u->rd(buf, sizeof(buf)) == 4) && (memcmp(buf, "0123", 4) == 0));	//read out before OERR is cleared
+	mockSync(u->m);
+	TEST(u->m->bits.OERR == 0);					//receiver restarted
+	TEST(u->err()->OERR == 1);
+	TEST(u->err()->DROPPED == 0);
+	_send(u, 'A', 3, 0);						//and receiving again
+	TEST((u->rd(buf, sizeof(buf)) == 3) && (memcmp(buf, "ABC", 3) == 0));
+	TEST(u->err()->OERR == 1);
+	//the same from the isr
+	_send(u, '0', 6, 0);
+	u->isr();
+	mockSync(u->m);
+	TEST(u->m->bits.OERR == 0);
+	TEST(u->err()->OERR == 2);
+	TEST((u->rd(buf, sizeof(buf)) == 4) && (memcmp(buf, "0123", 4) == 0));
+}
+
+//framing / parity errors are counted per char, the chars are kept
+static void _testErrors(const UART_TestTypeDef *u) {
+	uint8_t buf[16];
+
+	_reset(u);
+	mockRx(u->m, 'a', MOCK_FERR);
+	mockRx(u->m, 'b', 0);
+	mockRx(u->m, 'c', MOCK_PERR);
+	mockRx(u->m, 'd', MOCK_FERR | MOCK_PERR);
+	TEST((u->rd(buf, sizeof(buf)) == 4) && (memcmp(buf, "abcd", 4) == 0));
+	TEST((u->err()->FERR == 2) && (u->err()->PERR == 2));
+	TEST((u->err()->OERR == 0) && (u->err()->DROPPED == 0));
+}
+
+//the ring buffer fills up: the oldest chars are kept, the rest counted as dropped
+static void _testFull(const UART_TestTypeDef *u) {
+	uint8_t buf[256];
+	uint16_t i, n;
+
+	_reset(u);
+	for (i=0; i<u->size + 16; i += 4) {_send(u, i, 4, 0); u->isr();}
+	TEST(u->err()->DROPPED == 16);
+	TEST(u->err()->OERR == 0);
+	n = u->rd(buf, sizeof(buf));
+	TEST(n == u->size);
+	for (i=0; (i<n) && (buf[i] == (uint8_t) i); i++) continue;
+	TEST(i == u->size);
+}
+
+//random bursts, isr runs and reads: every char is delivered in order or accounted for as lost
+static void _testBursts(const UART_TestTypeDef *u) {
+	uint8_t buf[64];
+	uint32_t sent = 0, next = 0, got = 0, ovr = 0, bad = 0, seed = 7, i, n, k;
+
+	_reset(u);
+	for (i=0; i<20000; i++) {
+		seed = seed * 1664525ul + 1013904223ul;
+		n = 1 + ((seed >> 24) & 7);				//burst of 1..8 chars
+		while (n--) {
+			mockSync(u->m);
+			if ((u->m->bits.OERR == 0) && (u->m->rxn == MOCK_FIFO)) ovr += 1;	//this one overruns the fifo
+			mockRx(u->m, sent++, 0);
+		}
+		switch ((seed >> 16) & 3) {				//then the isr, a read, or nothing
+		case 0: u->isr(); break;
+		case 1:
+			n = u->rd(buf, 1 + ((seed >> 8) & 63));
+			for (k=0; k<n; k++) {
+				while (((next & 0xff) != buf[k]) && (next < sent)) next++;	//skip the lost ones
+				if (next == sent) bad += 1; else next++;
+			}
+			got += n;
+			break;
+		}
+	}
+	while ((n = u->rd(buf, sizeof(buf))) != 0) got += n;
+	TEST(bad == 0);								//in order
+	TEST(u->err()->OERR == ovr);				//one count per overrun
+	TEST(got + u->m->rxlost + u->err()->DROPPED == sent);	//nothing unaccounted for
+	TEST(u->m->rxlost > 0);						//the replay did overrun
+}
+
+int main(void) {
+	uint8_t i;
+
+	for (i=0; i<2; i++) {
+		_testRead(&_uart[i]);
+		_testOverrun(&_uart[i]);
+		_testErrors(&_uart[i]);
+		_testFull(&_uart[i]);
+		_testBursts(&_uart[i]);
+	}
+	return TEST_END();
+}
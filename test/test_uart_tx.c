@@ -0,0 +1,84 @@
+//host test: the uart2 tx ring buffer - uart2Putch() and the tx half of _U2Interrupt()
+//built once per overflow policy: -DTEST_OVF=UART_OVF_BLOCK / UART_OVF_DROPNEW / UART_OVF_DROPOLD
+#include "mock/uart.h"
+#include "../pic32duino.h"
+#undef U2TX_OVERFLOW
+#define U2TX_OVERFLOW		TEST_OVF
+#define main pic32duino_main
+#include "../pic32duino.c"
+#undef main
+#include "test.h"
+
+#define N					200					//chars sent, well over U2TX_BUFSIZE + the fifo
+
+//the line goes idle: the isr refills the fifo until the ring is empty
+static void _flush(void) {
+	uint32_t i;
+
+	for (i=0; (i<10000) && (mock_u2.txn || (_u2tx_head != _u2tx_tail)); i++) {
+		mockShift(&mock_u2, MOCK_FIFO);
+		IFS1bits.U2TXIF = 1;					//fifo empty
+		_U2Interrupt();
+	}
+}
+
+//chars on the line are in the order sent, nothing on the line was written to a full fifo
+static void _testOrder(void) {
+	uint32_t i;
+
+	uart2Init(UART_BR115200);
+	mock_u2.nout = 0;
+	for (i=0; i<3 * U2TX_BUFSIZE; i++) {
+		uart2Putch('a' + (i % 26));
+		if ((i % 5) == 4) {mockShift(&mock_u2, 5); IFS1bits.U2TXIF = 1; _U2Interrupt();}	//the line keeps up, at an odd phase
+	}
+	_flush();
+	TEST(mock_u2.nout == 3 * U2TX_BUFSIZE);
+	for (i=0; i<mock_u2.nout; i++) if (mock_u2.out[i] != 'a' + (i % 26)) break;
+	TEST(i == 3 * U2TX_BUFSIZE);
+	TEST(uart2TxDropped() == 0);
+	TEST(mock_u2.txover == 0);
+}
+
+//N chars with the line stalled: the policy decides what gets through
+static void _testOverflow(void) {
+	uint32_t i, first, nring = MOCK_FIFO + U2TX_BUFSIZE;	//fifo + ring
+
+	uart2Init(UART_BR115200);
+	mock_u2.nout = 0;
+	mock_u2.drain = (TEST_OVF == UART_OVF_BLOCK);	//blocking needs the line to move
+	for (i=0; i<N; i++) uart2Putch(i);
+	mock_u2.drain = 0;
+	_flush();
+	TEST(mock_u2.txover == 0);
+#if   TEST_OVF == UART_OVF_DROPNEW
+	//the first ones get through, the rest is dropped
+	TEST(uart2TxDropped() == N - nring);
+	TEST(mock_u2.nout == nring);
+	for (i=0; i<mock_u2.nout; i++) if (mock_u2.out[i] != (uint8_t) i) break;
+	TEST(i == nring);
+	(void) first;
+#elif TEST_OVF == UART_OVF_DROPOLD
+	//what was in the fifo, then the last U2TX_BUFSIZE chars
+	TEST(uart2TxDropped() == N - nring);
+	TEST(mock_u2.nout == nring);
+	for (i=0; i<MOCK_FIFO; i++) if (mock_u2.out[i] != (uint8_t) i) break;
+	TEST(i == MOCK_FIFO);
+	first = N - U2TX_BUFSIZE;
+	for (i=MOCK_FIFO; i<mock_u2.nout; i++) if (mock_u2.out[i] != (uint8_t) (first + i - MOCK_FIFO)) break;
+	TEST(i == nring);
+#else
+	//everything gets through, in order
+	TEST(uart2TxDropped() == 0);
+	TEST(mock_u2.nout == N);
+	for (i=0; i<mock_u2.nout; i++) if (mock_u2.out[i] != (uint8_t) i) break;
+	TEST(i == N);
+	(void) first; (void) nring;
+#endif
+}
+
+int main(void) {
+	_testOrder();
+	_testOverflow();
+	return TEST_END();
+}
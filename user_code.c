@@ -49,13 +49,79 @@
 
 //hardware configuration
 #define LED			PB7					//led pin
-#define LED_DLY		(F_CPU / 2)			//duration of delay
+#define LED_DLY		(F_TICK / 2)			//duration of delay, in ticks()
 //end hardware configuration
 
 //global defines
 
 //global variables
 
+//benchmark only: analogRead() as it was before the AN-channel table - a switch on ch and ANSELx / CH0SA written every call
+//the baseline for the analogRead() benchmark in loop(). don't use it otherwise: it doesn't clear DONE, so it can return the previous conversion
+uint16_t analogReadSwitch(uint16_t ch) {
+	//int i;
+
+	AD1CON1bits.SAMP = 0;			// |= (1<<1);			//1->set SAMP to start sampling, 0->stop sampling and start conversion
+	ch = ch & 0x0f;					//0..15 is valid input
+	//pin lay-out may change
+	//below is for pic32mx1xx/2xx/3xx pdip
+	switch (ch) {
+	case ADC_AN0:
+		ANSELA |= (1<<0);
+		break;	//AN0 = RA0
+	case ADC_AN1:
+		ANSELA |= (1<<1);
+		break;	//AN1 = RA1
+	case ADC_AN2:
+		ANSELB |= (1<<0);
+		break;	//AN2 = RB0
+	case ADC_AN3:
+		ANSELB |= (1<<1);
+		break;	//AN3 = RB1
+	case ADC_AN4:
+		ANSELB |= (1<<2);
+		break;	//AN4 = RB2
+	case ADC_AN5:
+		ANSELB |= (1<<3);
+		break;	//AN5 = RB3
+#if defined(_PORTC)
+	case ADC_AN6:
+		ANSELC |= (1<<0);
+		break;	//AN6 = RC0
+	case ADC_AN7:
+		ANSELC |= (1<<1);
+		break;	//AN7 = RC1
+	case ADC_AN8:
+		ANSELC |= (1<<2);
+		break;	//AN8 = RC2
+#endif
+	case ADC_AN9:
+		ANSELB |= (1<<15);
+		break;	//AN9 = RB15
+	case ADC_AN10:
+		ANSELB |= (1<<14);
+		break;	//AN10= RB14
+	case ADC_AN11:
+		ANSELB |= (1<<13);
+		break;	//AN11= RB13
+	case ADC_AN12:
+		ANSELB |= (1<<12);
+		break;	//AN12= RB12
+		//case ADC_AN13:ANSELB |= (1<<0); break;	//AN13= CTMUT
+		//case ADC_AN14:ANSELB |= (1<<0); break;	//AN14= Internal Vref
+		//case ADC_AN15:ANSELB |= (1<<0); break;	//AN15= Open
+	}
+	AD1CHSbits.CH0SA = ch;			//set Ch0 positive input
+	//start the conversion
+	//for (i=0; i<10000; i++);
+	AD1CON1bits.SAMP = 1;			// |= (1<<1);			//1->set SAMP to start sampling, 0->stop sampling and start conversion
+	//clear the DONE bit -> it is persistent in manual mode
+	//AD1CON1bits.DONE = 0;
+	//wait for the previous conversion to end
+	while (AD1CON1bits.DONE == 0) continue;	//0->conversion on going, 1->conversion done
+	return ADC1BUF0;
+}
+
 //user defined set up code
 void setup(void) {
 	pinMode(LED, OUTPUT);				//led as output pin
@@ -64,6 +130,9 @@ void setup(void) {
 	//uart1Init(UART_BR9600);				//initialize uart1
 	uart2Init(UART_BR9600);				//initialize uart2
 
+	//adcInit();							//initialize the adc
+	//analogRead(ADC_AN0);				//select the channel ahead of the benchmark
+
 	ei();
 }
 
@@ -84,9 +153,26 @@ void loop(void) {
 		tmp0=ticks();
 		//something to measure
 		//dhrystone();					//dhrystone benchmark
+		//digitalWrite(LED, HIGH);		//runtime pin: GPIO_PinDef[] lookup
+		//digitalWriteFast(LED, HIGH);	//constant pin: single LATxSET store
+		//pinFlip(LED);					//runtime pin: digitalRead + digitalWrite
+		//pinToggle(LED);				//constant pin: single LATxINV store
+		//shiftOut(PB2, PB3, MSBFIRST, 0x55);			//8 bits, runtime pins: bit-bang
+		//shiftOutFast(PB2, PB3, MSBFIRST, 0x55);		//8 bits, constant pins: LATxSET/LATxCLR only
+		//shiftOut(SDO1PIN, SCK1PIN, MSBFIRST, 0x55);	//8 bits through spi1 (spi1Init() with CKE=1 first)
+		//analogRead(ADC_AN0);			//blocking read, same channel: no ANSEL/CH0SA writes
+		//analogRead(ADC_AN0 + (tick0 & 1));	//blocking read, alternating channels: ANSEL/CH0SA written every call
+		//analogReadStart(ADC_AN0);		//non-blocking: cpu time to start a conversion
+		//analogReadSwitch(ADC_AN0);		//baseline: the switch-based analogRead() the table replaced, same channel
+		//analogReadSwitch(ADC_AN0 + (tick0 & 1));	//baseline, alternating channels
 		tmp0=ticks() - tmp0;
 
 		//display information
+		//profileReport(uart2Putch);		//PROFILE_BEGIN(id)/PROFILE_END(id) regions, with USE_PROFILE defined
+		//isrReport(uart2Putch);			//per-vector isr count / run time / latency, with USE_ISRSTATS defined
+		//pmdReport(uart2Putch);			//powered modules and their references
+		//u2Print("boot setup() =         ", bootTicksSetup());	//ticks from reset, with USE_BOOTTICKS defined
+		//u2Print("boot loop()  =         ", bootTicksLoop());
 		u2Print("F_CPU=                 ", F_CPU);
 		u2Print("ticks=                 ", ticks());
 		u2Print("tmp0 =                 ", tmp0);